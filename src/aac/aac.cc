@@ -9,6 +9,8 @@
 #include <libfauxdcore/plugin.h>
 #include <libfauxdcore/runtime.h>
 
+#include "adts-index.h"
+
 class AACDecoder : public InputPlugin
 {
 public:
@@ -272,30 +274,26 @@ bool AACDecoder::read_tag (const char * filename, VFSFile & file, Tuple & tuple,
     if (channels > 0)
         tuple.set_int (Tuple::Channels, channels);
 
-    tuple.fetch_stream_info (file);
-
-    return true;
-}
-
-static void aac_seek (VFSFile & file, NeAACDecHandle dec, int time, int len,
- void * buf, int size, int * buflen)
-{
-    /* == ESTIMATE BYTE OFFSET == */
+    /* exact figures, if playback has been through the whole file */
+    ADTSIndex index;
+    index.load (filename, file);
 
-    int64_t total = file.fsize ();
-    if (total < 0)
+    if (index.complete () && index.samples () > 0)
     {
-        AUDERR ("File is not seekable.\n");
-        return;
+        int64_t ms = index.samples () * 1000 / index.rate ();
+        tuple.set_int (Tuple::Length, ms);
+        if (ms > 0)
+            tuple.set_int (Tuple::Bitrate, index.bytes () * 8 / ms);
     }
 
-    /* == SEEK == */
-
-    if (file.fseek (total * time / len, VFS_SEEK_SET))
-        return;
+    tuple.fetch_stream_info (file);
 
-    * buflen = file.fread (buf, 1, size);
+    return true;
+}
 
+/* Starts decoding after a seek, at the first frame header in <buf>. */
+static void aac_restart (VFSFile & file, NeAACDecHandle dec, void * buf, int size, int * buflen)
+{
     /* == FIND FRAME HEADER == */
 
     int used = aac_probe ((unsigned char *) buf, * buflen);
@@ -334,12 +332,67 @@ static void aac_seek (VFSFile & file, NeAACDecHandle dec, int time, int len,
     }
 }
 
+static void aac_seek (VFSFile & file, NeAACDecHandle dec, int time, int len,
+ void * buf, int size, int * buflen)
+{
+    /* == ESTIMATE BYTE OFFSET == */
+
+    int64_t total = file.fsize ();
+    if (total < 0)
+    {
+        AUDERR ("File is not seekable.\n");
+        return;
+    }
+
+    /* == SEEK == */
+
+    if (file.fseek (total * time / len, VFS_SEEK_SET))
+        return;
+
+    * buflen = file.fread (buf, 1, size);
+    aac_restart (file, dec, buf, size, buflen);
+}
+
+/* Seeks to exactly <time> (ms) with the ADTS index.  Decoding starts at the
+ * indexed frame before it; <skip> is set to the samples (at the ADTS rate)
+ * to drop. */
+static bool aac_seek_index (VFSFile & file, NeAACDecHandle dec, ADTSIndex & index,
+ int time, void * buf, int size, int * buflen, int64_t * skip)
+{
+    /* without the rate, every time would come out as sample 0 */
+    if (! index.rate ())
+        return false;
+
+    int64_t sample = (int64_t) time * index.rate () / 1000;
+    int64_t offset, frame_sample;
+    int64_t resume = file.ftell ();
+
+    /* not played that far yet: read ahead through the headers */
+    if (! index.complete () && sample >= index.samples ())
+        index.scan (file, sample);
+
+    if (! index.find (sample, offset, frame_sample) || file.fseek (offset, VFS_SEEK_SET))
+    {
+        file.fseek (resume, VFS_SEEK_SET);  // carry on where we were
+        return false;
+    }
+
+    * buflen = file.fread (buf, 1, size);
+    * skip = sample - frame_sample;
+
+    aac_restart (file, dec, buf, size, buflen);
+    return true;
+}
+
 bool AACDecoder::play (const char * filename, VFSFile & file)
 {
     NeAACDecHandle decoder = 0;
     NeAACDecConfigurationPtr decoder_config;
     unsigned long samplerate = 0;
     unsigned char channels = 0;
+    ADTSIndex index;
+    bool indexed = false;
+    int64_t skip = 0;  /* samples (at the ADTS rate) to drop after a seek */
 
     Tuple tuple = get_playback_tuple ();
     int bitrate = 1000 * aud::max (0, tuple.get_int (Tuple::Bitrate));
@@ -418,6 +471,18 @@ bool AACDecoder::play (const char * filename, VFSFile & file)
         buflen += file.fread (buf + buflen, 1, sizeof (buf) - buflen);
     }
 
+    /* == NOTE FRAME OFFSETS (ADTS ONLY) == */
+
+    int rate_index, frame_samples;
+
+    if (buflen >= 7 && adts_frame_info (buf, & rate_index, & frame_samples) &&
+     file.fsize () >= 0)
+    {
+        indexed = true;
+        index.load (filename, file);
+        index.start (file.ftell () - buflen, rate_index);
+    }
+
     /* == CHECK FOR METADATA == */
 
     if (tuple.fetch_stream_info (file))
@@ -440,14 +505,35 @@ bool AACDecoder::play (const char * filename, VFSFile & file)
         if (seek_value >= 0)
         {
             int length = tuple.get_int (Tuple::Length);
-            if (length > 0)
+            bool was_complete = index.complete ();
+
+            skip = 0;
+
+            if (indexed && aac_seek_index (file, decoder, index, seek_value,
+             buf, sizeof buf, & buflen, & skip))
+            {
+                /* reading ahead may have found the true length */
+                if (index.complete () && ! was_complete)
+                {
+                    tuple.set_int (Tuple::Length, index.samples () * 1000 / index.rate ());
+                    set_playback_tuple (tuple.ref ());
+                }
+            }
+            else if (length > 0)
                 aac_seek (file, decoder, seek_value, length, buf, sizeof buf, & buflen);
         }
 
         /* == CHECK FOR END OF FILE == */
 
         if (! buflen)
+        {
+            /* played through: what is left is a tag at most */
+            int64_t size = file.fsize ();
+            if (indexed && index.known_end () >= 0 && size - index.known_end () < 65536)
+                index.scan (file, -1);
+
             break;
+        }
 
         /* == CHECK FOR METADATA == */
 
@@ -476,6 +562,9 @@ bool AACDecoder::play (const char * filename, VFSFile & file)
 
         if ((used = info.bytesconsumed))
         {
+            if (indexed)
+                index.add (buf, used, file.ftell () - buflen);
+
             buflen -= used;
             memmove (buf, buf + used, buflen);
             buflen += file.fread (buf + buflen, 1, sizeof buf - buflen);
@@ -483,10 +572,30 @@ bool AACDecoder::play (const char * filename, VFSFile & file)
 
         /* == PLAY THE SOUND == */
 
+        if (audio && info.samples && skip > 0 && info.channels && info.samplerate)
+        {
+            /* after an exact seek: drop what comes before the target */
+            int frames = info.samples / info.channels;
+            int64_t frame_skip = skip * info.samplerate / index.rate ();
+
+            if (frame_skip >= frames)
+            {
+                skip -= (int64_t) frames * index.rate () / info.samplerate;
+                continue;
+            }
+
+            audio = (float *) audio + frame_skip * info.channels;
+            info.samples -= frame_skip * info.channels;
+            skip = 0;
+        }
+
         if (audio && info.samples)
             write_audio (audio, sizeof (float) * info.samples);
     }
 
+    if (indexed)
+        index.save ();
+
     NeAACDecClose (decoder);
     return true;
 
@@ -0,0 +1,320 @@
+/*
+ * ADTS frame index for the AAC plugin
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <libfauxdcore/audstrings.h>
+#include <libfauxdcore/runtime.h>
+#include <libfauxdcore/vfs.h>
+
+#include "adts-index.h"
+#include "../cache-common/cache-files.h"
+
+#define INDEX_DIR "aac-index"
+#define MAX_INDEXES 1000   /* files kept in INDEX_DIR */
+#define SCAN_BLOCK 65536
+#define MAX_FRAME 8191     /* 13-bit frame length */
+
+static const int adts_rates[] =
+ {96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000};
+
+int adts_frame_info (const unsigned char * p, int * rate_index, int * samples)
+{
+    /* syncword, and layer 0 */
+    if (p[0] != 0xff || (p[1] & 0xf6) != 0xf0)
+        return 0;
+
+    int sr = (p[2] >> 2) & 0x0f;
+    if (sr > 11)
+        return 0;
+
+    int header = (p[1] & 1) ? 7 : 9;  // 2 more with a CRC
+    int len = ((p[3] & 0x03) << 11) | (p[4] << 3) | (p[5] >> 5);
+    if (len <= header)
+        return 0;
+
+    * rate_index = sr;
+    * samples = 1024 * ((p[6] & 0x03) + 1);
+    return len;
+}
+
+void ADTSIndex::load (const char * filename, VFSFile & file)
+{
+    int64_t size = file.fsize ();
+    if (size < 0)
+        return;
+
+    /* local files are keyed by modification time too */
+    long long mtime = 0;
+    if (! strncmp (filename, "file://", 7))
+    {
+        StringBuf path = uri_to_filename (filename);
+        struct stat st;
+        if (path && ! stat (path, & st))
+            mtime = st.st_mtime;
+    }
+
+    m_key = String (str_printf ("%s\t%lld\t%lld", filename, (long long) size, mtime));
+
+    m_uri = String (cache_hashed_uri (INDEX_DIR, filename));
+
+    VFSFile in (m_uri, "r");
+    if (! in)
+        return;
+
+    Index<char> data = in.read_all ();
+    data.append (0);
+
+    char * p = data.begin ();
+    char * nl = strchr (p, '\n');
+    if (! nl)
+        return;
+
+    * nl = 0;
+    if (strcmp (p, m_key))
+        return;  // file changed
+
+    /* "rate_index first next samples bytes complete", then "offset sample"
+     * per point */
+    p = nl + 1;
+    long long head[6];
+    for (long long & v : head)
+    {
+        char * end;
+        v = strtoll (p, & end, 10);
+        if (end == p)
+            return;
+        p = end;
+    }
+
+    if (head[0] < 0 || head[0] > 11 || head[1] < 0 || head[2] < head[1])
+        return;
+
+    Index<Point> points;
+    while (1)
+    {
+        char * end;
+        Point pt;
+
+        pt.offset = strtoll (p, & end, 10);
+        if (end == p)
+            break;
+
+        p = end;
+        pt.sample = strtoll (p, & end, 10);
+        if (end == p)
+            return;
+
+        p = end;
+        points.append (pt);
+    }
+
+    m_rate_index = head[0];
+    m_rate = adts_rates[m_rate_index];
+    m_first = head[1];
+    m_next = head[2];
+    m_samples = head[3];
+    m_bytes = head[4];
+    m_complete = head[5];
+    m_points = std::move (points);
+
+    /* used again: move it to the back of the pruning order */
+    cache_touch (m_uri);
+
+    AUDDBG ("Loaded ADTS index (%d points%s).\n", m_points.len (), m_complete ? ", complete" : "");
+}
+
+void ADTSIndex::save ()
+{
+    if (! m_uri || ! m_changed)
+        return;
+
+    cache_make_dir (INDEX_DIR);
+
+    VFSFile out (m_uri, "w");
+    if (! out)
+    {
+        AUDERR ("Could not write %s.\n", (const char *) m_uri);
+        return;
+    }
+
+    StringBuf head = str_printf ("%s\n%d %lld %lld %lld %lld %d\n", (const char *) m_key,
+     m_rate_index, (long long) m_first, (long long) m_next, (long long) m_samples,
+     (long long) m_bytes, (int) m_complete);
+    out.fwrite (head, 1, head.len ());
+
+    for (const Point & pt : m_points)
+    {
+        StringBuf line = str_printf ("%lld %lld\n", (long long) pt.offset, (long long) pt.sample);
+        out.fwrite (line, 1, line.len ());
+    }
+
+    m_changed = false;
+    cache_prune (INDEX_DIR, MAX_INDEXES);
+}
+
+void ADTSIndex::start (int64_t offset, int rate_index)
+{
+    if (m_first < 0 && m_key)
+        m_first = m_next = offset;
+
+    if (m_rate_index < 0)
+    {
+        m_rate_index = rate_index;
+        m_rate = adts_rates[rate_index];
+    }
+}
+
+/* <header> is the frame at m_next */
+bool ADTSIndex::append (const unsigned char * header, int64_t offset)
+{
+    int rate_index, samples;
+    int len = adts_frame_info (header, & rate_index, & samples);
+
+    if (! len || (m_rate_index >= 0 && rate_index != m_rate_index))
+        return false;
+
+    if (m_rate_index < 0)
+    {
+        m_rate_index = rate_index;
+        m_rate = adts_rates[rate_index];
+    }
+
+    if (! m_points.len () || m_samples >= m_points[m_points.len () - 1].sample + m_rate)
+        m_points.append ({offset, m_samples});
+
+    m_samples += samples;
+    m_bytes += len;
+    m_next = offset + len;
+    m_changed = true;
+
+    return true;
+}
+
+void ADTSIndex::add (const unsigned char * frame, int len, int64_t offset)
+{
+    if (m_complete || m_next < 0 || offset != m_next || len < 7)
+        return;
+
+    int rate_index, samples;
+    if (adts_frame_info (frame, & rate_index, & samples) == len)
+        append (frame, offset);
+}
+
+void ADTSIndex::scan (VFSFile & file, int64_t sample)
+{
+    if (m_complete || m_next < 0 || file.fseek (m_next, VFS_SEEK_SET) < 0)
+        return;
+
+    unsigned char * buf = new unsigned char[SCAN_BLOCK];
+    int64_t pos = m_next;  // file offset of buf[0]
+    int len = 0, at = 0;
+    bool eof = false, lost = false;
+
+    while (sample < 0 || m_samples <= sample)
+    {
+        /* when looking for sync, keep enough to check the frame after */
+        if (len - at < (lost ? MAX_FRAME + 7 : 7) && ! eof)
+        {
+            memmove (buf, buf + at, len - at);
+            pos += at;
+            len -= at;
+            at = 0;
+
+            int got = file.fread (buf + len, 1, SCAN_BLOCK - len);
+            if (got < SCAN_BLOCK - len)
+                eof = true;
+
+            len += got;
+            continue;
+        }
+
+        if (len - at < 7)
+            break;
+
+        if (! lost)
+        {
+            /* only the header is needed, then skip the frame */
+            if (append (buf + at, pos + at))
+            {
+                if (m_next - pos <= len)
+                    at = m_next - pos;
+                else
+                {
+                    if (file.fseek (m_next, VFS_SEEK_SET) < 0)
+                        break;
+
+                    pos = m_next;
+                    len = at = 0;
+                }
+
+                continue;
+            }
+
+            lost = true;
+        }
+
+        /* junk, or a tag at the end: a header counts only if another one
+         * follows it */
+        int rate_index, samples, next_index;
+        int n = adts_frame_info (buf + at, & rate_index, & samples);
+
+        if (n && rate_index == m_rate_index && at + n + 7 <= len &&
+         adts_frame_info (buf + at + n, & next_index, & samples) && next_index == rate_index)
+        {
+            lost = false;
+            m_next = pos + at;
+        }
+        else
+            at ++;
+    }
+
+    if (eof && len - at < 7)
+    {
+        m_complete = true;
+        m_changed = true;
+        AUDDBG ("ADTS index complete: %lld samples at %d Hz.\n", (long long) m_samples, m_rate);
+    }
+
+    delete[] buf;
+}
+
+bool ADTSIndex::find (int64_t sample, int64_t & offset, int64_t & frame_sample) const
+{
+    if (! m_points.len () || (sample >= m_samples && ! m_complete))
+        return false;
+
+    int lo = 0, hi = m_points.len ();
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (m_points[mid].sample <= sample)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (! lo)
+        return false;
+
+    offset = m_points[lo - 1].offset;
+    frame_sample = m_points[lo - 1].sample;
+    return true;
+}
@@ -0,0 +1,86 @@
+/*
+ * ADTS frame index for the AAC plugin
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef AAC_ADTS_INDEX_H
+#define AAC_ADTS_INDEX_H
+
+#include <stdint.h>
+
+#include <libfauxdcore/index.h>
+#include <libfauxdcore/objects.h>
+
+class VFSFile;
+
+/* Where the ADTS frames of a file start, one point about every second, with
+ * the number of samples before each.  Built as playback reads through the
+ * file (add), or by reading just the frame headers (scan) when a seek goes
+ * past what is known; kept per file in the user's config directory, where
+ * only the most recently used are kept.  Samples are counted at the ADTS
+ * sample rate, i.e. without SBR. */
+class ADTSIndex
+{
+public:
+    /* loads what is known about <filename>, if anything */
+    void load (const char * filename, VFSFile & file);
+    void save ();
+
+    /* sets where the first frame is and its sample rate index, if not known
+     * yet, so that seeks can be placed before anything is decoded */
+    void start (int64_t offset, int rate_index);
+
+    /* notes a frame read at <offset>, if it follows the last one known */
+    void add (const unsigned char * frame, int len, int64_t offset);
+
+    /* reads headers from the last frame known until <sample> is covered (or
+     * to the end, if <sample> is negative); moves the read position */
+    void scan (VFSFile & file, int64_t sample);
+
+    /* the frame to start decoding at to get to <sample> */
+    bool find (int64_t sample, int64_t & offset, int64_t & frame_sample) const;
+
+    bool complete () const
+        { return m_complete; }
+    int rate () const
+        { return m_rate; }
+    int64_t samples () const
+        { return m_samples; }
+    int64_t bytes () const
+        { return m_bytes; }
+    int64_t known_end () const
+        { return m_next; }
+
+private:
+    struct Point {
+        int64_t offset, sample;
+    };
+
+    bool append (const unsigned char * header, int64_t offset);
+
+    String m_key, m_uri;
+    int m_rate_index = -1, m_rate = 0;
+    int64_t m_first = -1, m_next = -1;  // first frame, end of the last one known
+    int64_t m_samples = 0, m_bytes = 0;
+    bool m_complete = false, m_changed = false;
+    Index<Point> m_points;
+};
+
+/* returns the length of the ADTS frame at <p> (at least 7 bytes) or 0, and
+ * sets its sample rate index and samples */
+int adts_frame_info (const unsigned char * p, int * rate_index, int * samples);
+
+#endif
@@ -35,15 +35,30 @@
  *   entering pause.)
  * * After setting the pump_quit flag, signal on alsa_cond AND the poll_pipe
  *   before joining the thread.
+ *
+ * In low-latency mode, the software buffer is a lock-free single-producer/
+ * single-consumer ring instead, so write_audio() and get_delay() never take
+ * the mutex.  The pump still holds the mutex while it talks to ALSA, but it
+ * no longer waits on alsa_cond when the buffer runs dry; instead it sets
+ * ll_starved and sleeps in poll() on the pipe alone, and write_audio() writes
+ * to the pipe if it finds ll_starved set.  The pump publishes the hardware
+ * delay after each write so that get_delay() can interpolate from it.
  */
 
 #include <assert.h>
 #include <errno.h>
 #include <poll.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdint.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include <linux/capability.h>
+
+#include <atomic>
 
 #include <alsa/asoundlib.h>
 #include <libfauxdcore/ringbuf.h>
@@ -56,7 +71,7 @@ EXPORT ALSAPlugin aud_plugin_instance;
 do { \
     (value) = function (__VA_ARGS__); \
     if ((value) < 0) { \
-        CHECK (snd_pcm_recover, alsa_handle, (value), 0); \
+        CHECK (pcm_recover, (value)); \
         CHECK_VAL ((value), function, __VA_ARGS__); \
     } \
 } while (0)
@@ -76,6 +91,17 @@ static int alsa_channels, alsa_rate;
 
 static RingBuf<char> alsa_buffer;
 static int alsa_period; /* milliseconds */
+static bool alsa_mmap;
+static bool alsa_low_latency;
+static int alsa_xruns;
+
+/* low-latency mode only, see above */
+static char * ll_buffer;
+static unsigned ll_size;
+static std::atomic<unsigned> ll_read_pos, ll_write_pos;
+static std::atomic<bool> ll_starved;
+static std::atomic<int> ll_delay;        /* frames */
+static std::atomic<int64_t> ll_delay_time; /* nanoseconds, 0 = not running */
 
 static bool alsa_prebuffer, alsa_paused;
 static int alsa_paused_delay; /* milliseconds */
@@ -117,9 +143,9 @@ static bool poll_setup ()
     return true;
 }
 
-static void poll_sleep ()
+static void poll_sleep (bool pcm = true)
 {
-    if (poll (poll_handles, poll_count, -1) < 0)
+    if (poll (poll_handles, pcm ? poll_count : 1, -1) < 0)
     {
         AUDERR ("Failed to poll: %s.\n", strerror (errno));
         return;
@@ -147,8 +173,207 @@ static void poll_cleanup ()
     delete[] poll_handles;
 }
 
+static int64_t monotonic_ns ()
+{
+    timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, & ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int pcm_recover (int error)
+{
+    if (error == -EPIPE)
+    {
+        alsa_xruns ++;
+        AUDDBG ("Underrun (%d so far).\n", alsa_xruns);
+    }
+
+    return snd_pcm_recover (alsa_handle, error, 0);
+}
+
+static void ll_alloc (int bytes)
+{
+    ll_buffer = new char[bytes];
+    ll_size = bytes;
+    ll_read_pos = 0;
+    ll_write_pos = 0;
+    ll_starved = false;
+    ll_delay = 0;
+    ll_delay_time = 0;
+}
+
+static void ll_destroy ()
+{
+    delete[] ll_buffer;
+    ll_buffer = nullptr;
+    ll_size = 0;
+}
+
+static int ll_len ()
+{
+    return ll_write_pos.load (std::memory_order_acquire) -
+     ll_read_pos.load (std::memory_order_acquire);
+}
+
+/* called from the pump, or with the pump stopped in its tracks */
+static void ll_set_delay (int frames, int64_t time)
+{
+    ll_delay.store (frames, std::memory_order_relaxed);
+    ll_delay_time.store (time, std::memory_order_release);
+}
+
+static void ll_update_delay ()
+{
+    snd_pcm_sframes_t delay;
+    if (snd_pcm_delay (alsa_handle, & delay) >= 0)
+        ll_set_delay (delay, monotonic_ns ());
+}
+
+/* The software buffer is either the RingBuf or (in low-latency mode) the
+ * lock-free ring.  The following helpers are for the consumer side. */
+static int buffer_len ()
+{
+    return alsa_low_latency ? ll_len () : alsa_buffer.len ();
+}
+
+static int buffer_space ()
+{
+    return alsa_low_latency ? ll_size - ll_len () : alsa_buffer.space ();
+}
+
+static int buffer_linear ()
+{
+    if (! alsa_low_latency)
+        return alsa_buffer.linear ();
+
+    unsigned offset = ll_read_pos.load (std::memory_order_relaxed) % ll_size;
+    return aud::min ((unsigned) ll_len (), ll_size - offset);
+}
+
+static const char * buffer_head ()
+{
+    if (! alsa_low_latency)
+        return & alsa_buffer[0];
+
+    return ll_buffer + ll_read_pos.load (std::memory_order_relaxed) % ll_size;
+}
+
+static void buffer_discard (int bytes)
+{
+    if (alsa_low_latency)
+        ll_read_pos.fetch_add (bytes, std::memory_order_release);
+    else
+        alsa_buffer.discard (bytes);
+}
+
+static void buffer_discard_all ()
+{
+    if (alsa_low_latency)
+        ll_read_pos.store (ll_write_pos.load (std::memory_order_acquire),
+         std::memory_order_release);
+    else
+        alsa_buffer.discard ();
+}
+
+/* Gives the calling thread realtime priority, limited by RLIMIT_RTPRIO
+ * where that is set.  Failure is not fatal. */
+static bool have_cap_sys_nice ()
+{
+    __user_cap_header_struct header {_LINUX_CAPABILITY_VERSION_3, 0};
+    __user_cap_data_struct data[_LINUX_CAPABILITY_U32S_3] {};
+
+    if (syscall (SYS_capget, & header, data) < 0)
+        return false;
+
+    return data[CAP_TO_INDEX (CAP_SYS_NICE)].effective & CAP_TO_MASK (CAP_SYS_NICE);
+}
+
+static void set_realtime ()
+{
+    sched_param param {};
+    param.sched_priority = aud::min (sched_get_priority_max (SCHED_FIFO), 20);
+
+    /* without CAP_SYS_NICE, the soft limit is what the kernel enforces */
+    rlimit limit;
+    if (! getrlimit (RLIMIT_RTPRIO, & limit) && limit.rlim_cur != RLIM_INFINITY &&
+     ! have_cap_sys_nice ())
+    {
+        if (! limit.rlim_cur)
+        {
+            AUDINFO ("Realtime priority not permitted (RLIMIT_RTPRIO is 0).\n");
+            return;
+        }
+
+        param.sched_priority = aud::min (param.sched_priority, (int) limit.rlim_cur);
+    }
+
+    int error = pthread_setschedparam (pthread_self (), SCHED_FIFO, & param);
+
+    if (error)
+        AUDWARN ("Failed to set realtime priority: %s.\n", strerror (error));
+    else
+        AUDINFO ("Pump running with SCHED_FIFO priority %d.\n", param.sched_priority);
+}
+
+/* Copies frames from the software buffer directly into the hardware ring.
+ * Returns the number of frames written or a negative error code, just like
+ * snd_pcm_writei(). */
+static snd_pcm_sframes_t mmap_write (const char * data, snd_pcm_uframes_t frames)
+{
+    snd_pcm_uframes_t done = 0;
+
+    while (done < frames)
+    {
+        const snd_pcm_channel_area_t * areas;
+        snd_pcm_uframes_t offset, count = frames - done;
+
+        int error = snd_pcm_mmap_begin (alsa_handle, & areas, & offset, & count);
+        if (error < 0)
+            return error;
+        if (! count)
+            break;
+
+        /* interleaved access: one area describes all channels */
+        char * dest = (char *) areas[0].addr +
+         (areas[0].first + offset * areas[0].step) / 8;
+
+        memcpy (dest, data + snd_pcm_frames_to_bytes (alsa_handle, done),
+         snd_pcm_frames_to_bytes (alsa_handle, count));
+
+        snd_pcm_sframes_t committed = snd_pcm_mmap_commit (alsa_handle, offset, count);
+        if (committed < 0)
+            return committed;
+
+        done += committed;
+
+        if ((snd_pcm_uframes_t) committed < count)
+            break;
+    }
+
+    /* unlike snd_pcm_writei(), committing does not start the stream */
+    if (done && snd_pcm_state (alsa_handle) == SND_PCM_STATE_PREPARED)
+    {
+        int error = snd_pcm_start (alsa_handle);
+        if (error < 0)
+            return error;
+    }
+
+    return done;
+}
+
+static snd_pcm_sframes_t pcm_write (const char * data, snd_pcm_uframes_t frames)
+{
+    if (alsa_mmap)
+        return mmap_write (data, frames);
+    else
+        return snd_pcm_writei (alsa_handle, data, frames);
+}
+
 static void * pump (void *)
 {
+    if (alsa_low_latency && aud_get_bool ("alsa", "realtime"))
+        set_realtime ();
+
     pthread_mutex_lock (& alsa_mutex);
 
     bool failed_once = false;
@@ -157,14 +382,32 @@ static void * pump (void *)
 
     while (! pump_quit)
     {
-        int writable = snd_pcm_bytes_to_frames (alsa_handle, alsa_buffer.linear ());
+        int writable = snd_pcm_bytes_to_frames (alsa_handle, buffer_linear ());
 
-        if (alsa_prebuffer || alsa_paused || ! writable)
+        if (alsa_prebuffer || alsa_paused || (! writable && ! alsa_low_latency))
         {
             pthread_cond_wait (& alsa_cond, & alsa_mutex);
             continue;
         }
 
+        if (! writable)
+        {
+            /* low-latency mode: wait for write_audio() rather than ALSA */
+            ll_starved.store (true);
+            std::atomic_thread_fence (std::memory_order_seq_cst);
+
+            if (! buffer_len ())
+            {
+                ll_update_delay ();
+
+                pthread_mutex_unlock (& alsa_mutex);
+                poll_sleep (false);
+                pthread_mutex_lock (& alsa_mutex);
+            }
+
+            continue;
+        }
+
         int avail;
         CHECK_VAL_RECOVER (avail, snd_pcm_avail_update, alsa_handle);
 
@@ -173,12 +416,15 @@ static void * pump (void *)
             wakeups_since_write = 0;
 
             int written;
-            CHECK_VAL_RECOVER (written, snd_pcm_writei, alsa_handle,
-             & alsa_buffer[0], aud::min (writable, avail));
+            CHECK_VAL_RECOVER (written, pcm_write, buffer_head (),
+             aud::min (writable, avail));
 
             failed_once = false;
 
-            alsa_buffer.discard (snd_pcm_frames_to_bytes (alsa_handle, written));
+            buffer_discard (snd_pcm_frames_to_bytes (alsa_handle, written));
+
+            if (alsa_low_latency)
+                ll_update_delay ();
 
             pthread_cond_broadcast (& alsa_cond); /* signal write complete */
 
@@ -318,7 +564,7 @@ static snd_pcm_format_t convert_aud_format (int aud_format)
 
 bool ALSAPlugin::open_audio (int aud_format, int rate, int channels, String & error)
 {
-    int total_buffer, hard_buffer, soft_buffer, buffer_frames;
+    int total_buffer, period_buffer, hard_buffer, soft_buffer, buffer_frames;
     unsigned useconds;
     int direction;
 
@@ -342,8 +588,15 @@ bool ALSAPlugin::open_audio (int aud_format, int rate, int channels, String & er
     snd_pcm_hw_params_t * params;
     snd_pcm_hw_params_alloca (& params);
     CHECK_STR (error, snd_pcm_hw_params_any, alsa_handle, params);
+
+    alsa_mmap = aud_get_bool ("alsa", "mmap") &&
+     ! snd_pcm_hw_params_test_access (alsa_handle, params, SND_PCM_ACCESS_MMAP_INTERLEAVED);
+
+    if (aud_get_bool ("alsa", "mmap") && ! alsa_mmap)
+        AUDINFO ("PCM device does not support mmap access; using read/write.\n");
+
     CHECK_STR (error, snd_pcm_hw_params_set_access, alsa_handle, params,
-     SND_PCM_ACCESS_RW_INTERLEAVED);
+     alsa_mmap ? SND_PCM_ACCESS_MMAP_INTERLEAVED : SND_PCM_ACCESS_RW_INTERLEAVED);
 
     CHECK_STR (error, snd_pcm_hw_params_set_format, alsa_handle, params, format);
     CHECK_STR (error, snd_pcm_hw_params_set_channels, alsa_handle, params, channels);
@@ -353,28 +606,47 @@ bool ALSAPlugin::open_audio (int aud_format, int rate, int channels, String & er
     alsa_channels = channels;
     alsa_rate = rate;
 
-    total_buffer = aud_get_int (nullptr, "output_buffer_size");
+    alsa_low_latency = aud_get_bool ("alsa", "low_latency");
+
+    if (alsa_low_latency)
+    {
+        /* the software buffer is no bigger than the hardware one */
+        total_buffer = 2 * aud::clamp (aud_get_int ("alsa", "ll_buffer_time"), 2, 500);
+        period_buffer = aud::clamp (aud_get_int ("alsa", "ll_period_time"), 1, total_buffer / 4);
+    }
+    else
+    {
+        total_buffer = aud_get_int (nullptr, "output_buffer_size");
+        period_buffer = 0;
+    }
+
     useconds = 1000 * aud::min (1000, total_buffer / 2);
     direction = 0;
     CHECK_STR (error, snd_pcm_hw_params_set_buffer_time_near, alsa_handle,
      params, & useconds, & direction);
     hard_buffer = useconds / 1000;
 
-    useconds = 1000 * (hard_buffer / 4);
+    useconds = 1000 * (period_buffer ? period_buffer : hard_buffer / 4);
     direction = 0;
     CHECK_STR (error, snd_pcm_hw_params_set_period_time_near, alsa_handle,
      params, & useconds, & direction);
-    alsa_period = useconds / 1000;
+    alsa_period = aud::max (1u, useconds / 1000);
 
     CHECK_STR (error, snd_pcm_hw_params, alsa_handle, params);
 
     soft_buffer = aud::max (total_buffer / 2, total_buffer - hard_buffer);
-    AUDINFO ("Buffer: hardware %d ms, software %d ms, period %d ms.\n",
-     hard_buffer, soft_buffer, alsa_period);
+    AUDINFO ("Buffer: hardware %d ms, software %d ms, period %d ms, %s access%s.\n",
+     hard_buffer, soft_buffer, alsa_period, alsa_mmap ? "mmap" : "read/write",
+     alsa_low_latency ? ", low latency" : "");
 
     buffer_frames = aud::rescale<int64_t> (soft_buffer, 1000, rate);
-    alsa_buffer.alloc (snd_pcm_frames_to_bytes (alsa_handle, buffer_frames));
 
+    if (alsa_low_latency)
+        ll_alloc (snd_pcm_frames_to_bytes (alsa_handle, buffer_frames));
+    else
+        alsa_buffer.alloc (snd_pcm_frames_to_bytes (alsa_handle, buffer_frames));
+
+    alsa_xruns = 0;
     alsa_prebuffer = true;
     alsa_paused = false;
     alsa_paused_delay = 0;
@@ -409,7 +681,11 @@ void ALSAPlugin::close_audio ()
     CHECK (snd_pcm_drop, alsa_handle);
 
 FAILED:
+    if (alsa_xruns)
+        AUDINFO ("%d underrun(s) occurred.\n", alsa_xruns);
+
     alsa_buffer.destroy ();
+    ll_destroy ();
     poll_cleanup ();
     snd_pcm_close (alsa_handle);
     alsa_handle = nullptr;
@@ -417,8 +693,31 @@ FAILED:
     pthread_mutex_unlock (& alsa_mutex);
 }
 
+static int ll_write (const char * data, int length)
+{
+    unsigned write_pos = ll_write_pos.load (std::memory_order_relaxed);
+    length = aud::min (length, (int) (ll_size - ll_len ()));
+
+    unsigned offset = write_pos % ll_size;
+    int part = aud::min (length, (int) (ll_size - offset));
+
+    memcpy (ll_buffer + offset, data, part);
+    memcpy (ll_buffer, data + part, length - part);
+
+    ll_write_pos.store (write_pos + length, std::memory_order_release);
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+
+    if (length && ll_starved.exchange (false))
+        poll_wake ();
+
+    return length;
+}
+
 int ALSAPlugin::write_audio (const void * data, int length)
 {
+    if (alsa_low_latency)
+        return ll_write ((const char *) data, length);
+
     pthread_mutex_lock (& alsa_mutex);
 
     length = aud::min (length, alsa_buffer.space ());
@@ -433,9 +732,12 @@ int ALSAPlugin::write_audio (const void * data, int length)
 
 void ALSAPlugin::period_wait ()
 {
+    if (alsa_low_latency && buffer_space ())
+        return;
+
     pthread_mutex_lock (& alsa_mutex);
 
-    while (! alsa_buffer.space ())
+    while (! buffer_space ())
     {
         if (! alsa_paused)
         {
@@ -461,7 +763,7 @@ void ALSAPlugin::drain ()
     if (alsa_prebuffer)
         start_playback ();
 
-    while (snd_pcm_bytes_to_frames (alsa_handle, alsa_buffer.len ()))
+    while (snd_pcm_bytes_to_frames (alsa_handle, buffer_len ()))
         pthread_cond_wait (& alsa_cond, & alsa_mutex);
 
     if (! alsa_prebuffer)
@@ -484,6 +786,7 @@ void ALSAPlugin::drain ()
         */
         alsa_prebuffer = true;
         alsa_paused_delay = 0;
+        ll_set_delay (0, 0);
 
         poll_wake (); /* wake pump so it's ready */
         pthread_cond_timedwait (& alsa_cond, & alsa_mutex, & ts);
@@ -492,8 +795,25 @@ void ALSAPlugin::drain ()
     pthread_mutex_unlock (& alsa_mutex);
 }
 
+static int ll_get_delay ()
+{
+    int64_t time = ll_delay_time.load (std::memory_order_acquire);
+    int64_t frames = ll_delay.load (std::memory_order_relaxed);
+
+    /* the pump only updates the delay once per period */
+    if (time)
+        frames = aud::max<int64_t> (0, frames -
+         (monotonic_ns () - time) * alsa_rate / 1000000000);
+
+    frames += snd_pcm_bytes_to_frames (alsa_handle, ll_len ());
+    return aud::rescale<int64_t> (frames, alsa_rate, 1000);
+}
+
 int ALSAPlugin::get_delay ()
 {
+    if (alsa_low_latency)
+        return ll_get_delay ();
+
     pthread_mutex_lock (& alsa_mutex);
 
     int buffered = snd_pcm_bytes_to_frames (alsa_handle, alsa_buffer.len ());
@@ -516,10 +836,11 @@ void ALSAPlugin::flush ()
     CHECK (snd_pcm_drop, alsa_handle);
 
 FAILED:
-    alsa_buffer.discard ();
+    buffer_discard_all ();
 
     alsa_prebuffer = true;
     alsa_paused_delay = 0;
+    ll_set_delay (0, 0);
 
     poll_wake (); /* wake pump so it's ready */
     pthread_cond_broadcast (& alsa_cond); /* interrupt period wait */
@@ -536,7 +857,10 @@ void ALSAPlugin::pause (bool pause)
     if (! alsa_prebuffer)
     {
         if (pause)
+        {
             alsa_paused_delay = get_delay_locked ();
+            ll_set_delay (aud::rescale (alsa_paused_delay, 1000, alsa_rate), 0);
+        }
 
         /* JWT:THIS ALWAYS SEEMS TO "FAIL" FOR ME, BUT NO PBMS I CAN TELL, SO SHUSH MESSAGES!: */
         CHECK_QUIETLY (snd_pcm_pause, alsa_handle, pause);
@@ -244,6 +244,11 @@ static void guess_element ()
 const char * const ALSAPlugin::defaults[] = {
     "pcm", "default",
     "mixer", "default",
+    "mmap", "FALSE",
+    "low_latency", "FALSE",
+    "ll_buffer_time", "20",
+    "ll_period_time", "5",
+    "realtime", "FALSE",
     nullptr
 };
 
@@ -303,6 +308,18 @@ const PreferencesWidget ALSAPlugin::widgets[] = {
     WidgetCombo (N_("PCM device:"),
         WidgetString ("alsa", "pcm", pcm_changed),
         {nullptr, pcm_combo_fill}),
+    WidgetCheck (N_("Use memory-mapped (mmap) access"),
+        WidgetBool ("alsa", "mmap", pcm_changed)),
+    WidgetCheck (N_("Low-latency mode"),
+        WidgetBool ("alsa", "low_latency", pcm_changed)),
+    WidgetSpin (N_("Buffer size:"),
+        WidgetInt ("alsa", "ll_buffer_time", pcm_changed),
+        {2, 500, 1, N_("ms")}, WIDGET_CHILD),
+    WidgetSpin (N_("Period size:"),
+        WidgetInt ("alsa", "ll_period_time", pcm_changed),
+        {1, 125, 1, N_("ms")}, WIDGET_CHILD),
+    WidgetCheck (N_("Use realtime scheduling"),
+        WidgetBool ("alsa", "realtime", pcm_changed), WIDGET_CHILD),
     WidgetCombo (N_("Mixer device:"),
         WidgetString ("alsa", "mixer", mixer_changed),
         {nullptr, mixer_combo_fill}),
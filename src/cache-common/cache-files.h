@@ -0,0 +1,137 @@
+/*
+ * Per-file caches kept in the user's config directory
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef CACHE_COMMON_CACHE_FILES_H
+#define CACHE_COMMON_CACHE_FILES_H
+
+/*
+ * Helpers for the plugins that remember something about each file played
+ * (seek indexes and the like) in a directory of their own under the user's
+ * config directory, one small file per played file.  Such a directory is
+ * kept in check by touching a file whenever it is used and, after writing
+ * one, removing the least recently used beyond a fixed number.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#ifdef _WIN32
+#include <io.h>
+#endif
+
+#include <libfauxdcore/audstrings.h>
+#include <libfauxdcore/index.h>
+#include <libfauxdcore/runtime.h>
+
+/* 64-bit FNV-1a */
+inline uint64_t cache_hash (const void * data, int len)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    for (int i = 0; i < len; i ++)
+        hash = (hash ^ ((const unsigned char *) data)[i]) * 0x100000001b3;
+
+    return hash;
+}
+
+/* <name> (a file or directory) in the user's config directory */
+inline StringBuf cache_path (const char * name)
+{
+    return filename_build ({aud_get_path (AudPath::UserDir), name});
+}
+
+/* the file in <dir> for <key> (e.g. a URI), named by a hash of it; as with
+ * any hash, the file should say what it is for */
+inline StringBuf cache_hashed_uri (const char * dir, const char * key)
+{
+    StringBuf name = str_printf ("%016llx",
+     (unsigned long long) cache_hash (key, strlen (key)));
+
+    return filename_to_uri (filename_build ({cache_path (dir), name}));
+}
+
+/* creates <dir> if need be, before writing a file into it */
+inline void cache_make_dir (const char * dir)
+{
+    StringBuf path = cache_path (dir);
+#ifdef _WIN32
+    mkdir (path);
+#else
+    mkdir (path, 0755);
+#endif
+}
+
+/* marks a cache file as just used, keeping it from being pruned */
+inline void cache_touch (const char * uri)
+{
+    StringBuf path = uri_to_filename (uri);
+    if (path)
+        utime (path, nullptr);
+}
+
+/* removes all but the <keep> most recently used (touched or written) files
+ * in <dir> */
+inline void cache_prune (const char * dir, int keep)
+{
+    struct CacheFile {
+        String path;
+        time_t mtime;
+
+        CacheFile (const char * path, time_t mtime) :
+            path (path), mtime (mtime) {}
+    };
+
+    StringBuf dir_path = cache_path (dir);
+    DIR * handle = opendir (dir_path);
+    if (! handle)
+        return;
+
+    Index<CacheFile> files;
+    struct dirent * entry;
+
+    while ((entry = readdir (handle)))
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        StringBuf path = filename_build ({dir_path, entry->d_name});
+        struct stat st;
+
+        if (! stat (path, & st) && S_ISREG (st.st_mode))
+            files.append ((const char *) path, st.st_mtime);
+    }
+
+    closedir (handle);
+
+    int excess = files.len () - keep;
+    if (excess <= 0)
+        return;
+
+    /* oldest first */
+    files.sort ([] (const CacheFile & a, const CacheFile & b)
+        { return (a.mtime > b.mtime) - (a.mtime < b.mtime); });
+
+    for (int i = 0; i < excess; i ++)
+        unlink (files[i].path);
+
+    AUDDBG ("Removed %d old files from %s.\n", excess, (const char *) dir_path);
+}
+
+#endif
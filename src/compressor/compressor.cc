@@ -28,6 +28,8 @@
 #include <libfauxdcore/ringbuf.h>
 #include <libfauxdcore/runtime.h>
 
+#include "../dsp/dsp.h"
+
 /* Response time adjustments.  Maybe this should be adjustable? */
 #define CHUNK_TIME 0.2f /* seconds */
 #define CHUNKS 5
@@ -42,6 +44,12 @@
 static const char * const compressor_defaults[] = {
     "center", "0.5",
     "range", "0.5",
+    "lookahead", "FALSE",
+    "threshold", "-12",
+    "ratio", "4",
+    "knee", "6",
+    "attack", "5",
+    "release", "100",
      nullptr
 };
 
@@ -52,7 +60,24 @@ static const PreferencesWidget compressor_widgets[] = {
         {0.1, 1, 0.1}),
     WidgetSpin (N_("Dynamic range:"),
         WidgetFloat ("compressor", "range"),
-        {0.0, 3.0, 0.1})
+        {0.0, 3.0, 0.1}),
+    WidgetCheck (N_("Look-ahead mode (instead of the above)"),
+        WidgetBool ("compressor", "lookahead")),
+    WidgetSpin (N_("Threshold:"),
+        WidgetFloat ("compressor", "threshold"),
+        {-40, 0, 1, N_("dB")}, WIDGET_CHILD),
+    WidgetSpin (N_("Ratio:"),
+        WidgetFloat ("compressor", "ratio"),
+        {1, 20, 0.5, N_(": 1")}, WIDGET_CHILD),
+    WidgetSpin (N_("Knee:"),
+        WidgetFloat ("compressor", "knee"),
+        {0, 24, 1, N_("dB")}, WIDGET_CHILD),
+    WidgetSpin (N_("Attack:"),
+        WidgetInt ("compressor", "attack"),
+        {1, 100, 1, N_("ms")}, WIDGET_CHILD),
+    WidgetSpin (N_("Release:"),
+        WidgetInt ("compressor", "release"),
+        {10, 2000, 10, N_("ms")}, WIDGET_CHILD)
 };
 
 static const PluginPreferences compressor_prefs = {{compressor_widgets}};
@@ -104,11 +129,7 @@ static int current_channels, current_rate;
 
 static audio_sample calc_peak (audio_sample * data, int length)
 {
-    audio_sample sum = 0;
-
-    const audio_sample * end = data + length;
-    while (data < end)
-        sum += fabs (* data ++);
+    audio_sample sum = dsp_abs_sum (data, length);
 
 #ifdef DEF_AUDIO_FLOAT64
     return aud::max (0.01, sum / length * 6);
@@ -124,11 +145,241 @@ static void do_ramp (audio_sample * data, int length, audio_sample peak_a, audio
     audio_sample a = pow (peak_a / center, range - 1);
     audio_sample b = pow (peak_b / center, range - 1);
 
-    for (int count = 0; count < length; count ++)
+    dsp_ramp (data, length, a, (b - a) / length);
+}
+
+/* Look-ahead mode: the audio is held back by the attack time, so that the
+ * gain can come down smoothly before a peak goes out rather than after it.
+ * The target gain for each frame comes from the largest peak in the window
+ * of frames still held back (a sliding maximum, kept in a monotonic deque so
+ * that each frame costs the same however long the window), and eases back up
+ * at the release rate.  A moving average over the window then spreads each
+ * drop over the attack time; since every frame in the average has seen the
+ * peak, the gain is down far enough by the time the peak is output. */
+
+struct LookAheadSettings
+{
+    float threshold, knee;  // dB
+    float slope;            // gain reduction per dB over the threshold
+    float quiet;            // below this peak, there is nothing to do
+    float release;          // per frame
+};
+
+class LookAhead
+{
+public:
+    void reset (int frames);
+
+    /* works out the gains for <n> more frames; each is for the frame that
+     * came in <frames> before the one it was worked out at */
+    void run (const float * peaks, float * gains, int n, const LookAheadSettings & s);
+
+private:
+    struct Peak {
+        int64_t pos;
+        float value;
+    };
+
+    int m_frames = 0;
+    int64_t m_pos = 0;
+
+    Index<Peak> m_window;   // the deque, as a ring of <frames> + 2
+    int m_head = 0, m_len = 0;
+
+    float m_released = 1;
+
+    Index<float> m_average;  // the last <frames> gains
+    int m_at = 0;
+    double m_sum = 0;
+};
+
+void LookAhead::reset (int frames)
+{
+    m_frames = frames;
+    m_pos = 0;
+
+    m_window.resize (frames + 2);
+    m_head = m_len = 0;
+
+    m_released = 1;
+
+    m_average.resize (frames);
+    for (float & g : m_average)
+        g = 1;
+
+    m_at = 0;
+    m_sum = frames;
+}
+
+static float gain_reduction (float level, const LookAheadSettings & s)
+{
+    float over = level - s.threshold;
+
+    if (2 * over <= - s.knee)
+        return 0;
+
+    /* soft knee: a quadratic from no reduction to the full slope */
+    if (2 * over < s.knee)
+    {
+        float x = over + s.knee / 2;
+        return s.slope * x * x / (2 * s.knee);
+    }
+
+    return s.slope * over;
+}
+
+void LookAhead::run (const float * peaks, float * gains, int n, const LookAheadSettings & s)
+{
+    int size = m_window.len ();
+
+    for (int i = 0; i < n; i ++, m_pos ++)
+    {
+        float peak = peaks[i];
+
+        /* smaller peaks behind a larger one can never be the maximum again */
+        while (m_len)
+        {
+            int back = m_head + m_len - 1;
+            if (m_window[back < size ? back : back - size].value > peak)
+                break;
+            m_len --;
+        }
+
+        int tail = m_head + m_len;
+        m_window[tail < size ? tail : tail - size] = {m_pos, peak};
+        m_len ++;
+
+        if (m_window[m_head].pos < m_pos - m_frames)
+        {
+            if (++ m_head == size)
+                m_head = 0;
+            m_len --;
+        }
+
+        float loudest = m_window[m_head].value;
+        float target = 1;
+
+        if (loudest > s.quiet)
+            target = powf (10, gain_reduction (20 * log10f (loudest), s) / 20);
+
+        if (target < m_released)
+            m_released = target;
+        else
+            m_released += (target - m_released) * s.release;
+
+        m_sum += m_released - m_average[m_at];
+        m_average[m_at] = m_released;
+        if (++ m_at == m_frames)
+            m_at = 0;
+
+        gains[i] = aud::min (m_sum / m_frames, 1.0);
+    }
+}
+
+static bool lookahead;
+static LookAhead detector;
+static RingBuf<audio_sample> delayed;
+static Index<float> frame_peaks, frame_gains;
+static int lookahead_frames, skip_frames;
+
+static void lookahead_reset ()
+{
+    int attack = aud::clamp (aud_get_int ("compressor", "attack"), 1, 100);
+    lookahead_frames = aud::max (aud::rescale (attack, 1000, current_rate), 1);
+
+    detector.reset (lookahead_frames);
+    delayed.discard ();
+
+    /* nothing comes out until the window is full */
+    skip_frames = lookahead_frames;
+}
+
+/* <data> null means as many frames of silence, to get the last frames out */
+static void lookahead_run (const audio_sample * data, int frames)
+{
+    LookAheadSettings s;
+    s.threshold = aud_get_double ("compressor", "threshold");
+    s.knee = aud::max (aud_get_double ("compressor", "knee"), 0.0);
+    s.slope = 1 / aud::max (aud_get_double ("compressor", "ratio"), 1.0) - 1;
+    s.quiet = powf (10, (s.threshold - s.knee / 2) / 20);
+
+    int release = aud::max (aud_get_int ("compressor", "release"), 1);
+    s.release = 1 - expf (-1000.0f / ((float) release * current_rate));
+
+    frame_peaks.resize (frames);
+    frame_gains.resize (frames);
+
+    if (data)
+        dsp_frame_peaks (data, frames, current_channels, frame_peaks.begin ());
+    else
     {
-        * data = (* data) * (a * (length - count) + b * count) / length;
-        data ++;
+        for (float & p : frame_peaks)
+            p = 0;
     }
+
+    detector.run (frame_peaks.begin (), frame_gains.begin (), frames, s);
+
+    if (data)
+    {
+        int samples = frames * current_channels;
+        if (delayed.space () < samples)
+            delayed.alloc (aud::max (delayed.len () + samples, 2 * delayed.size ()));
+
+        delayed.copy_in (data, samples);
+    }
+
+    int skip = aud::min (skip_frames, frames);
+    int ready = frames - skip;
+    skip_frames -= skip;
+
+    if (! ready)
+        return;
+
+    int at = output.len ();
+    delayed.move_out (output, -1, ready * current_channels);
+    dsp_apply_gains (& output[at], & frame_gains[skip], ready, current_channels);
+}
+
+static void lookahead_finish ()
+{
+    lookahead_run (nullptr, lookahead_frames);
+    lookahead_reset ();
+}
+
+/* the averaging mode, when done with the buffer */
+static void averaging_finish ()
+{
+    peaks.discard ();
+
+    while (buffer.len ())
+    {
+        int writable = buffer.linear ();
+
+        if (current_peak != 0.0)
+            do_ramp (& buffer[0], writable, current_peak, current_peak);
+
+        buffer.move_out (output, -1, writable);
+    }
+}
+
+/* switching modes, pass on whatever the old one was holding back */
+static void check_mode ()
+{
+    bool want = aud_get_bool ("compressor", "lookahead");
+    if (want == lookahead)
+        return;
+
+    if (lookahead)
+        lookahead_finish ();
+    else
+    {
+        averaging_finish ();
+        current_peak = 0.0;
+    }
+
+    lookahead = want;
+    if (lookahead)
+        lookahead_reset ();
 }
 
 bool Compressor::init ()
@@ -141,6 +392,9 @@ void Compressor::cleanup ()
 {
     buffer.destroy ();
     peaks.destroy ();
+    delayed.destroy ();
+    frame_peaks.clear ();
+    frame_gains.clear ();
     output.clear ();
 }
 
@@ -154,6 +408,8 @@ void Compressor::start (int & channels, int & rate)
     buffer.alloc (chunk_size * CHUNKS);
     peaks.alloc (CHUNKS);
 
+    lookahead = aud_get_bool ("compressor", "lookahead");
+
     flush (true);
 }
 
@@ -161,6 +417,14 @@ Index<audio_sample> & Compressor::process (Index<audio_sample> & data)
 {
     output.resize (0);
 
+    check_mode ();
+
+    if (lookahead)
+    {
+        lookahead_run (data.begin (), data.len () / current_channels);
+        return output;
+    }
+
     int offset = 0;
     int remain = data.len ();
 
@@ -210,6 +474,10 @@ bool Compressor::flush (bool force)
     peaks.discard ();
 
     current_peak = 0.0;
+
+    if (lookahead)
+        lookahead_reset ();
+
     return true;
 }
 
@@ -217,18 +485,17 @@ Index<audio_sample> & Compressor::finish (Index<audio_sample> & data, bool end_o
 {
     output.resize (0);
 
-    peaks.discard ();
+    check_mode ();
 
-    while (buffer.len ())
+    if (lookahead)
     {
-        int writable = buffer.linear ();
-
-        if (current_peak != 0.0)
-            do_ramp (& buffer[0], writable, current_peak, current_peak);
-
-        buffer.move_out (output, -1, writable);
+        lookahead_run (data.begin (), data.len () / current_channels);
+        lookahead_finish ();
+        return output;
     }
 
+    averaging_finish ();
+
     if (current_peak != 0.0)
         do_ramp (data.begin (), data.len (), current_peak, current_peak);
 
@@ -239,5 +506,6 @@ Index<audio_sample> & Compressor::finish (Index<audio_sample> & data, bool end_o
 
 int Compressor::adjust_delay (int delay)
 {
-    return delay + aud::rescale<int64_t> (buffer.len () / current_channels, current_rate, 1000);
+    int held = lookahead ? delayed.len () : buffer.len ();
+    return delay + aud::rescale<int64_t> (held / current_channels, current_rate, 1000);
 }
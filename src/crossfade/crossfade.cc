@@ -18,11 +18,15 @@
  */
 
 #include <math.h>
+#include <string.h>
+
 #include <libfauxdcore/i18n.h>
 #include <libfauxdcore/plugin.h>
 #include <libfauxdcore/preferences.h>
 #include <libfauxdcore/runtime.h>
 
+#include "../dsp/dsp.h"
+
 enum
 {
     STATE_OFF,
@@ -99,12 +103,19 @@ public:
     int adjust_delay (int delay);
 };
 
+
 EXPORT Crossfade aud_plugin_instance;
 
 static char state = STATE_OFF;
 static int current_channels, current_rate;
-static Index<audio_sample> buffer, output;
-static int fadein_point;
+static Index<audio_sample> output;
+static int fadein_point, fadein_length;
+
+/* The fade window is kept in a ring, so that passing audio through it costs
+ * only what is passing through, however long the fade.  The ring grows as
+ * needed and is otherwise reused from song to song. */
+static Index<audio_sample> ring;
+static int ring_head, ring_len;
 
 bool Crossfade::init ()
 {
@@ -115,38 +126,145 @@ bool Crossfade::init ()
 void Crossfade::cleanup ()
 {
     state = STATE_OFF;
-    buffer.clear ();
+    ring.clear ();
+    ring_head = ring_len = 0;
     output.clear ();
 }
 
-static void do_linear_ramp (audio_sample * data, int length, float a, float b)
+/* calls <func> (ptr, offset, length) for the contiguous stretches of samples
+ * [pos, pos + len) of the ring; offset counts from <pos> */
+template<class F>
+static void ring_parts (int pos, int len, F func)
 {
-    for (int i = 0; i < length; i ++)
-        (* data ++) *= (a * (length - i) + b * i) / length;
+    int size = ring.len ();
+    int at = ring_head + pos;
+    if (at >= size)
+        at -= size;
+
+    int first = aud::min (len, size - at);
+    if (first > 0)
+        func (& ring[at], 0, first);
+    if (len > first)
+        func (ring.begin (), first, len - first);
 }
 
-static void do_sigmoid_ramp (audio_sample * data, int length, float a, float b)
+static audio_sample & ring_at (int pos)
 {
-    float steepness = aud_get_double ("crossfade", "sigmoid_steepness");
-    for (int i = 0; i < length; i ++)
+    int at = ring_head + pos;
+    return ring[at < ring.len () ? at : at - ring.len ()];
+}
+
+static void ring_reserve (int len)
+{
+    if (ring_len + len <= ring.len ())
+        return;
+
+    Index<audio_sample> bigger;
+    bigger.resize (aud::max (ring_len + len, 2 * ring.len ()));
+
+    ring_parts (0, ring_len, [& bigger] (audio_sample * p, int at, int n)
+        { memcpy (& bigger[at], p, sizeof (audio_sample) * n); });
+
+    ring = std::move (bigger);
+    ring_head = 0;
+}
+
+/* appends <len> samples from <data>, or silence if <data> is null */
+static void ring_push (const audio_sample * data, int len)
+{
+    ring_reserve (len);
+    ring_len += len;
+
+    ring_parts (ring_len - len, len, [data] (audio_sample * p, int at, int n) {
+        if (data)
+            memcpy (p, data + at, sizeof (audio_sample) * n);
+        else
+            memset (p, 0, sizeof (audio_sample) * n);
+    });
+}
+
+/* moves the first <len> samples to the end of <out> */
+static void ring_pop (Index<audio_sample> & out, int len)
+{
+    out.insert (-1, len);
+    audio_sample * to = out.end () - len;
+
+    ring_parts (0, len, [to] (audio_sample * p, int at, int n)
+        { memcpy (to + at, p, sizeof (audio_sample) * n); });
+
+    ring_head += len;
+    if (ring_head >= ring.len ())
+        ring_head -= ring.len ();
+
+    ring_len -= len;
+}
+
+/* The fades: at <t> of the way through, the new song is scaled by g(t) and
+ * the old one by 1 - g(t), where g is either linear or an S-curve (which is
+ * symmetric, so 1 - g(t) = g(1 - t) either way).  The old song's fade-out is
+ * applied as the new song is mixed in, in a single pass. */
+struct Curve
+{
+    float steepness;  // 0 for linear
+    bool fade_in;
+};
+
+static Curve get_curve ()
+{
+    Curve curve;
+    curve.steepness = aud_get_bool ("crossfade", "use_sigmoid") ?
+     aud_get_double ("crossfade", "sigmoid_steepness") : 0;
+    curve.fade_in = ! aud_get_bool ("crossfade", "no_fade_in");
+    return curve;
+}
+
+static inline float sigmoid (float t, float steepness)
+{
+    return 0.5f + 0.5f * tanhf (steepness * (t - 0.5f));
+}
+
+/* fades out <data>, which is at <pos> of <total> samples of the fade */
+static void fade_out (audio_sample * data, int length, int pos, int total, const Curve & curve)
+{
+    float scale = 1.0f / total;
+
+    if (! curve.steepness)
     {
-        float linear = (a * (length - i) + b * i) / length;
-        (* data ++) *= 0.5f + 0.5f * tanhf (steepness * (linear - 0.5f));
+        dsp_ramp (data, length, 1 - pos * scale, -scale);
+        return;
     }
+
+    for (int i = 0; i < length; i ++)
+        data[i] *= 1 - sigmoid ((pos + i) * scale, curve.steepness);
 }
 
-static void do_ramp (audio_sample * data, int length, float a, float b)
+/* fades out <data> as above, and mixes in <add>, faded in to match */
+static void fade_mix (audio_sample * data, const audio_sample * add, int length,
+ int pos, int total, const Curve & curve)
 {
-    if (aud_get_bool ("crossfade", "use_sigmoid"))
-        do_sigmoid_ramp (data, length, a, b);
-    else
-        do_linear_ramp (data, length, a, b);
+    float scale = 1.0f / total;
+
+    if (! curve.steepness)
+    {
+        dsp_ramp_mix (data, add, length, pos * scale, scale, curve.fade_in);
+        return;
+    }
+
+    for (int i = 0; i < length; i ++)
+    {
+        float g = sigmoid ((pos + i) * scale, curve.steepness);
+        data[i] = data[i] * (1 - g) + (curve.fade_in ? add[i] * g : add[i]);
+    }
 }
 
-static void mix (audio_sample * data, audio_sample * add, int length)
+/* fades out samples [pos, pos + len) of the ring, which are <pos> into a fade
+ * <total> samples long */
+static void ring_fade_out (int pos, int len, int total)
 {
-    while (length --)
-        (* data ++) += (* add ++);
+    Curve curve = get_curve ();
+
+    ring_parts (pos, len, [pos, total, & curve] (audio_sample * p, int at, int n)
+        { fade_out (p, n, pos + at, total, curve); });
 }
 
 /* stupid simple resampling/rechanneling algorithm */
@@ -155,7 +273,7 @@ static void reformat (int channels, int rate)
     if (channels == current_channels && rate == current_rate)
         return;
 
-    int old_frames = buffer.len () / current_channels;
+    int old_frames = ring_len / current_channels;
     int new_frames = (int64_t) old_frames * rate / current_rate;
 
     int map[AUD_MAX_CHANNELS];
@@ -172,10 +290,20 @@ static void reformat (int channels, int rate)
         int s = f * channels;
 
         for (int c = 0; c < channels; c ++)
-            new_buffer[s + c] = buffer[s0 + map[c]];
+            new_buffer[s + c] = ring_at (s0 + map[c]);
+    }
+
+    /* a fade in progress carries on from the same point in time */
+    if (state == STATE_FADEIN)
+    {
+        int frame = (int64_t) (fadein_point / current_channels) * rate / current_rate;
+        fadein_point = aud::min (frame * channels, new_buffer.len ());
+        fadein_length = new_buffer.len ();
     }
 
-    buffer = std::move (new_buffer);
+    ring = std::move (new_buffer);
+    ring_head = 0;
+    ring_len = ring.len ();
 }
 
 static int buffer_needed_for_state ()
@@ -193,11 +321,11 @@ static int buffer_needed_for_state ()
 
 static void output_data_as_ready (int buffer_needed, bool exact)
 {
-    int copy = buffer.len () - buffer_needed;
+    int copy = ring_len - buffer_needed;
 
     /* if allowed, wait until we have at least 1/2 second ready to output */
     if (exact ? (copy > 0) : (copy >= current_channels * (current_rate / 2)))
-        output.move_from (buffer, 0, -1, copy, true, true);
+        ring_pop (output, copy);
 }
 
 void Crossfade::start (int & channels, int & rate)
@@ -213,42 +341,48 @@ void Crossfade::start (int & channels, int & rate)
         if (aud_get_bool ("crossfade", "manual"))
         {
             state = STATE_FLUSHED;
-            buffer.insert (0, buffer_needed_for_state ());
+            ring_push (nullptr, buffer_needed_for_state ());
         }
         else
             state = STATE_RUNNING;
     }
 }
 
+/* the old song is faded out only as the new one is mixed in */
 static void run_fadeout ()
 {
-    do_ramp (buffer.begin (), buffer.len (), 1.0, 0.0);
-
     state = STATE_FADEIN;
     fadein_point = 0;
+    fadein_length = ring_len;
 }
 
-static void run_fadein (Index<audio_sample> & data)
+/* mixes in as much of <data> as the fade has room for; returns how much */
+static int run_fadein (const Index<audio_sample> & data)
 {
-    int length = buffer.len ();
+    int copy = aud::min (data.len (), fadein_length - fadein_point);
 
-    if (fadein_point < length)
+    if (copy > 0)
     {
-        int copy = aud::min (data.len (), length - fadein_point);
-        float a = (float) fadein_point / length;
-        float b = (float) (fadein_point + copy) / length;
+        Curve curve = get_curve ();
+        int pos = fadein_point;
 
-        if (! aud_get_bool ("crossfade", "no_fade_in"))
-            do_ramp (data.begin (), copy, a, b);
-
-        mix (& buffer[fadein_point], data.begin (), copy);
-        data.remove (0, copy);
+        ring_parts (pos, copy, [& data, pos, & curve] (audio_sample * p, int at, int n)
+            { fade_mix (p, data.begin () + at, n, pos + at, fadein_length, curve); });
 
         fadein_point += copy;
     }
 
-    if (fadein_point == length)
+    if (fadein_point == fadein_length)
         state = STATE_RUNNING;
+
+    return copy;
+}
+
+/* the new song stopped short: fade out the rest of the old one alone */
+static void cut_fadein ()
+{
+    ring_fade_out (fadein_point, fadein_length - fadein_point, fadein_length);
+    fadein_point = fadein_length;
 }
 
 Index<audio_sample> & Crossfade::process (Index<audio_sample> & data)
@@ -258,15 +392,17 @@ Index<audio_sample> & Crossfade::process (Index<audio_sample> & data)
 
     output.resize (0);
 
+    int used = 0;
+
     if (state == STATE_FINISHED || state == STATE_FLUSHED)
         run_fadeout ();
 
     if (state == STATE_FADEIN)
-        run_fadein (data);
+        used = run_fadein (data);
 
     if (state == STATE_RUNNING)
     {
-        buffer.insert (data.begin (), -1, data.len ());
+        ring_push (data.begin () + used, data.len () - used);
         output_data_as_ready (buffer_needed_for_state (), false);
     }
 
@@ -280,16 +416,17 @@ bool Crossfade::flush (bool force)
 
     if (! force && aud_get_bool ("crossfade", "manual"))
     {
+        if (state == STATE_FADEIN)
+            cut_fadein ();
+
         state = STATE_FLUSHED;
-        int buffer_needed = buffer_needed_for_state ();
-        if (buffer.len () > buffer_needed)
-            buffer.remove (buffer_needed, -1);
+        ring_len = aud::min (ring_len, buffer_needed_for_state ());
 
         return false;
     }
 
     state = STATE_RUNNING;
-    buffer.resize (0);
+    ring_head = ring_len = 0;
 
     return true;
 }
@@ -301,17 +438,22 @@ Index<audio_sample> & Crossfade::finish (Index<audio_sample> & data, bool end_of
 
     output.resize (0);
 
+    int used = 0;
+
     if (state == STATE_FADEIN)
-        run_fadein (data);
+        used = run_fadein (data);
 
     if (state == STATE_RUNNING || state == STATE_FINISHED || state == STATE_FLUSHED)
     {
-        buffer.insert (data.begin (), -1, data.len ());
+        ring_push (data.begin () + used, data.len () - used);
         output_data_as_ready (buffer_needed_for_state (), state != STATE_RUNNING);
     }
 
     if (state == STATE_FADEIN || state == STATE_RUNNING)
     {
+        if (state == STATE_FADEIN)
+            cut_fadein ();
+
         if (aud_get_bool ("crossfade", "automatic"))
         {
             state = STATE_FINISHED;
@@ -326,7 +468,7 @@ Index<audio_sample> & Crossfade::finish (Index<audio_sample> & data, bool end_of
 
     if (end_of_playlist && (state == STATE_FINISHED || state == STATE_FLUSHED))
     {
-        do_ramp (buffer.begin (), buffer.len (), 1.0, 0.0);
+        ring_fade_out (0, ring_len, ring_len);
 
         state = STATE_OFF;
         output_data_as_ready (0, true);
@@ -337,5 +479,5 @@ Index<audio_sample> & Crossfade::finish (Index<audio_sample> & data, bool end_of
 
 int Crossfade::adjust_delay (int delay)
 {
-    return delay + aud::rescale<int64_t> (buffer.len () / current_channels, current_rate, 1000);
+    return delay + aud::rescale<int64_t> (ring_len / current_channels, current_rate, 1000);
 }
@@ -23,6 +23,8 @@
 #include <libfauxdcore/plugin.h>
 #include <libfauxdcore/preferences.h>
 
+#include "../dsp/dsp.h"
+
 static const char * const cryst_defaults[] = {
  "intensity", "1",
  nullptr};
@@ -82,18 +84,9 @@ void Crystalizer::start (int & channels, int & rate)
 Index<audio_sample> & Crystalizer::process (Index<audio_sample> & data)
 {
     float value = aud_get_double ("crystalizer", "intensity");
-    audio_sample * f = data.begin ();
-    const audio_sample * end = data.end ();
-
-    while (f < end)
-    {
-        for (int channel = 0; channel < cryst_channels; channel ++)
-        {
-            audio_sample current = * f;
-            * f ++ = current + (current - cryst_prev[channel]) * value;
-            cryst_prev[channel] = current;
-        }
-    }
+
+    dsp_emphasize (data.begin (), data.len () / cryst_channels, cryst_channels,
+     value, cryst_prev.begin ());
 
     return data;
 }
@@ -0,0 +1,267 @@
+/*
+ * Fauxdacious DSP kernels shared by the effect plugins
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+/*
+ * "make bench": puts SincResampler's Fast, Medium and Best qualities next to
+ * libsamplerate's SRC_SINC_FASTEST, SRC_SINC_MEDIUM_QUALITY and
+ * SRC_SINC_BEST_QUALITY.  Both are fed the same stereo tones in blocks of
+ * BLOCK frames, the way the effect plugins call them, and are rated on:
+ *
+ *  - SNR: the output against the same tones computed at the output rate.
+ *    Tones above the output band are left out of the reference, so what
+ *    gets through of them counts as noise.  Edges are not counted.
+ *  - speed: seconds of input resampled per second of CPU time.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <samplerate.h>
+
+#include "sinc-resampler.h"
+
+#define CHANNELS 2
+#define BLOCK 512
+#define SECONDS 10
+#define EDGE 4096     /* output frames not rated at either end */
+
+struct Tone {
+    double freq, level;
+};
+
+static const Tone tones[] = {
+    {440, 0.2}, {3000, 0.15}, {9000, 0.1}, {16000, 0.1},
+    {30000, 0.2}   // only there at 96 kHz, and must be filtered out
+};
+
+struct Conversion {
+    int in_rate, out_rate;
+};
+
+static const Conversion conversions[] = {
+    {44100, 48000},
+    {48000, 44100},
+    {96000, 44100},
+    {44100, 96000}
+};
+
+static double tone_at (const Tone & t, int rate, int frame, int channel)
+{
+    /* the channels a little apart in phase */
+    return t.level * sin (2 * M_PI * t.freq * frame / rate + channel * 0.5);
+}
+
+static Index<audio_sample> make_input (int rate)
+{
+    int frames = rate * SECONDS;
+    Index<audio_sample> in;
+    in.insert (0, frames * CHANNELS);
+
+    for (const Tone & t : tones)
+    {
+        if (t.freq >= rate / 2)
+            continue;
+
+        for (int i = 0; i < frames; i ++)
+            for (int c = 0; c < CHANNELS; c ++)
+                in[i * CHANNELS + c] += tone_at (t, rate, i, c);
+    }
+
+    return in;
+}
+
+static double snr (const Conversion & conv, const Index<audio_sample> & out)
+{
+    /* what can pass: below the output band edge (and present at all) */
+    int limit = aud::min (conv.in_rate, conv.out_rate) / 2;
+    int frames = out.len () / CHANNELS;
+    double signal = 0, noise = 0;
+
+    for (int i = EDGE; i < frames - EDGE; i ++)
+    {
+        for (int c = 0; c < CHANNELS; c ++)
+        {
+            double want = 0;
+            for (const Tone & t : tones)
+            {
+                if (t.freq < limit * 0.85)
+                    want += tone_at (t, conv.out_rate, i, c);
+            }
+
+            double err = out[i * CHANNELS + c] - want;
+            signal += want * want;
+            noise += err * err;
+        }
+    }
+
+    return 10 * log10 (signal / aud::max (noise, 1e-30));
+}
+
+static double cpu_seconds ()
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_PROCESS_CPUTIME_ID, & ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void run_builtin (const Conversion & conv, const Index<audio_sample> & in,
+ SincResampler::Quality quality, Index<audio_sample> & out, double & time)
+{
+    double ratio = (double) conv.out_rate / conv.in_rate;
+    int frames = in.len () / CHANNELS;
+
+    SincResampler rs;
+    rs.setup (CHANNELS, quality);
+    rs.reset ();
+
+    out.resize (0);
+    double start = cpu_seconds ();
+
+    for (int i = 0; i < frames; i += BLOCK)
+    {
+        int n = aud::min (BLOCK, frames - i);
+        rs.process (& in[i * CHANNELS], n, ratio, i + n == frames, out);
+    }
+
+    time = cpu_seconds () - start;
+}
+
+static bool run_src (const Conversion & conv, const Index<audio_sample> & in,
+ int type, Index<audio_sample> & out, double & time)
+{
+    double ratio = (double) conv.out_rate / conv.in_rate;
+    int frames = in.len () / CHANNELS;
+
+    int error;
+    SRC_STATE * state = src_new (type, CHANNELS, & error);
+    if (! state)
+    {
+        fprintf (stderr, "src_new: %s\n", src_strerror (error));
+        return false;
+    }
+
+    /* libsamplerate takes float; not timed */
+    Index<float> fin, fout;
+    fin.resize (in.len ());
+    for (int i = 0; i < in.len (); i ++)
+        fin[i] = in[i];
+
+    fout.resize ((int) (frames * ratio + BLOCK * ratio + 256) * CHANNELS);
+
+    int made = 0;
+    double start = cpu_seconds ();
+
+    for (int i = 0; i < frames; )
+    {
+        int n = aud::min (BLOCK, frames - i);
+
+        SRC_DATA d = SRC_DATA ();
+        d.data_in = & fin[i * CHANNELS];
+        d.input_frames = n;
+        d.data_out = & fout[made * CHANNELS];
+        d.output_frames = fout.len () / CHANNELS - made;
+        d.src_ratio = ratio;
+        d.end_of_input = (i + n == frames);
+
+        if ((error = src_process (state, & d)))
+        {
+            fprintf (stderr, "src_process: %s\n", src_strerror (error));
+            src_delete (state);
+            return false;
+        }
+
+        i += d.input_frames_used;
+        made += d.output_frames_gen;
+
+        /* at the end, collect what is still held back */
+        if (d.end_of_input && i == frames)
+        {
+            while (d.output_frames_gen)
+            {
+                d.data_in = nullptr;
+                d.input_frames = 0;
+                d.data_out = & fout[made * CHANNELS];
+                d.output_frames = fout.len () / CHANNELS - made;
+
+                if (src_process (state, & d))
+                    break;
+
+                made += d.output_frames_gen;
+            }
+        }
+    }
+
+    time = cpu_seconds () - start;
+    src_delete (state);
+
+    out.resize (made * CHANNELS);
+    for (int i = 0; i < made * CHANNELS; i ++)
+        out[i] = fout[i];
+
+    return true;
+}
+
+int main ()
+{
+    static const struct {
+        const char * name;
+        SincResampler::Quality quality;
+        const char * src_name;
+        int src_type;
+    } pairs[] = {
+        {"Fast", SincResampler::Fast, "SINC_FASTEST", SRC_SINC_FASTEST},
+        {"Medium", SincResampler::Medium, "SINC_MEDIUM", SRC_SINC_MEDIUM_QUALITY},
+        {"Best", SincResampler::Best, "SINC_BEST", SRC_SINC_BEST_QUALITY}
+    };
+
+    printf ("audio_sample is %s; %d s of stereo input per run, in blocks of %d\n\n",
+     sizeof (audio_sample) == 8 ? "double" : "float", SECONDS, BLOCK);
+    printf ("%-13s  %-12s %8s %9s   %-12s %8s %9s\n", "conversion",
+     "builtin", "SNR dB", "x speed", "libsamplerate", "SNR dB", "x speed");
+
+    bool ok = true;
+
+    for (const Conversion & conv : conversions)
+    {
+        Index<audio_sample> in = make_input (conv.in_rate);
+        Index<audio_sample> out;
+
+        for (auto & p : pairs)
+        {
+            double time;
+            run_builtin (conv, in, p.quality, out, time);
+            double snr_a = snr (conv, out), speed_a = SECONDS / time;
+
+            double snr_b = 0, speed_b = 0;
+            if (run_src (conv, in, p.src_type, out, time))
+            {
+                snr_b = snr (conv, out);
+                speed_b = SECONDS / time;
+            }
+            else
+                ok = false;
+
+            printf ("%6d>%-6d  %-12s %8.1f %9.0f   %-12s %8.1f %9.0f\n",
+             conv.in_rate, conv.out_rate, p.name, snr_a, speed_a, p.src_name,
+             snr_b, speed_b);
+        }
+    }
+
+    return ok ? 0 : 1;
+}
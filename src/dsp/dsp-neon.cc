@@ -0,0 +1,312 @@
+/*
+ * Fauxdacious DSP kernels shared by the effect plugins
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+
+#include "dsp-private.h"
+
+#ifdef DSP_HAVE_NEON
+
+#include <arm_neon.h>
+
+static int correlate_neon (const float * a, const float * b, int i, int len,
+ float & cross, float & energy)
+{
+    float32x4_t c = vdupq_n_f32 (0), e = vdupq_n_f32 (0);
+
+    for (; i + 4 <= len; i += 4)
+    {
+        float32x4_t x = vld1q_f32 (a + i), y = vld1q_f32 (b + i);
+        c = vmlaq_f32 (c, x, y);
+        e = vmlaq_f32 (e, y, y);
+    }
+
+    float part[4];
+    vst1q_f32 (part, c);
+    cross += (part[0] + part[1]) + (part[2] + part[3]);
+    vst1q_f32 (part, e);
+    energy += (part[0] + part[1]) + (part[2] + part[3]);
+
+    return i;
+}
+
+#ifndef DEF_AUDIO_FLOAT64
+
+static const float steps4[4] = {0, 1, 2, 3};
+
+static int ramp_neon (float * data, int i, int len, float a, float step)
+{
+    const float32x4_t steps = vld1q_f32 (steps4);
+    const float32x4_t va = vdupq_n_f32 (a);
+
+    for (; i + 4 <= len; i += 4)
+    {
+        float32x4_t g = vaddq_f32 (va, vmulq_n_f32 (vaddq_f32 (vdupq_n_f32 (i), steps), step));
+        vst1q_f32 (data + i, vmulq_f32 (vld1q_f32 (data + i), g));
+    }
+
+    return i;
+}
+
+static int ramp_mix_neon (float * data, const float * add, int i, int len,
+ float a, float step, bool ramp_add)
+{
+    const float32x4_t steps = vld1q_f32 (steps4);
+    const float32x4_t va = vdupq_n_f32 (a);
+    const float32x4_t one = vdupq_n_f32 (1);
+
+    for (; i + 4 <= len; i += 4)
+    {
+        float32x4_t g = vaddq_f32 (va, vmulq_n_f32 (vaddq_f32 (vdupq_n_f32 (i), steps), step));
+        float32x4_t x = vld1q_f32 (add + i);
+        if (ramp_add)
+            x = vmulq_f32 (x, g);
+
+        float32x4_t d = vmulq_f32 (vld1q_f32 (data + i), vsubq_f32 (one, g));
+        vst1q_f32 (data + i, vaddq_f32 (d, x));
+    }
+
+    return i;
+}
+
+static int abs_sum_neon (const float * data, int i, int len, float & sum)
+{
+    float32x4_t acc = vdupq_n_f32 (0);
+
+    for (; i + 4 <= len; i += 4)
+        acc = vaddq_f32 (acc, vabsq_f32 (vld1q_f32 (data + i)));
+
+    float part[4];
+    vst1q_f32 (part, acc);
+    sum += (part[0] + part[1]) + (part[2] + part[3]);
+
+    return i;
+}
+
+static int abs_max_neon (const float * data, int i, int len, float & peak)
+{
+    float32x4_t acc = vdupq_n_f32 (peak);
+
+    for (; i + 4 <= len; i += 4)
+        acc = vmaxq_f32 (acc, vabsq_f32 (vld1q_f32 (data + i)));
+
+    float32x2_t m = vpmax_f32 (vget_low_f32 (acc), vget_high_f32 (acc));
+    m = vpmax_f32 (m, m);
+    peak = vget_lane_f32 (m, 0);
+
+    return i;
+}
+
+static int mat2x2_neon (float * data, int i, int frames, const float m[4])
+{
+    for (; i + 4 <= frames; i += 4)
+    {
+        float32x4x2_t x = vld2q_f32 (data + 2 * i);
+        float32x4x2_t y;
+        y.val[0] = vaddq_f32 (vmulq_n_f32 (x.val[0], m[0]), vmulq_n_f32 (x.val[1], m[1]));
+        y.val[1] = vaddq_f32 (vmulq_n_f32 (x.val[0], m[2]), vmulq_n_f32 (x.val[1], m[3]));
+        vst2q_f32 (data + 2 * i, y);
+    }
+
+    return i;
+}
+
+static int window_add_neon (float * out, const float * in, const float * window, int i, int len)
+{
+    for (; i + 4 <= len; i += 4)
+        vst1q_f32 (out + i, vmlaq_f32 (vld1q_f32 (out + i), vld1q_f32 (in + i), vld1q_f32 (window + i)));
+
+    return i;
+}
+
+static int frame_peaks_neon (const float * data, int channels, float * peaks, int i, int frames)
+{
+    if (channels == 1)
+    {
+        for (; i + 4 <= frames; i += 4)
+            vst1q_f32 (peaks + i, vabsq_f32 (vld1q_f32 (data + i)));
+    }
+    else if (channels == 2)
+    {
+        for (; i + 4 <= frames; i += 4)
+        {
+            float32x4x2_t x = vld2q_f32 (data + 2 * i);
+            vst1q_f32 (peaks + i, vmaxq_f32 (vabsq_f32 (x.val[0]), vabsq_f32 (x.val[1])));
+        }
+    }
+
+    return i;
+}
+
+static int apply_gains_neon (float * data, const float * gains, int channels, int i, int frames)
+{
+    if (channels == 1)
+    {
+        for (; i + 4 <= frames; i += 4)
+            vst1q_f32 (data + i, vmulq_f32 (vld1q_f32 (data + i), vld1q_f32 (gains + i)));
+    }
+    else if (channels == 2)
+    {
+        for (; i + 4 <= frames; i += 4)
+        {
+            float32x4_t g = vld1q_f32 (gains + i);
+            float32x4x2_t x = vld2q_f32 (data + 2 * i);
+            x.val[0] = vmulq_f32 (x.val[0], g);
+            x.val[1] = vmulq_f32 (x.val[1], g);
+            vst2q_f32 (data + 2 * i, x);
+        }
+    }
+
+    return i;
+}
+
+static int emphasize2_neon (float * data, int i, int frames, float amount, float prev[2])
+{
+    /* the previous input frame is in the last lane */
+    float32x4_t last_l = vdupq_n_f32 (prev[0]);
+    float32x4_t last_r = vdupq_n_f32 (prev[1]);
+
+    for (; i + 4 <= frames; i += 4)
+    {
+        float32x4x2_t x = vld2q_f32 (data + 2 * i);
+        float32x4_t before_l = vextq_f32 (last_l, x.val[0], 3);
+        float32x4_t before_r = vextq_f32 (last_r, x.val[1], 3);
+
+        last_l = x.val[0];
+        last_r = x.val[1];
+
+        x.val[0] = vaddq_f32 (x.val[0], vmulq_n_f32 (vsubq_f32 (x.val[0], before_l), amount));
+        x.val[1] = vaddq_f32 (x.val[1], vmulq_n_f32 (vsubq_f32 (x.val[1], before_r), amount));
+        vst2q_f32 (data + 2 * i, x);
+    }
+
+    prev[0] = vgetq_lane_f32 (last_l, 3);
+    prev[1] = vgetq_lane_f32 (last_r, 3);
+
+    return i;
+}
+
+static int remix12_neon (const float * in, float * out, int i, int frames, const float m[2])
+{
+    for (; i + 4 <= frames; i += 4)
+    {
+        float32x4_t x = vld1q_f32 (in + i);
+        float32x4x2_t y;
+        y.val[0] = vmulq_n_f32 (x, m[0]);
+        y.val[1] = vmulq_n_f32 (x, m[1]);
+        vst2q_f32 (out + 2 * i, y);
+    }
+
+    return i;
+}
+
+static int remix21_neon (const float * in, float * out, int i, int frames, const float m[2])
+{
+    for (; i + 4 <= frames; i += 4)
+    {
+        float32x4x2_t x = vld2q_f32 (in + 2 * i);
+        vst1q_f32 (out + i, vaddq_f32 (vmulq_n_f32 (x.val[0], m[0]), vmulq_n_f32 (x.val[1], m[1])));
+    }
+
+    return i;
+}
+
+static int get_channel2_neon (const float * in, int channel, float * out, int i, int frames)
+{
+    for (; i + 4 <= frames; i += 4)
+    {
+        float32x4x2_t x = vld2q_f32 (in + 2 * i);
+        vst1q_f32 (out + i, channel ? x.val[1] : x.val[0]);
+    }
+
+    return i;
+}
+
+static int set_channel2_neon (const float * in, float * out, int channel, int i, int frames)
+{
+    for (; i + 4 <= frames; i += 4)
+    {
+        float32x4x2_t x = vld2q_f32 (out + 2 * i);
+        if (channel)
+            x.val[1] = vld1q_f32 (in + i);
+        else
+            x.val[0] = vld1q_f32 (in + i);
+
+        vst2q_f32 (out + 2 * i, x);
+    }
+
+    return i;
+}
+
+void dsp_init_neon (DSPKernels & k)
+{
+    k.ramp = ramp_neon;
+    k.ramp_mix = ramp_mix_neon;
+    k.abs_sum = abs_sum_neon;
+    k.abs_max = abs_max_neon;
+    k.mat2x2 = mat2x2_neon;
+    k.window_add = window_add_neon;
+    k.correlate = correlate_neon;
+    k.frame_peaks = frame_peaks_neon;
+    k.apply_gains = apply_gains_neon;
+    k.emphasize2 = emphasize2_neon;
+    k.remix12 = remix12_neon;
+    k.remix21 = remix21_neon;
+    k.get_channel2 = get_channel2_neon;
+    k.set_channel2 = set_channel2_neon;
+}
+
+#else  /* DEF_AUDIO_FLOAT64 */
+
+/* converting between float and double takes AArch64 */
+#ifdef __aarch64__
+static int to_float_neon (const double * in, float * out, int i, int len)
+{
+    for (; i + 4 <= len; i += 4)
+    {
+        float32x2_t lo = vcvt_f32_f64 (vld1q_f64 (in + i));
+        float32x2_t hi = vcvt_f32_f64 (vld1q_f64 (in + i + 2));
+        vst1q_f32 (out + i, vcombine_f32 (lo, hi));
+    }
+
+    return i;
+}
+
+static int from_float_neon (const float * in, double * out, int i, int len)
+{
+    for (; i + 4 <= len; i += 4)
+    {
+        float32x4_t x = vld1q_f32 (in + i);
+        vst1q_f64 (out + i, vcvt_f64_f32 (vget_low_f32 (x)));
+        vst1q_f64 (out + i + 2, vcvt_high_f64_f32 (x));
+    }
+
+    return i;
+}
+#endif
+
+void dsp_init_neon (DSPKernels & k)
+{
+    k.correlate = correlate_neon;
+#ifdef __aarch64__
+    k.to_float = to_float_neon;
+    k.from_float = from_float_neon;
+#endif
+}
+
+#endif
+#endif
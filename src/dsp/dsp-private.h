@@ -0,0 +1,87 @@
+/*
+ * Fauxdacious DSP kernels shared by the effect plugins
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef __DSP_PRIVATE_H__GUARD
+#define __DSP_PRIVATE_H__GUARD
+
+#include "dsp.h"
+
+#if defined(__SSE2__)
+#define DSP_HAVE_SSE2
+#endif
+
+/* AVX2 is built in whenever the compiler can target it per function, and
+ * used only if the CPU turns out to have it */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define DSP_HAVE_AVX2
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define DSP_HAVE_NEON
+#endif
+
+/* The vector parts of the kernels.  Like elsewhere in the tree, each starts at
+ * sample (or frame) <i>, does as many whole vectors as it can and returns the
+ * first one it did not do; the caller finishes the rest in C.  An entry left
+ * null has no vector version on this CPU. */
+struct DSPKernels
+{
+    int (* ramp) (audio_sample * data, int i, int len, float a, float step);
+    int (* ramp_mix) (audio_sample * data, const audio_sample * add, int i, int len,
+     float a, float step, bool ramp_add);
+    int (* abs_sum) (const audio_sample * data, int i, int len, audio_sample & sum);
+    int (* abs_max) (const audio_sample * data, int i, int len, audio_sample & peak);
+    int (* mat2x2) (audio_sample * data, int i, int frames, const float m[4]);
+    int (* window_add) (audio_sample * out, const audio_sample * in, const float * window,
+     int i, int len);
+
+    /* float whatever audio_sample is */
+    int (* correlate) (const float * a, const float * b, int i, int len, float & cross,
+     float & energy);
+
+    /* mono and stereo only; others return <i> */
+    int (* frame_peaks) (const audio_sample * data, int channels, float * peaks, int i, int frames);
+    int (* apply_gains) (audio_sample * data, const float * gains, int channels, int i, int frames);
+
+    /* stereo only; prev[] is kept up to date with the last frame done */
+    int (* emphasize2) (audio_sample * data, int i, int frames, float amount,
+     audio_sample prev[2]);
+
+    /* 1 -> 2 and 2 -> 1 channels */
+    int (* remix12) (const audio_sample * in, audio_sample * out, int i, int frames,
+     const float m[2]);
+    int (* remix21) (const audio_sample * in, audio_sample * out, int i, int frames,
+     const float m[2]);
+
+    /* stereo only */
+    int (* get_channel2) (const audio_sample * in, int channel, float * out, int i, int frames);
+    int (* set_channel2) (const float * in, audio_sample * out, int channel, int i, int frames);
+
+    int (* to_float) (const audio_sample * in, float * out, int i, int len);
+    int (* from_float) (const float * in, audio_sample * out, int i, int len);
+};
+
+/* the table in use, picked on first use; test-dsp.cc swaps in others */
+DSPKernels & dsp_kernels ();
+
+/* each fills in the entries it has */
+void dsp_init_sse2 (DSPKernels & k);
+void dsp_init_avx2 (DSPKernels & k);
+void dsp_init_neon (DSPKernels & k);
+
+#endif
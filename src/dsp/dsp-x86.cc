@@ -0,0 +1,503 @@
+/*
+ * Fauxdacious DSP kernels shared by the effect plugins
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+
+#include "dsp-private.h"
+
+#if defined(DSP_HAVE_AVX2)
+#include <immintrin.h>
+#elif defined(DSP_HAVE_SSE2)
+#include <emmintrin.h>
+#endif
+
+/* ---- SSE2 ---- */
+
+#ifdef DSP_HAVE_SSE2
+
+static int correlate_sse2 (const float * a, const float * b, int i, int len,
+ float & cross, float & energy)
+{
+    __m128 c = _mm_setzero_ps (), e = _mm_setzero_ps ();
+
+    for (; i + 4 <= len; i += 4)
+    {
+        __m128 x = _mm_loadu_ps (a + i), y = _mm_loadu_ps (b + i);
+        c = _mm_add_ps (c, _mm_mul_ps (x, y));
+        e = _mm_add_ps (e, _mm_mul_ps (y, y));
+    }
+
+    float part[4];
+    _mm_storeu_ps (part, c);
+    cross += (part[0] + part[1]) + (part[2] + part[3]);
+    _mm_storeu_ps (part, e);
+    energy += (part[0] + part[1]) + (part[2] + part[3]);
+
+    return i;
+}
+
+#endif
+
+#if defined(DSP_HAVE_SSE2) && ! defined(DEF_AUDIO_FLOAT64)
+
+static int ramp_sse2 (float * data, int i, int len, float a, float step)
+{
+    const __m128 steps = _mm_set_ps (3, 2, 1, 0);
+    const __m128 va = _mm_set1_ps (a), vstep = _mm_set1_ps (step);
+
+    for (; i + 4 <= len; i += 4)
+    {
+        __m128 g = _mm_add_ps (va, _mm_mul_ps (vstep, _mm_add_ps (_mm_set1_ps (i), steps)));
+        _mm_storeu_ps (data + i, _mm_mul_ps (_mm_loadu_ps (data + i), g));
+    }
+
+    return i;
+}
+
+static int ramp_mix_sse2 (float * data, const float * add, int i, int len,
+ float a, float step, bool ramp_add)
+{
+    const __m128 steps = _mm_set_ps (3, 2, 1, 0);
+    const __m128 va = _mm_set1_ps (a), vstep = _mm_set1_ps (step);
+    const __m128 one = _mm_set1_ps (1);
+
+    for (; i + 4 <= len; i += 4)
+    {
+        __m128 g = _mm_add_ps (va, _mm_mul_ps (vstep, _mm_add_ps (_mm_set1_ps (i), steps)));
+        __m128 x = _mm_loadu_ps (add + i);
+        if (ramp_add)
+            x = _mm_mul_ps (x, g);
+
+        __m128 d = _mm_mul_ps (_mm_loadu_ps (data + i), _mm_sub_ps (one, g));
+        _mm_storeu_ps (data + i, _mm_add_ps (d, x));
+    }
+
+    return i;
+}
+
+static int abs_sum_sse2 (const float * data, int i, int len, float & sum)
+{
+    const __m128 mask = _mm_castsi128_ps (_mm_set1_epi32 (0x7fffffff));
+    __m128 acc = _mm_setzero_ps ();
+
+    for (; i + 4 <= len; i += 4)
+        acc = _mm_add_ps (acc, _mm_and_ps (_mm_loadu_ps (data + i), mask));
+
+    float part[4];
+    _mm_storeu_ps (part, acc);
+    sum += (part[0] + part[1]) + (part[2] + part[3]);
+
+    return i;
+}
+
+static int abs_max_sse2 (const float * data, int i, int len, float & peak)
+{
+    const __m128 mask = _mm_castsi128_ps (_mm_set1_epi32 (0x7fffffff));
+    __m128 acc = _mm_set1_ps (peak);
+
+    for (; i + 4 <= len; i += 4)
+        acc = _mm_max_ps (acc, _mm_and_ps (_mm_loadu_ps (data + i), mask));
+
+    acc = _mm_max_ps (acc, _mm_shuffle_ps (acc, acc, _MM_SHUFFLE (1, 0, 3, 2)));
+    acc = _mm_max_ps (acc, _mm_shuffle_ps (acc, acc, _MM_SHUFFLE (2, 3, 0, 1)));
+    peak = _mm_cvtss_f32 (acc);
+
+    return i;
+}
+
+static int mat2x2_sse2 (float * data, int i, int frames, const float m[4])
+{
+    /* per pair of frames: (L0 L0 L1 L1) * (m0 m2 ..) + (R0 R0 R1 R1) * (m1 m3 ..) */
+    const __m128 ml = _mm_set_ps (m[2], m[0], m[2], m[0]);
+    const __m128 mr = _mm_set_ps (m[3], m[1], m[3], m[1]);
+
+    for (; i + 2 <= frames; i += 2)
+    {
+        __m128 x = _mm_loadu_ps (data + 2 * i);
+        __m128 l = _mm_shuffle_ps (x, x, _MM_SHUFFLE (2, 2, 0, 0));
+        __m128 r = _mm_shuffle_ps (x, x, _MM_SHUFFLE (3, 3, 1, 1));
+        _mm_storeu_ps (data + 2 * i, _mm_add_ps (_mm_mul_ps (l, ml), _mm_mul_ps (r, mr)));
+    }
+
+    return i;
+}
+
+static int window_add_sse2 (float * out, const float * in, const float * window, int i, int len)
+{
+    for (; i + 4 <= len; i += 4)
+    {
+        __m128 x = _mm_mul_ps (_mm_loadu_ps (in + i), _mm_loadu_ps (window + i));
+        _mm_storeu_ps (out + i, _mm_add_ps (_mm_loadu_ps (out + i), x));
+    }
+
+    return i;
+}
+
+static int frame_peaks_sse2 (const float * data, int channels, float * peaks, int i, int frames)
+{
+    const __m128 mask = _mm_castsi128_ps (_mm_set1_epi32 (0x7fffffff));
+
+    if (channels == 1)
+    {
+        for (; i + 4 <= frames; i += 4)
+            _mm_storeu_ps (peaks + i, _mm_and_ps (_mm_loadu_ps (data + i), mask));
+    }
+    else if (channels == 2)
+    {
+        for (; i + 4 <= frames; i += 4)
+        {
+            __m128 a = _mm_and_ps (_mm_loadu_ps (data + 2 * i), mask);
+            __m128 b = _mm_and_ps (_mm_loadu_ps (data + 2 * i + 4), mask);
+            _mm_storeu_ps (peaks + i, _mm_max_ps (_mm_shuffle_ps (a, b, _MM_SHUFFLE (2, 0, 2, 0)),
+             _mm_shuffle_ps (a, b, _MM_SHUFFLE (3, 1, 3, 1))));
+        }
+    }
+
+    return i;
+}
+
+static int apply_gains_sse2 (float * data, const float * gains, int channels, int i, int frames)
+{
+    if (channels == 1)
+    {
+        for (; i + 4 <= frames; i += 4)
+            _mm_storeu_ps (data + i, _mm_mul_ps (_mm_loadu_ps (data + i), _mm_loadu_ps (gains + i)));
+    }
+    else if (channels == 2)
+    {
+        for (; i + 4 <= frames; i += 4)
+        {
+            __m128 g = _mm_loadu_ps (gains + i);
+            _mm_storeu_ps (data + 2 * i, _mm_mul_ps (_mm_loadu_ps (data + 2 * i), _mm_unpacklo_ps (g, g)));
+            _mm_storeu_ps (data + 2 * i + 4, _mm_mul_ps (_mm_loadu_ps (data + 2 * i + 4), _mm_unpackhi_ps (g, g)));
+        }
+    }
+
+    return i;
+}
+
+static int emphasize2_sse2 (float * data, int i, int frames, float amount, float prev[2])
+{
+    const __m128 amt = _mm_set1_ps (amount);
+
+    /* the previous input frame lives in the upper half */
+    __m128 last = _mm_set_ps (prev[1], prev[0], 0, 0);
+
+    for (; i + 2 <= frames; i += 2)
+    {
+        __m128 x = _mm_loadu_ps (data + 2 * i);
+        __m128 before = _mm_shuffle_ps (last, x, _MM_SHUFFLE (1, 0, 3, 2));
+        _mm_storeu_ps (data + 2 * i, _mm_add_ps (x, _mm_mul_ps (_mm_sub_ps (x, before), amt)));
+        last = x;
+    }
+
+    float part[4];
+    _mm_storeu_ps (part, last);
+    prev[0] = part[2];
+    prev[1] = part[3];
+
+    return i;
+}
+
+static int remix12_sse2 (const float * in, float * out, int i, int frames, const float m[2])
+{
+    const __m128 mm = _mm_set_ps (m[1], m[0], m[1], m[0]);
+
+    for (; i + 4 <= frames; i += 4)
+    {
+        __m128 x = _mm_loadu_ps (in + i);
+        _mm_storeu_ps (out + 2 * i, _mm_mul_ps (_mm_unpacklo_ps (x, x), mm));
+        _mm_storeu_ps (out + 2 * i + 4, _mm_mul_ps (_mm_unpackhi_ps (x, x), mm));
+    }
+
+    return i;
+}
+
+static int remix21_sse2 (const float * in, float * out, int i, int frames, const float m[2])
+{
+    const __m128 m0 = _mm_set1_ps (m[0]), m1 = _mm_set1_ps (m[1]);
+
+    for (; i + 4 <= frames; i += 4)
+    {
+        __m128 a = _mm_loadu_ps (in + 2 * i);
+        __m128 b = _mm_loadu_ps (in + 2 * i + 4);
+        __m128 l = _mm_shuffle_ps (a, b, _MM_SHUFFLE (2, 0, 2, 0));
+        __m128 r = _mm_shuffle_ps (a, b, _MM_SHUFFLE (3, 1, 3, 1));
+        _mm_storeu_ps (out + i, _mm_add_ps (_mm_mul_ps (l, m0), _mm_mul_ps (r, m1)));
+    }
+
+    return i;
+}
+
+static int get_channel2_sse2 (const float * in, int channel, float * out, int i, int frames)
+{
+    for (; i + 4 <= frames; i += 4)
+    {
+        __m128 a = _mm_loadu_ps (in + 2 * i);
+        __m128 b = _mm_loadu_ps (in + 2 * i + 4);
+
+        if (channel)
+            _mm_storeu_ps (out + i, _mm_shuffle_ps (a, b, _MM_SHUFFLE (3, 1, 3, 1)));
+        else
+            _mm_storeu_ps (out + i, _mm_shuffle_ps (a, b, _MM_SHUFFLE (2, 0, 2, 0)));
+    }
+
+    return i;
+}
+
+static int set_channel2_sse2 (const float * in, float * out, int channel, int i, int frames)
+{
+    for (; i + 4 <= frames; i += 4)
+    {
+        __m128 a = _mm_loadu_ps (out + 2 * i);
+        __m128 b = _mm_loadu_ps (out + 2 * i + 4);
+        __m128 x = _mm_loadu_ps (in + i);
+        __m128 lo, hi;
+
+        if (channel)
+        {
+            __m128 l = _mm_shuffle_ps (a, b, _MM_SHUFFLE (2, 0, 2, 0));
+            lo = _mm_unpacklo_ps (l, x);
+            hi = _mm_unpackhi_ps (l, x);
+        }
+        else
+        {
+            __m128 r = _mm_shuffle_ps (a, b, _MM_SHUFFLE (3, 1, 3, 1));
+            lo = _mm_unpacklo_ps (x, r);
+            hi = _mm_unpackhi_ps (x, r);
+        }
+
+        _mm_storeu_ps (out + 2 * i, lo);
+        _mm_storeu_ps (out + 2 * i + 4, hi);
+    }
+
+    return i;
+}
+
+void dsp_init_sse2 (DSPKernels & k)
+{
+    k.ramp = ramp_sse2;
+    k.ramp_mix = ramp_mix_sse2;
+    k.abs_sum = abs_sum_sse2;
+    k.abs_max = abs_max_sse2;
+    k.mat2x2 = mat2x2_sse2;
+    k.window_add = window_add_sse2;
+    k.correlate = correlate_sse2;
+    k.frame_peaks = frame_peaks_sse2;
+    k.apply_gains = apply_gains_sse2;
+    k.emphasize2 = emphasize2_sse2;
+    k.remix12 = remix12_sse2;
+    k.remix21 = remix21_sse2;
+    k.get_channel2 = get_channel2_sse2;
+    k.set_channel2 = set_channel2_sse2;
+}
+
+#elif defined(DSP_HAVE_SSE2)  /* DEF_AUDIO_FLOAT64 */
+
+static int to_float_sse2 (const double * in, float * out, int i, int len)
+{
+    for (; i + 4 <= len; i += 4)
+    {
+        __m128 lo = _mm_cvtpd_ps (_mm_loadu_pd (in + i));
+        __m128 hi = _mm_cvtpd_ps (_mm_loadu_pd (in + i + 2));
+        _mm_storeu_ps (out + i, _mm_movelh_ps (lo, hi));
+    }
+
+    return i;
+}
+
+static int from_float_sse2 (const float * in, double * out, int i, int len)
+{
+    for (; i + 4 <= len; i += 4)
+    {
+        __m128 x = _mm_loadu_ps (in + i);
+        _mm_storeu_pd (out + i, _mm_cvtps_pd (x));
+        _mm_storeu_pd (out + i + 2, _mm_cvtps_pd (_mm_movehl_ps (x, x)));
+    }
+
+    return i;
+}
+
+void dsp_init_sse2 (DSPKernels & k)
+{
+    k.to_float = to_float_sse2;
+    k.from_float = from_float_sse2;
+    k.correlate = correlate_sse2;
+}
+
+#endif
+
+/* ---- AVX2 (the rest stays with SSE2) ---- */
+
+#ifdef DSP_HAVE_AVX2
+
+#define AVX2 __attribute__ ((target ("avx2")))
+
+AVX2 static int correlate_avx2 (const float * a, const float * b, int i, int len,
+ float & cross, float & energy)
+{
+    __m256 c = _mm256_setzero_ps (), e = _mm256_setzero_ps ();
+
+    for (; i + 8 <= len; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps (a + i), y = _mm256_loadu_ps (b + i);
+        c = _mm256_add_ps (c, _mm256_mul_ps (x, y));
+        e = _mm256_add_ps (e, _mm256_mul_ps (y, y));
+    }
+
+    float part[8];
+    _mm256_storeu_ps (part, c);
+    cross += ((part[0] + part[1]) + (part[2] + part[3])) + ((part[4] + part[5]) + (part[6] + part[7]));
+    _mm256_storeu_ps (part, e);
+    energy += ((part[0] + part[1]) + (part[2] + part[3])) + ((part[4] + part[5]) + (part[6] + part[7]));
+
+    return i;
+}
+
+#ifndef DEF_AUDIO_FLOAT64
+
+AVX2 static int ramp_avx2 (float * data, int i, int len, float a, float step)
+{
+    const __m256 steps = _mm256_set_ps (7, 6, 5, 4, 3, 2, 1, 0);
+    const __m256 va = _mm256_set1_ps (a), vstep = _mm256_set1_ps (step);
+
+    for (; i + 8 <= len; i += 8)
+    {
+        __m256 g = _mm256_add_ps (va, _mm256_mul_ps (vstep, _mm256_add_ps (_mm256_set1_ps (i), steps)));
+        _mm256_storeu_ps (data + i, _mm256_mul_ps (_mm256_loadu_ps (data + i), g));
+    }
+
+    return i;
+}
+
+AVX2 static int ramp_mix_avx2 (float * data, const float * add, int i, int len,
+ float a, float step, bool ramp_add)
+{
+    const __m256 steps = _mm256_set_ps (7, 6, 5, 4, 3, 2, 1, 0);
+    const __m256 va = _mm256_set1_ps (a), vstep = _mm256_set1_ps (step);
+    const __m256 one = _mm256_set1_ps (1);
+
+    for (; i + 8 <= len; i += 8)
+    {
+        __m256 g = _mm256_add_ps (va, _mm256_mul_ps (vstep, _mm256_add_ps (_mm256_set1_ps (i), steps)));
+        __m256 x = _mm256_loadu_ps (add + i);
+        if (ramp_add)
+            x = _mm256_mul_ps (x, g);
+
+        __m256 d = _mm256_mul_ps (_mm256_loadu_ps (data + i), _mm256_sub_ps (one, g));
+        _mm256_storeu_ps (data + i, _mm256_add_ps (d, x));
+    }
+
+    return i;
+}
+
+AVX2 static int abs_sum_avx2 (const float * data, int i, int len, float & sum)
+{
+    const __m256 mask = _mm256_castsi256_ps (_mm256_set1_epi32 (0x7fffffff));
+    __m256 acc = _mm256_setzero_ps ();
+
+    for (; i + 8 <= len; i += 8)
+        acc = _mm256_add_ps (acc, _mm256_and_ps (_mm256_loadu_ps (data + i), mask));
+
+    float part[8];
+    _mm256_storeu_ps (part, acc);
+    sum += ((part[0] + part[1]) + (part[2] + part[3])) + ((part[4] + part[5]) + (part[6] + part[7]));
+
+    return i;
+}
+
+AVX2 static int abs_max_avx2 (const float * data, int i, int len, float & peak)
+{
+    const __m256 mask = _mm256_castsi256_ps (_mm256_set1_epi32 (0x7fffffff));
+    __m256 acc = _mm256_set1_ps (peak);
+
+    for (; i + 8 <= len; i += 8)
+        acc = _mm256_max_ps (acc, _mm256_and_ps (_mm256_loadu_ps (data + i), mask));
+
+    __m128 m = _mm_max_ps (_mm256_castps256_ps128 (acc), _mm256_extractf128_ps (acc, 1));
+    m = _mm_max_ps (m, _mm_shuffle_ps (m, m, _MM_SHUFFLE (1, 0, 3, 2)));
+    m = _mm_max_ps (m, _mm_shuffle_ps (m, m, _MM_SHUFFLE (2, 3, 0, 1)));
+    peak = _mm_cvtss_f32 (m);
+
+    return i;
+}
+
+AVX2 static int window_add_avx2 (float * out, const float * in, const float * window, int i, int len)
+{
+    for (; i + 8 <= len; i += 8)
+    {
+        __m256 x = _mm256_mul_ps (_mm256_loadu_ps (in + i), _mm256_loadu_ps (window + i));
+        _mm256_storeu_ps (out + i, _mm256_add_ps (_mm256_loadu_ps (out + i), x));
+    }
+
+    return i;
+}
+
+AVX2 static int mat2x2_avx2 (float * data, int i, int frames, const float m[4])
+{
+    const __m256 ml = _mm256_set_ps (m[2], m[0], m[2], m[0], m[2], m[0], m[2], m[0]);
+    const __m256 mr = _mm256_set_ps (m[3], m[1], m[3], m[1], m[3], m[1], m[3], m[1]);
+
+    for (; i + 4 <= frames; i += 4)
+    {
+        __m256 x = _mm256_loadu_ps (data + 2 * i);
+        __m256 l = _mm256_permute_ps (x, _MM_SHUFFLE (2, 2, 0, 0));
+        __m256 r = _mm256_permute_ps (x, _MM_SHUFFLE (3, 3, 1, 1));
+        _mm256_storeu_ps (data + 2 * i, _mm256_add_ps (_mm256_mul_ps (l, ml), _mm256_mul_ps (r, mr)));
+    }
+
+    return i;
+}
+
+void dsp_init_avx2 (DSPKernels & k)
+{
+    k.ramp = ramp_avx2;
+    k.ramp_mix = ramp_mix_avx2;
+    k.abs_sum = abs_sum_avx2;
+    k.abs_max = abs_max_avx2;
+    k.mat2x2 = mat2x2_avx2;
+    k.window_add = window_add_avx2;
+    k.correlate = correlate_avx2;
+}
+
+#else  /* DEF_AUDIO_FLOAT64 */
+
+AVX2 static int to_float_avx2 (const double * in, float * out, int i, int len)
+{
+    for (; i + 4 <= len; i += 4)
+        _mm_storeu_ps (out + i, _mm256_cvtpd_ps (_mm256_loadu_pd (in + i)));
+
+    return i;
+}
+
+AVX2 static int from_float_avx2 (const float * in, double * out, int i, int len)
+{
+    for (; i + 4 <= len; i += 4)
+        _mm256_storeu_pd (out + i, _mm256_cvtps_pd (_mm_loadu_ps (in + i)));
+
+    return i;
+}
+
+void dsp_init_avx2 (DSPKernels & k)
+{
+    k.to_float = to_float_avx2;
+    k.from_float = from_float_avx2;
+    k.correlate = correlate_avx2;
+}
+
+#endif
+#endif
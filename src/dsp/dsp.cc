@@ -0,0 +1,273 @@
+/*
+ * Fauxdacious DSP kernels shared by the effect plugins
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+
+#include <math.h>
+#include <string.h>
+
+#include "dsp-private.h"
+
+static DSPKernels pick_kernels ()
+{
+    DSPKernels k = DSPKernels ();
+
+#ifdef DSP_HAVE_SSE2
+    dsp_init_sse2 (k);
+#endif
+#ifdef DSP_HAVE_AVX2
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx2"))
+        dsp_init_avx2 (k);
+#endif
+#ifdef DSP_HAVE_NEON
+    dsp_init_neon (k);
+#endif
+
+    return k;
+}
+
+DSPKernels & dsp_kernels ()
+{
+    static DSPKernels k = pick_kernels ();
+    return k;
+}
+
+static const DSPKernels & kernels ()
+    { return dsp_kernels (); }
+
+void dsp_ramp (audio_sample * data, int len, float a, float step)
+{
+    int i = 0;
+    if (kernels ().ramp)
+        i = kernels ().ramp (data, i, len, a, step);
+
+    for (; i < len; i ++)
+        data[i] *= a + step * i;
+}
+
+void dsp_ramp_mix (audio_sample * data, const audio_sample * add, int len,
+ float a, float step, bool ramp_add)
+{
+    int i = 0;
+    if (kernels ().ramp_mix)
+        i = kernels ().ramp_mix (data, add, i, len, a, step, ramp_add);
+
+    for (; i < len; i ++)
+    {
+        float g = a + step * i;
+        data[i] = data[i] * (1 - g) + (ramp_add ? add[i] * g : add[i]);
+    }
+}
+
+audio_sample dsp_abs_sum (const audio_sample * data, int len)
+{
+    audio_sample sum = 0;
+    int i = 0;
+    if (kernels ().abs_sum)
+        i = kernels ().abs_sum (data, i, len, sum);
+
+    for (; i < len; i ++)
+        sum += fabs (data[i]);
+
+    return sum;
+}
+
+audio_sample dsp_abs_max (const audio_sample * data, int len)
+{
+    audio_sample peak = 0;
+    int i = 0;
+    if (kernels ().abs_max)
+        i = kernels ().abs_max (data, i, len, peak);
+
+    for (; i < len; i ++)
+    {
+        audio_sample x = fabs (data[i]);
+        if (x > peak)
+            peak = x;
+    }
+
+    return peak;
+}
+
+void dsp_frame_peaks (const audio_sample * data, int frames, int channels, float * peaks)
+{
+    int i = 0;
+    if (kernels ().frame_peaks)
+        i = kernels ().frame_peaks (data, channels, peaks, i, frames);
+
+    for (data += i * channels; i < frames; i ++)
+    {
+        audio_sample peak = 0;
+        for (int c = 0; c < channels; c ++)
+        {
+            audio_sample x = fabs (* data ++);
+            if (x > peak)
+                peak = x;
+        }
+
+        peaks[i] = peak;
+    }
+}
+
+void dsp_apply_gains (audio_sample * data, const float * gains, int frames, int channels)
+{
+    int i = 0;
+    if (kernels ().apply_gains)
+        i = kernels ().apply_gains (data, gains, channels, i, frames);
+
+    for (data += i * channels; i < frames; i ++)
+    {
+        for (int c = 0; c < channels; c ++)
+            * data ++ *= gains[i];
+    }
+}
+
+void dsp_window_add (audio_sample * out, const audio_sample * in, const float * window, int len)
+{
+    int i = 0;
+    if (kernels ().window_add)
+        i = kernels ().window_add (out, in, window, i, len);
+
+    for (; i < len; i ++)
+        out[i] += in[i] * window[i];
+}
+
+void dsp_correlate (const float * a, const float * b, int len, float & cross, float & energy)
+{
+    cross = energy = 0;
+    int i = 0;
+    if (kernels ().correlate)
+        i = kernels ().correlate (a, b, i, len, cross, energy);
+
+    for (; i < len; i ++)
+    {
+        cross += a[i] * b[i];
+        energy += b[i] * b[i];
+    }
+}
+
+void dsp_mat2x2 (audio_sample * data, int frames, const float m[4])
+{
+    int i = 0;
+    if (kernels ().mat2x2)
+        i = kernels ().mat2x2 (data, i, frames, m);
+
+    for (; i < frames; i ++)
+    {
+        audio_sample l = data[2 * i], r = data[2 * i + 1];
+        data[2 * i] = m[0] * l + m[1] * r;
+        data[2 * i + 1] = m[2] * l + m[3] * r;
+    }
+}
+
+void dsp_emphasize (audio_sample * data, int frames, int channels, float amount,
+ audio_sample * prev)
+{
+    int i = 0;
+    if (channels == 2 && kernels ().emphasize2)
+        i = kernels ().emphasize2 (data, i, frames, amount, prev);
+
+    for (audio_sample * f = data + i * channels; i < frames; i ++)
+    {
+        for (int c = 0; c < channels; c ++)
+        {
+            audio_sample current = * f;
+            * f ++ = current + (current - prev[c]) * amount;
+            prev[c] = current;
+        }
+    }
+}
+
+void dsp_remix (const audio_sample * in, int in_channels, audio_sample * out,
+ int out_channels, const float * matrix, int frames)
+{
+    int i = 0;
+    if (in_channels == 1 && out_channels == 2 && kernels ().remix12)
+        i = kernels ().remix12 (in, out, i, frames, matrix);
+    else if (in_channels == 2 && out_channels == 1 && kernels ().remix21)
+        i = kernels ().remix21 (in, out, i, frames, matrix);
+
+    in += i * in_channels;
+    out += i * out_channels;
+
+    for (; i < frames; i ++)
+    {
+        const float * row = matrix;
+
+        for (int o = 0; o < out_channels; o ++)
+        {
+            audio_sample sum = 0;
+            for (int c = 0; c < in_channels; c ++)
+                sum += * row ++ * in[c];
+
+            * out ++ = sum;
+        }
+
+        in += in_channels;
+    }
+}
+
+void dsp_get_channel (const audio_sample * in, int channels, int channel,
+ float * out, int frames)
+{
+    int i = 0;
+    if (channels == 2 && kernels ().get_channel2)
+        i = kernels ().get_channel2 (in, channel, out, i, frames);
+
+    for (; i < frames; i ++)
+        out[i] = in[i * channels + channel];
+}
+
+void dsp_set_channel (const float * in, audio_sample * out, int channels,
+ int channel, int frames)
+{
+    int i = 0;
+    if (channels == 2 && kernels ().set_channel2)
+        i = kernels ().set_channel2 (in, out, channel, i, frames);
+
+    for (; i < frames; i ++)
+        out[i * channels + channel] = in[i];
+}
+
+void dsp_to_float (const audio_sample * in, float * out, int len)
+{
+#ifdef DEF_AUDIO_FLOAT64
+    int i = 0;
+    if (kernels ().to_float)
+        i = kernels ().to_float (in, out, i, len);
+
+    for (; i < len; i ++)
+        out[i] = in[i];
+#else
+    memcpy (out, in, sizeof (float) * len);
+#endif
+}
+
+void dsp_from_float (const float * in, audio_sample * out, int len)
+{
+#ifdef DEF_AUDIO_FLOAT64
+    int i = 0;
+    if (kernels ().from_float)
+        i = kernels ().from_float (in, out, i, len);
+
+    for (; i < len; i ++)
+        out[i] = in[i];
+#else
+    memcpy (out, in, sizeof (float) * len);
+#endif
+}
@@ -0,0 +1,81 @@
+/*
+ * Fauxdacious DSP kernels shared by the effect plugins
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef __DSP_H__GUARD
+#define __DSP_H__GUARD
+
+#include <libfauxdcore/audio.h>
+
+/*
+ * The inner loops that most effect plugins have in common.  Each picks the
+ * fastest version the CPU can run the first time it is called: SSE2 or AVX2
+ * on x86, NEON on ARM, or else the plain C version in dsp.cc, which is also
+ * the reference the others must agree with.  With DEF_AUDIO_FLOAT64, only the
+ * conversions to and from float and dsp_correlate() are vectorized.
+ *
+ * Linked statically into the plugins (see src/dsp/Makefile).
+ */
+
+/* data[i] *= a + step * i */
+void dsp_ramp (audio_sample * data, int len, float a, float step);
+
+/* data[i] = data[i] * (1 - g) + add[i] * (ramp_add ? g : 1),
+ * where g = a + step * i -- a crossfade in one pass */
+void dsp_ramp_mix (audio_sample * data, const audio_sample * add, int len,
+ float a, float step, bool ramp_add);
+
+/* sum and maximum of |data[i]| */
+audio_sample dsp_abs_sum (const audio_sample * data, int len);
+audio_sample dsp_abs_max (const audio_sample * data, int len);
+
+/* peaks[f] = the largest |sample| of frame f */
+void dsp_frame_peaks (const audio_sample * data, int frames, int channels, float * peaks);
+
+/* multiplies each frame by its own gain */
+void dsp_apply_gains (audio_sample * data, const float * gains, int frames, int channels);
+
+/* out[i] += in[i] * window[i] -- overlap-adding one windowed piece */
+void dsp_window_add (audio_sample * out, const audio_sample * in, const float * window, int len);
+
+/* for matching waveforms: cross = sum of a[i] b[i], energy = sum of b[i]^2 */
+void dsp_correlate (const float * a, const float * b, int len, float & cross, float & energy);
+
+/* interleaved stereo, in place: L = m[0] L + m[1] R, R = m[2] L + m[3] R */
+void dsp_mat2x2 (audio_sample * data, int frames, const float m[4]);
+
+/* per channel, x[n] += (x[n] - x[n - 1]) * amount; <prev> holds the last
+ * input frame of the previous call and is updated */
+void dsp_emphasize (audio_sample * data, int frames, int channels, float amount,
+ audio_sample * prev);
+
+/* out = matrix * in for each frame; <matrix> has <out_channels> rows of
+ * <in_channels> coefficients */
+void dsp_remix (const audio_sample * in, int in_channels, audio_sample * out,
+ int out_channels, const float * matrix, int frames);
+
+/* one channel of interleaved audio, to or from a separate float buffer */
+void dsp_get_channel (const audio_sample * in, int channels, int channel,
+ float * out, int frames);
+void dsp_set_channel (const float * in, audio_sample * out, int channels,
+ int channel, int frames);
+
+/* between audio_sample and float (a plain copy unless DEF_AUDIO_FLOAT64) */
+void dsp_to_float (const audio_sample * in, float * out, int len);
+void dsp_from_float (const float * in, audio_sample * out, int len);
+
+#endif
@@ -0,0 +1,236 @@
+/*
+ * Fauxdacious DSP kernels shared by the effect plugins
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <math.h>
+
+#include "sinc-resampler.h"
+
+struct QualitySpec {
+    int half;        // taps each side at unity ratio
+    int phases;      // table rows between two input frames
+    double beta;     // Kaiser window shape
+    double passband; // cutoff, relative to the lower Nyquist frequency
+};
+
+/* the cutoff is put so that the transition band ends about at Nyquist, and
+ * the phases so that interpolating between them stays below the stopband */
+static const QualitySpec specs[] = {
+    {16, 128, 7, 0.86},
+    {32, 256, 9, 0.91},
+    {64, 512, 12, 0.94}
+};
+
+/* modified Bessel function of the first kind, order 0 */
+static double bessel_i0 (double x)
+{
+    double sum = 1, term = 1;
+
+    for (int k = 1; term > sum * 1e-16; k ++)
+    {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+
+    return sum;
+}
+
+void SincResampler::setup (int channels, Quality quality)
+{
+    m_channels = channels;
+    m_quality = quality;
+
+    /* built on the first call to process() */
+    m_cutoff = 0;
+    m_half = 0;
+    m_table.clear ();
+    m_hist.clear ();
+    m_pos = 0;
+}
+
+void SincResampler::reset ()
+{
+    m_hist.resize (0);
+    m_hist.insert (0, m_half * m_channels);
+    m_pos = m_half;
+}
+
+void SincResampler::clear ()
+{
+    m_cutoff = 0;
+    m_half = 0;
+    m_table.clear ();
+    m_hist.clear ();
+    m_coefs.clear ();
+    m_pos = 0;
+}
+
+void SincResampler::build (double cutoff)
+{
+    const QualitySpec & spec = specs[m_quality];
+
+    /* the same transition band, relative to the cutoff, means a filter
+     * longer by as much as the cutoff is lower */
+    int half = (int) ceil (spec.half / (cutoff / spec.passband));
+    int taps = 2 * half;
+
+    m_phases = spec.phases;
+    m_table.resize ((m_phases + 1) * taps);
+
+    double scale = 1 / bessel_i0 (spec.beta);
+
+    for (int p = 0; p <= m_phases; p ++)
+    {
+        double frac = (double) p / m_phases;
+        audio_sample * row = & m_table[p * taps];
+
+        for (int j = 0; j < taps; j ++)
+        {
+            /* distance from the output position to input frame j */
+            double x = j - half + 1 - frac;
+            double u = x / half;
+
+            if (u <= -1 || u >= 1)
+            {
+                row[j] = 0;
+                continue;
+            }
+
+            double sinc = (x == 0) ? 1 : sin (M_PI * cutoff * x) / (M_PI * cutoff * x);
+            row[j] = cutoff * sinc * bessel_i0 (spec.beta * sqrt (1 - u * u)) * scale;
+        }
+    }
+
+    /* keep m_half frames of history before the output position */
+    if (half > m_half)
+    {
+        m_hist.insert (0, (half - m_half) * m_channels);
+        m_pos += half - m_half;
+    }
+    else if (half < m_half)
+    {
+        m_hist.remove (0, (m_half - half) * m_channels);
+        m_pos -= m_half - half;
+    }
+
+    m_cutoff = cutoff;
+    m_half = half;
+    m_coefs.resize (taps);
+}
+
+template<int C>
+static void dot_c (const audio_sample * x, const audio_sample * coefs, int taps,
+ audio_sample * out)
+{
+    audio_sample acc[C] = {};
+
+    for (int j = 0; j < taps; j ++)
+        for (int c = 0; c < C; c ++)
+            acc[c] += x[j * C + c] * coefs[j];
+
+    for (int c = 0; c < C; c ++)
+        out[c] = acc[c];
+}
+
+static void dot_any (const audio_sample * x, const audio_sample * coefs, int taps,
+ int channels, audio_sample * out)
+{
+    for (int c = 0; c < channels; c ++)
+        out[c] = 0;
+
+    for (int j = 0; j < taps; j ++)
+        for (int c = 0; c < channels; c ++)
+            out[c] += x[j * channels + c] * coefs[j];
+}
+
+void SincResampler::process (const audio_sample * in, int frames, double ratio,
+ bool finish, Index<audio_sample> & out)
+{
+    const int ch = m_channels;
+
+    double cutoff = specs[m_quality].passband * aud::min (ratio, 1.0);
+    if (cutoff != m_cutoff)
+        build (cutoff);
+
+    m_hist.insert (in, -1, frames * ch);
+
+    /* past the end of the real input, the filter sees silence */
+    int end = m_hist.len () / ch;
+    if (finish)
+        m_hist.insert (-1, m_half * ch);
+
+    int avail = m_hist.len () / ch;
+    int taps = 2 * m_half;
+    double step = 1 / ratio;
+
+    int at = out.len ();
+    int room = aud::max ((int) ((avail - m_pos) * ratio) + 2, 0);
+    out.resize (at + room * ch);
+
+    audio_sample * o = & out[at];
+    audio_sample * coefs = m_coefs.begin ();
+    int made = 0;
+
+    while (made < room)
+    {
+        /* m_pos adds up rounding errors; one that lands a hair before the
+         * end is the end (else feeding in blocks could give an extra frame) */
+        int n = (int) m_pos;
+        if (n + m_half >= avail || (finish && m_pos > end - 1e-6))
+            break;
+
+        /* interpolate between the two nearest rows of the table */
+        double fp = (m_pos - n) * m_phases;
+        int p = (int) fp;
+        audio_sample a = fp - p;
+
+        const audio_sample * row0 = & m_table[p * taps];
+        const audio_sample * row1 = row0 + taps;
+
+        for (int j = 0; j < taps; j ++)
+            coefs[j] = row0[j] + (row1[j] - row0[j]) * a;
+
+        const audio_sample * x = & m_hist[(n - m_half + 1) * ch];
+
+        switch (ch)
+        {
+            case 1: dot_c<1> (x, coefs, taps, o); break;
+            case 2: dot_c<2> (x, coefs, taps, o); break;
+            default: dot_any (x, coefs, taps, ch, o); break;
+        }
+
+        o += ch;
+        made ++;
+        m_pos += step;
+    }
+
+    out.resize (at + made * ch);
+
+    if (finish)
+    {
+        reset ();
+        return;
+    }
+
+    /* drop what the filter can no longer reach */
+    int drop = aud::min ((int) m_pos - m_half, avail);
+    if (drop > 0)
+    {
+        m_hist.remove (0, drop * ch);
+        m_pos -= drop;
+    }
+}
@@ -0,0 +1,312 @@
+/*
+ * Fauxdacious DSP kernels shared by the effect plugins
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+/*
+ * "make check": runs every kernel with each vector table this CPU can use
+ * and compares the result with the plain C version, over lengths that do not
+ * fill whole vectors and data that does not start on a vector boundary.  The
+ * buffers are compared past the end, too, to catch overruns.  Built once
+ * with the sample type the headers pick and once with DEF_AUDIO_FLOAT64.
+ *
+ * SincResampler is checked too: input fed in odd-sized blocks must give the
+ * same output as all at once, and finishing must drain the whole tail (and
+ * leave it ready to start over).
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "dsp-private.h"
+#include "sinc-resampler.h"
+
+#define MAX_FRAMES 72
+#define MAX_CHANNELS 3
+#define SLACK 8       /* past the end, must come back untouched */
+#define BUF (4 + MAX_FRAMES * MAX_CHANNELS + SLACK)
+#define TRIALS (67 * 4 * 3)
+
+struct Variant {
+    const char * name;
+    DSPKernels k;
+};
+
+struct Result {
+    double v[48 * BUF];
+    int n;
+
+    void add (double x)
+        { v[n ++] = x; }
+    template<class T>
+    void add (const T * p, int len)
+        { for (int i = 0; i < len; i ++) v[n ++] = p[i]; }
+};
+
+static unsigned seed;
+
+static float random_float ()
+{
+    seed = seed * 1103515245 + 12345;
+    return (int) ((seed >> 8) % 20001 - 10000) / 10000.0f;
+}
+
+template<class T>
+static void fill (T * p, int len)
+{
+    for (int i = 0; i < len; i ++)
+        p[i] = random_float ();
+}
+
+/* one run of every kernel; <trial> picks the length, offset and data */
+static void run_all (int trial, Result & r)
+{
+    int len = trial % 67;
+    int off = (trial / 67) % 4;
+    seed = trial;
+    r.n = 0;
+
+    audio_sample a[BUF], b[BUF];
+    float f[BUF], g[BUF], m[MAX_CHANNELS * MAX_CHANNELS];
+
+    /* one value in, one value out */
+    fill (a, BUF);
+    dsp_ramp (a + off, len, random_float (), random_float () / 64);
+    r.add (a, BUF);
+
+    for (int ramp_add = 0; ramp_add < 2; ramp_add ++)
+    {
+        fill (a, BUF);
+        fill (b, BUF);
+        dsp_ramp_mix (a + off, b + off, len, random_float (), random_float () / 64, ramp_add);
+        r.add (a, BUF);
+    }
+
+    fill (a, BUF);
+    r.add (dsp_abs_sum (a + off, len));
+    r.add (dsp_abs_max (a + off, len));
+
+    fill (a, BUF);
+    fill (b, BUF);
+    fill (f, BUF);
+    dsp_window_add (a + off, b + off, f + off, len);
+    r.add (a, BUF);
+
+    float cross, energy;
+    fill (f, BUF);
+    fill (g, BUF);
+    dsp_correlate (f + off, g + off, len, cross, energy);
+    r.add (cross);
+    r.add (energy);
+
+    fill (a, BUF);
+    fill (f, BUF);
+    dsp_to_float (a + off, f + off, len);
+    r.add (f, BUF);
+
+    fill (f, BUF);
+    fill (a, BUF);
+    dsp_from_float (f + off, a + off, len);
+    r.add (a, BUF);
+
+    /* per frame */
+    for (int ch = 1; ch <= MAX_CHANNELS; ch ++)
+    {
+        fill (a, BUF);
+        fill (f, BUF);
+        dsp_frame_peaks (a + off, len, ch, f + off);
+        r.add (f, BUF);
+
+        fill (a, BUF);
+        fill (g, BUF);
+        dsp_apply_gains (a + off, g + off, len, ch);
+        r.add (a, BUF);
+
+        audio_sample prev[MAX_CHANNELS];
+        fill (a, BUF);
+        fill (prev, ch);
+        dsp_emphasize (a + off, len, ch, random_float () + 1, prev);
+        r.add (a, BUF);
+        r.add (prev, ch);
+
+        for (int c = 0; c < ch; c ++)
+        {
+            fill (a, BUF);
+            fill (f, BUF);
+            dsp_get_channel (a + off, ch, c, f + off, len);
+            r.add (f, BUF);
+
+            fill (f, BUF);
+            fill (a, BUF);
+            dsp_set_channel (f + off, a + off, ch, c, len);
+            r.add (a, BUF);
+        }
+
+        for (int out_ch = 1; out_ch <= MAX_CHANNELS; out_ch ++)
+        {
+            fill (a, BUF);
+            fill (b, BUF);
+            fill (m, ch * out_ch);
+            dsp_remix (a + off, ch, b + off, out_ch, m, len);
+            r.add (b, BUF);
+        }
+    }
+
+    /* stereo only */
+    fill (a, BUF);
+    fill (m, 4);
+    dsp_mat2x2 (a + off, len, m);
+    r.add (a, BUF);
+}
+
+static Result ref, got;
+
+static bool check (const Variant & v)
+{
+    for (int trial = 0; trial < TRIALS; trial ++)
+    {
+        dsp_kernels () = DSPKernels ();
+        run_all (trial, ref);
+
+        dsp_kernels () = v.k;
+        run_all (trial, got);
+
+        /* sums may be added up in another order */
+        for (int i = 0; i < ref.n; i ++)
+        {
+            if (fabs (got.v[i] - ref.v[i]) > 1e-5 * (1 + fabs (ref.v[i])))
+            {
+                printf ("FAIL: %s, trial %d (length %d, offset %d), value %d: "
+                 "%.9g, should be %.9g\n", v.name, trial, trial % 67,
+                 (trial / 67) % 4, i, got.v[i], ref.v[i]);
+                return false;
+            }
+        }
+    }
+
+    printf ("ok: %s\n", v.name);
+    return true;
+}
+
+/* all of <in> at once, or in blocks of 1, 2, ... 97 frames */
+static void resample (SincResampler & rs, const Index<audio_sample> & in, int channels,
+ double ratio, bool chunked, Index<audio_sample> & out)
+{
+    int frames = in.len () / channels;
+    out.resize (0);
+
+    for (int i = 0, block = 1; i < frames; block = block % 97 + 1)
+    {
+        int n = chunked ? aud::min (block, frames - i) : frames;
+        rs.process (& in[i * channels], n, ratio, i + n == frames, out);
+        i += n;
+    }
+}
+
+static bool check_resampler ()
+{
+    static const double ratios[] = {48000.0 / 44100, 44100.0 / 48000, 0.5, 2, 1};
+
+    for (int q = SincResampler::Fast; q <= SincResampler::Best; q ++)
+    for (int channels = 1; channels <= MAX_CHANNELS; channels ++)
+    for (double ratio : ratios)
+    {
+        const int frames = 4000;
+
+        Index<audio_sample> in;
+        in.resize (frames * channels);
+        seed = q * 100 + channels;
+        fill (in.begin (), in.len ());
+
+        SincResampler rs;
+        rs.setup (channels, (SincResampler::Quality) q);
+        rs.reset ();
+
+        Index<audio_sample> whole, chunked, again;
+        resample (rs, in, channels, ratio, false, whole);
+        resample (rs, in, channels, ratio, true, chunked);
+        resample (rs, in, channels, ratio, false, again);
+
+        /* one output frame per 1 / ratio input frames, to the end */
+        int want = (int) ceil (frames * ratio - 1e-9);
+        bool ok = (whole.len () == want * channels);
+
+        /* the position adds up differently in blocks, so the phases (and
+         * the output) may differ in the last bits */
+        ok = ok && chunked.len () == whole.len () && again.len () == whole.len ();
+
+        for (int i = 0; ok && i < whole.len (); i ++)
+            ok = (fabs (chunked[i] - whole[i]) <= 1e-5 * (1 + fabs (whole[i])) &&
+             again[i] == whole[i]);
+
+        /* the tail is the filtered input, not silence */
+        double tail = 0;
+        for (int i = aud::max (whole.len () - 8 * channels, 0); i < whole.len (); i ++)
+            tail += fabs (whole[i]);
+
+        if (! ok || ! (tail > 0))
+        {
+            printf ("FAIL: SincResampler quality %d, %d channels, ratio %g: %d frames "
+             "in one go, %d in blocks, %d after restarting, should be %d%s\n", q,
+             channels, ratio, whole.len () / channels, chunked.len () / channels,
+             again.len () / channels, want, (tail > 0) ? "" : ", silent tail");
+            return false;
+        }
+    }
+
+    printf ("ok: SincResampler\n");
+    return true;
+}
+
+int main ()
+{
+    Variant variants[3];
+    int count = 0;
+
+#ifdef DSP_HAVE_SSE2
+    variants[count] = {"SSE2", DSPKernels ()};
+    dsp_init_sse2 (variants[count ++].k);
+#endif
+#ifdef DSP_HAVE_AVX2
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx2"))
+    {
+        variants[count] = {"AVX2", DSPKernels ()};
+#ifdef DSP_HAVE_SSE2
+        dsp_init_sse2 (variants[count].k);
+#endif
+        dsp_init_avx2 (variants[count ++].k);
+    }
+#endif
+#ifdef DSP_HAVE_NEON
+    variants[count] = {"NEON", DSPKernels ()};
+    dsp_init_neon (variants[count ++].k);
+#endif
+
+    printf ("audio_sample is %s\n", sizeof (audio_sample) == 8 ? "double" : "float");
+
+    if (! count)
+        printf ("no vector kernels on this CPU, nothing to compare\n");
+
+    bool ok = true;
+    for (int i = 0; i < count; i ++)
+        ok = check (variants[i]) && ok;
+
+    ok = check_resampler () && ok;
+
+    return ok ? 0 : 1;
+}
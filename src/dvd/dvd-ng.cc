@@ -50,6 +50,7 @@ extern "C" {
 // #define RAW_PACKET_BUFFER_SIZE 32768
 
 #include "../ffaudio/ffaudio-stdinc.h"
+#include "../ffaudio/ffaudio-interleave.h"
 
 /* prevent libcdio from redefining PACKAGE, VERSION, etc. */
 #define EXTERNAL_LIBDVDNAV_CONFIG_H
@@ -234,6 +235,7 @@ static bool menubuttons_adjusted;  /* TRUE SIGNALS WINDOW HAS CHANGED SZ/RATIO &
 static bool checkcodecs;        /* SIGNAL THAT WE NEED TO RELOAD THE CODECS (TRACK CHANGE, ETC.) */
 static bool readblock;          /* PREVENT READER/DEMUXER THREAD FROM CONTINUING UNTIL DATA READY TO READ */
 static bool initted = false;    /* JWT:TRUE AFTER libav/ffaudio stuff initialized. */
+static Index<char> audio_buf;   /* INTERLEAVED AUDIO, KEPT FOR THE WHOLE PLAYBACK (NOT REALLOCATED PER PACKET). */
 static int as_decor_fudge_x = 0; // MUST CAPTURE WxH OF WINDOW-DECORATIONS FOR AfterStep WM FOR PROPER WINDOW PLACEMENT!
 static int as_decor_fudge_y = 0;
 #if SDL_COMPILEDVERSION > 4600
@@ -891,7 +893,7 @@ void save_window_xy (SDL_Window * sdl_window, int video_window_x, int video_wind
 void DVD::write_audioframe (CodecInfo * cinfo, AVPacket * pkt, int out_fmt, bool planar)
 {
     int size = 0;
-    Index<char> buf;
+    ScopedFrame frame;  // (ONE PER PACKET, NOT PER FRAME)
 #ifdef SEND_PACKET
     if (LOG (avcodec_send_packet, cinfo->context, pkt) < 0)
         return;
@@ -908,7 +910,6 @@ void DVD::write_audioframe (CodecInfo * cinfo, AVPacket * pkt, int out_fmt, bool
 
     while (pkt->size > 0)
     {
-        ScopedFrame frame;
 #ifdef SEND_PACKET
         if (LOG (avcodec_receive_frame, cinfo->context, frame.ptr) < 0)
             break;  /* read next packet (continue past errors) */
@@ -935,15 +936,19 @@ void DVD::write_audioframe (CodecInfo * cinfo, AVPacket * pkt, int out_fmt, bool
         size = FMT_SIZEOF (out_fmt) * channels * frame->nb_samples;
         if (planar)
         {
-            if (size > buf.len ())
-                buf.resize (size);
+            if (size > audio_buf.len ())
+                audio_buf.resize (size);
 
-            audio_interlace ((const void * *) frame->data, out_fmt,
-                    channels, buf.begin (), frame->nb_samples);
-            write_audio (buf.begin (), size);
+            interleave_planar ((const void * const *) frame->extended_data, out_fmt,
+                    channels, audio_buf.begin (), frame->nb_samples);
+            write_audio (audio_buf.begin (), size);
         }
         else
             write_audio (frame->data[0], size);
+
+#if CHECK_LIBAVCODEC_VERSION (55, 45, 101, 55, 28, 1)
+        av_frame_unref (frame.ptr);
+#endif
     }
     return;
 }
@@ -2473,6 +2478,7 @@ AUDDBG("---INPUT PIPE OPENED!\n");
 error_exit:  /* WE END UP HERE WHEN PLAYBACK IS STOPPED: */
 
     AUDINFO ("end of playback.\n");
+    audio_buf.clear ();
     if (apktQ)
         destroyQueue (apktQ);
     apktQ = nullptr;     // QUEUE FOR AUDIO-PACKET QUEUEING.
@@ -31,8 +31,17 @@ extern "C" {
 #undef FFAUDIO_NO_BLACKLIST /* Don't blacklist any recognized codecs/formats */
 
 #include "ffaudio-stdinc.h"
+#include "ffaudio-queue.h"
+#include "ffaudio-video.h"
+#include "ffaudio-dsd.h"
+#include "ffaudio-interleave.h"
 
 #include <pthread.h>
+#ifdef HAVE_SWRESAMPLE
+extern "C" {
+#include <libswresample/swresample.h>
+}
+#endif
 
 #define  USE_SDL2 1
 #include <libfauxdcore/sdl_window.h>
@@ -61,16 +70,6 @@ extern "C" {
 #define SEND_PACKET 1
 #endif
 
-typedef struct
-{
-    int capacity;
-    int size;
-    int front;
-    int rear;
-    AVPacket * * elements;
-}
-pktQueue;
-
 typedef struct
 {
     int stream_idx;
@@ -80,11 +79,13 @@ typedef struct
 }
 CodecInfo;
 
+struct AudioOut;
+
 typedef struct
 {
     CodecInfo cinfo, vcinfo;   //AUDIO AND VIDEO CODECS
-    pktQueue *pktQ = nullptr;  // QUEUE FOR VIDEO-PACKET QUEUEING.
-    pktQueue *apktQ = nullptr; // QUEUE FOR AUDIO-PACKET QUEUEING.
+    PacketQueue *pktQ = nullptr;  // QUEUE FOR VIDEO-PACKET QUEUEING.
+    PacketQueue *apktQ = nullptr; // QUEUE FOR AUDIO-PACKET QUEUEING.
     AVFormatContext * ic = nullptr;  // AVstuff.
     int errcount = 0;
     bool videoalso;
@@ -98,7 +99,6 @@ static int as_decor_fudge_y = 0;
 static bool as_decor_fudge_set = false;
 #endif
 static pthread_mutex_t read_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 class FFaudio : public InputPlugin
 {
@@ -127,10 +127,9 @@ public:
     bool is_our_file (const char * filename, VFSFile & file);
     bool read_tag (const char * filename, VFSFile & file, Tuple & tuple, Index<char> * image);
     bool write_tuple (const char * filename, VFSFile & file, const Tuple & tuple);
-    void write_audioframe (CodecInfo * cinfo, AVPacket * pkt, int out_fmt, bool planar);
-    void write_videoframe (SDL_Renderer * renderer, CodecInfo * vcinfo,
-            SDL_Texture * bmp, AVPacket *pkt, int video_width,
-            int video_height, bool last_resized, bool * windowIsStable);
+    void write_audioframe (CodecInfo * cinfo, AVPacket * pkt, AudioOut & aout);
+    void write_videoframe (SDL_Renderer * renderer, SDL_Texture * bmp, AVFrame * vframe,
+            bool last_resized, bool * windowIsStable);
     bool play (const char * filename, VFSFile & file);
 };
 
@@ -145,6 +144,18 @@ const char * const FFaudio::defaults[] = {
     "video_ysize", "-1",    // ADJUST WINDOW WIDTH TO MATCH PREV. SAVED HEIGHT.
     "save_video", "FALSE",  // DUB VIDEO AS BEING PLAYED.
     "reader_sleep_ms", "90", // TIME FOR READER THREAD TO SLEEP IN MILLISEC TO ALLOW QUEUES TO DRAIN.
+    "queue_max_kb", "32768", // MAX. KILOBYTES OF PACKETS TO QUEUE PER STREAM (0 = NO LIMIT).
+    "queue_max_ms", "5000",  // MAX. PLAY-TIME OF PACKETS TO QUEUE PER STREAM (0 = NO LIMIT).
+    "audio_threads", "0",    // AUDIO DECODER THREADS (0 = AUTO, IE. ONE PER CPU CORE, 1 = NO THREADING).
+    "audio_frame_threads", "TRUE",  // LET AUDIO DECODER THREAD ACROSS FRAMES (IF CODEC SUPPORTS IT).
+    "audio_slice_threads", "TRUE",  // LET AUDIO DECODER THREAD WITHIN FRAMES (IF CODEC SUPPORTS IT).
+    "video_threads", "0",    // VIDEO DECODER THREADS (0 = AUTO, IE. ONE PER CPU CORE, 1 = NO THREADING).
+    "video_frame_threads", "TRUE",  // LET VIDEO DECODER THREAD ACROSS FRAMES (IF CODEC SUPPORTS IT).
+    "video_slice_threads", "TRUE",  // LET VIDEO DECODER THREAD WITHIN FRAMES (IF CODEC SUPPORTS IT).
+    "io_buffer_kb", "256",   // READ BUFFER FOR LOCAL FILES (STREAMS ALWAYS USE A SMALL ONE).
+    "io_mmap", "FALSE",      // MEMORY-MAP LOCAL FILES INSTEAD OF READING THEM (NOT ON WINDOWS).
+    "probe_cache_size", "1024", // NO. OF CONTENT-PROBED FORMATS TO REMEMBER ACROSS SESSIONS (0 = DON'T CACHE).
+    "fast_read_tag", "TRUE", // GET SONG LENGTH, ETC. FROM CONTAINER HEADERS ALONE WHEN ADDING FILES, IF THEY HAVE IT.
     "noresize_optimizations", "FALSE", // SOME WMs (LIKE jwm) REQUIRE THIS TO BE TRUE FOR VIDEO WINDOW TO BE RESIZABLE.
 #ifdef _WIN32
     "save_video_file", "C:\\Temp\\lastvideo",
@@ -152,9 +163,17 @@ const char * const FFaudio::defaults[] = {
     "save_video_file", "/tmp/lastvideo",
 #endif
     "enable_dsd", "FALSE",
+    "audio_float", "FALSE", // HAVE libswresample CONVERT ALL AUDIO TO FLOAT (IF BUILT WITH IT).
+    "dsd_to_pcm", "FALSE",  // CONVERT DSD TO PCM OURSELVES (FASTER THAN libavcodec's DSD DECODER), UNLESS PASSING IT THROUGH.
+    "dsd_pcm_rate", "88200", // PCM RATE TO CONVERT DSD TO (88200 OR 176400, 96000 OR 192000 FOR 48K-BASED DSD).
     nullptr
 };
 
+static const ComboItem dsd_pcm_rates[] = {
+    ComboItem (N_("88.2 kHz"), 88200),
+    ComboItem (N_("176.4 kHz"), 176400)
+};
+
 const PreferencesWidget FFaudio::widgets[] = {
     WidgetCheck (N_("Play video stream in popup window when video stream found"),
         WidgetBool ("ffaudio", "play_video")),
@@ -173,16 +192,53 @@ const PreferencesWidget FFaudio::widgets[] = {
         WidgetInt ("ffaudio", "video_qsize"), {2, 16, 1}),
     WidgetSpin (N_("Reader sleep interval (millisec)"),
         WidgetInt ("ffaudio", "reader_sleep_ms"), {1, 500, 1}),
+    WidgetSpin (N_("Max. packet queue size"),
+        WidgetInt ("ffaudio", "queue_max_kb"), {0, 1048576, 1024, N_("KiB")}),
+    WidgetSpin (N_("Max. packet queue length"),
+        WidgetInt ("ffaudio", "queue_max_ms"), {0, 60000, 500, N_("ms")}),
+    WidgetSpin (N_("Audio decoder threads (0 = auto)"),
+        WidgetInt ("ffaudio", "audio_threads"), {0, 64, 1}),
+    WidgetCheck (N_("Frame threading"),
+        WidgetBool ("ffaudio", "audio_frame_threads"), WIDGET_CHILD),
+    WidgetCheck (N_("Slice threading"),
+        WidgetBool ("ffaudio", "audio_slice_threads"), WIDGET_CHILD),
+    WidgetSpin (N_("Video decoder threads (0 = auto)"),
+        WidgetInt ("ffaudio", "video_threads"), {0, 64, 1}),
+    WidgetCheck (N_("Frame threading"),
+        WidgetBool ("ffaudio", "video_frame_threads"), WIDGET_CHILD),
+    WidgetCheck (N_("Slice threading"),
+        WidgetBool ("ffaudio", "video_slice_threads"), WIDGET_CHILD),
+    WidgetSpin (N_("Local file read buffer"),
+        WidgetInt ("ffaudio", "io_buffer_kb"), {4, 16384, 4, N_("KiB")}),
+#ifndef _WIN32
+    WidgetCheck (N_("Memory-map local files"),
+        WidgetBool ("ffaudio", "io_mmap")),
+#endif
+    WidgetSpin (N_("Remember probed formats of"),
+        WidgetInt ("ffaudio", "probe_cache_size"), {0, 65536, 64, N_("files")}),
+    WidgetCheck (N_("Quick scan of container headers when adding files"),
+        WidgetBool ("ffaudio", "fast_read_tag")),
     WidgetCheck (N_("Unoptimized vid. window resize (some WMs, ie. JWM may need)."),  // WE HAVE ffmpeg COMPILED W/--enable-gray IN WINDOWS!
         WidgetBool ("ffaudio", "noresize_optimizations")),
+#ifdef HAVE_SWRESAMPLE
+    WidgetCheck (N_("Convert all audio to floating point (libswresample)"),
+        WidgetBool ("ffaudio", "audio_float")),
+#endif
     WidgetCheck (N_("Enable DSD stream output"),
         WidgetBool("ffaudio", "enable_dsd")),
+    WidgetCheck (N_("Otherwise, convert DSD to PCM with built-in filters"),
+        WidgetBool ("ffaudio", "dsd_to_pcm")),
+    WidgetCombo (N_("PCM rate:"),
+        WidgetInt ("ffaudio", "dsd_pcm_rate"),
+        {{dsd_pcm_rates}}, WIDGET_CHILD),
 };
 
 const PluginPreferences FFaudio::prefs = {{widgets}};
 
 static bool play_video;      /* JWT: TRUE IF USER IS CURRENTLY PLAYING VIDEO (KILLING VID. WINDOW TURNS OFF)! */
 static bool initted = false; /* JWT:TRUE AFTER libav/ffaudio stuff initialized. */
+static DSDDecimator * dsd_pcm = nullptr;  /* SET WHILE PLAYING DSD CONVERTED TO PCM BY US (NOT libavcodec). */
+static Index<float> dsd_pcm_buf;          /* ITS OUTPUT, KEPT AROUND TO SAVE REALLOCATING EVERY PACKET. */
 
 struct ScopedFrame
 {
@@ -203,107 +259,31 @@ struct ScopedFrame
 #endif
 };
 
-/*
-    JWT: ADDED ALL THIS QUEUE STUFF TO SMOOTH VIDEO PERFORMANCE SO THAT VIDEO FRAMES WOULD
-    BE OUTPUT MORE INTERLACED WITH THE AUDIO FRAMES BY QUEUEING VIDEO FRAMES UNTIL AN
-    AUDIO FRAME IS PROCESSED, THEN DEQUEUEING AND PROCESSING 'EM WITH EACH AUDIO FRAME.
-    THE SIZE OF THIS QUEUE IS SET BY video_qsize CONFIG PARAMETER AND DEFAULTS TO 6.
-    HAVING TOO MANY CAN RESULT IN DELAYED VIDEO, SO EXPERIMENT.  IDEALLY, PACKETS SHOULD
-    BE PROCESSED:  V A V A V A..., BUT THIS HANDLES:
-    V1 V2 V3 V4 V5 A1 A2 A3 A4 A5 A6 A7 V7 A8... AS:
-    (q:V1 V2 V3 V4 V5 V6) A1 A2 dq:V1 A3 A4 dq:V2 A5 A6 dq:V3 A7 A8...
-    WE DON'T WANT TO INTERRUPT AUDIO PERFORMANCE AND I DON'T KNOW HOW TO THREAD IT UP,
-    BUT THIS SIMPLE APPROACH SEEMS TO WORK PRETTY SMOOTH FOR ME!  OTHERWISE TRY
-    INCREASING video_qsize IN config file OTHERWISE.
-    BORROWED THESE FUNCTIONS FROM:
-    http://www.thelearningpoint.net/computer-science/data-structures-queues--with-c-program-source-code
-*/
-
-pktQueue * createQueue (int maxElements)
+/* WHAT write_audioframe () NEEDS TO TURN DECODED FRAMES INTO OUTPUT, KEPT FOR THE WHOLE PLAYBACK
+   SO THAT NOTHING GETS ALLOCATED PER PACKET OR FRAME: */
+struct AudioOut
 {
-    /* Create a Queue */
-    pktQueue * Q = (pktQueue *) malloc (sizeof (pktQueue));
-    /* Initialise its properties */
-    Q->elements = (AVPacket * *) malloc (sizeof (AVPacket *) * maxElements);
-    Q->size = 0;
-    Q->capacity = maxElements;
-    Q->front = 0;
-    Q->rear = -1;
-    /* Return the pointer */
-    return Q;
-}
-
-bool Dequeue (pktQueue * Q)
-{
-    /* If Queue size is zero then it is empty. So we cannot pop */
-    if (! Q->size)
-        return false;
-    /* Removing an element is equivalent to incrementing index of front by one */
-    else
-    {
-        pthread_mutex_lock (& queue_mutex);  // (READER THREAD IS ENQUEUING MORE AT SAME TIME)!
-
-        Q->size--;
-        av_packet_free (& Q->elements[Q->front]);
-
-        Q->front++;
-        /* As we fill elements in circular fashion */
-        if (Q->front == Q->capacity)
-            Q->front = 0;
-
-        pthread_mutex_unlock (& queue_mutex);
-    }
-    return true;
-}
-
-/* JWT:FLUSH AND FREE EVERYTHING IN THE QUEUE */
-void QFlush (pktQueue * Q)
-{
-    pthread_mutex_lock (& queue_mutex);  // DON'T ALLOW THREADS TO ENQUEUE OR DEQUEUE WHILST FLUSHING!
-
-    while (Q->size > 0)
-    {
-        Q->size--;
-        av_packet_free (& Q->elements[Q->front]);
-
-        Q->front++;
-        /* As we fill elements in circular fashion */
-        if (Q->front == Q->capacity)
-            Q->front = 0;
-    }
-
-    pthread_mutex_unlock (& queue_mutex);
-}
-
-bool Enqueue (pktQueue * Q, AVPacket * element)
-{
-    /* If the Queue is full, we cannot push an element into it as there is no space for it.*/
-    if (Q->size == Q->capacity)
-        return false;
-    else
-    {
-        pthread_mutex_lock (& queue_mutex);  // (MAIN THREAD IS DEQUEUING THEM AT SAME TIME)!
-
-        Q->rear += 1;
-        /* As we fill the queue in circular fashion */
-        if (Q->rear == Q->capacity)
-            Q->rear = 0;
-        /* Insert the element in its rear side */
-        Q->elements[Q->rear] = element;
-        Q->size++;
-
-        pthread_mutex_unlock (& queue_mutex);
-    }
-    return true;
-}
+    int fmt = FMT_S16_NE;   // FORMAT SENT TO THE OUTPUT.
+    bool planar = false;    // DECODER PUTS OUT ONE PLANE PER CHANNEL (USED BY Audacious).
+    ScopedFrame frame;      // DECODED FRAME (UNREFERENCED, NOT FREED, AFTER EACH USE).
+    Index<char> buf;        // INTERLEAVED (OR CONVERTED) SAMPLES.
+#ifdef HAVE_SWRESAMPLE
+    SwrContext * swr = nullptr;  // SET IF libswresample CONVERTS THE SAMPLES TO FLOAT FOR US.
+
+    ~AudioOut () { swr_free (& swr); }
+#endif
+};
 
-void destroyQueue (pktQueue * Q)
-{
-    QFlush (Q);
-    free (Q->elements);
-    free (Q);
-    Q = nullptr;
-}
+/*
+    ADDED ALL THIS QUEUE STUFF TO SMOOTH VIDEO PERFORMANCE.  THE READER THREAD DEMUXES
+    AUDIO AND VIDEO PACKETS INTO SEPARATE QUEUES.  THE PLAYBACK THREAD DECODES AND WRITES THE
+    AUDIO, WHILST A VIDEO DECODER THREAD (ffaudio-video.h) DECODES THE VIDEO INTO A FEW
+    TIMESTAMPED FRAMES, WHICH THE PLAYBACK THREAD BLITS AS THE AUDIO CLOCK REACHES EACH ONE
+    (DROPPING ANY IT'S TOO LATE FOR), SO VIDEO NEVER HOLDS UP THE AUDIO.
+    THE SIZE OF EACH QUEUE IS SET BY video_qsize CONFIG PARAMETER AND DEFAULTS TO 6
+    (AND IS FURTHER CAPPED IN BYTES AND PLAY-TIME BY queue_max_kb AND queue_max_ms).
+    THE QUEUES THEMSELVES (LOCK-FREE, W/RECYCLED PACKETS) ARE IN ffaudio-queue.h.
+*/
 
 // DSD Processing
 // Check DSD stream
@@ -447,6 +427,7 @@ void FFaudio::cleanup ()
 
     aud_set_bool ("ffaudio", "save_video", false);  // JWT:MAKE SURE WE DON'T LEAVE VIDEO RECORDING ON!
     extension_dict.clear ();
+    probe_cache_save ();
 #if ! CHECK_LIBAVCODEC_VERSION (58, 9, 100, 255, 255, 255)
     av_lockmgr_register (nullptr);
 #endif
@@ -509,16 +490,39 @@ static AVInputFormat * get_format_by_extension (const char * name)
 
 static AVInputFormat * get_format_by_content (const char * name, VFSFile & file)
 {
-    AUDINFO ("Probing content: %s\n", name);
+    /* LOCAL FILES CAN BE LOOKED UP BEFORE READING ANYTHING: */
+    String key = probe_cache_file_key (name);
+    AVInputFormat * f = probe_cache_lookup (key);
 
-    AVInputFormat * f = nullptr;
+    if (f)
+    {
+        AUDINFO ("Cached format %s for %s.\n", f->name, name);
+        return f;
+    }
+
+    AUDINFO ("Probing content: %s\n", name);
 
     unsigned char buf[16384 + AVPROBE_PADDING_SIZE];
-    int size = 16;
-    int filled = 0;
+    int size = 1024;
+    int filled = file.fread (buf, 1, size);
     int target = 100;
     int score = 0;
 
+    /* OTHERWISE GO BY WHAT'S IN THE FIRST BLOCK (WHICH WE NEED TO PROBE ANYWAY): */
+    if (! key)
+    {
+        key = probe_cache_data_key (name, buf, aud::max (filled, 0));
+        if ((f = probe_cache_lookup (key)))
+        {
+            AUDINFO ("Cached format %s for %s.\n", f->name, name);
+            file.fseek (0, VFS_SEEK_SET);
+            return f;
+        }
+    }
+
+    if (filled < 0)
+        filled = 0;
+
     while (1)
     {
         if (filled < size)
@@ -541,7 +545,10 @@ static AVInputFormat * get_format_by_content (const char * name, VFSFile & file)
     }
 
     if (f)
+    {
         AUDINFO ("Probe matched format %s, buffer size %d, score %d.\n", f->name, filled, score);
+        probe_cache_add (key, f);
+    }
     else
         AUDINFO ("Probe did not match any known formats.\n");
 
@@ -557,7 +564,9 @@ static AVInputFormat * get_format (const char * name, VFSFile & file)
     return f ? f : get_format_by_content (name, file);
 }
 
-static AVFormatContext * open_input_file (const char * name, VFSFile & file)
+/* header_only ONLY LETS libavformat LOOK AT THE FIRST FEW BYTES WHILE OPENING (FOR read_tag ()'S QUICK SCAN): */
+static AVFormatContext * open_input_file (const char * name, VFSFile & file, bool header_only = false,
+ bool playing = false)
 {
     AVFormatContext * c = nullptr;
 
@@ -589,10 +598,21 @@ static AVFormatContext * open_input_file (const char * name, VFSFile & file)
             return nullptr;
         }
         c = avformat_alloc_context ();
-        AVIOContext * io = io_context_new (file);
+        AVIOContext * io = io_context_new (file, playing);
         if (c)
             c->pb = io;
-        if (LOG (avformat_open_input, & c, xname, f, nullptr) < 0)
+
+        AVDictionary * options = nullptr;
+        if (header_only)
+        {
+            av_dict_set (& options, "probesize", "262144", 0);
+            av_dict_set (& options, "analyzeduration", "500000", 0);  // MICROSECONDS.
+        }
+
+        int ret = LOG (avformat_open_input, & c, xname, f, & options);
+        av_dict_free (& options);
+
+        if (ret < 0)
         {
             if (c)
                 avformat_free_context (c);
@@ -712,6 +732,114 @@ static bool find_codec (AVFormatContext * c, CodecInfo * cinfo, CodecInfo * vcin
     return false;
 }
 
+#ifdef HAVE_SWRESAMPLE
+/* SET UP libswresample TO TURN THE DECODER'S SAMPLES INTO INTERLEAVED FLOAT (SAME RATE & CHANNELS): */
+static SwrContext * new_float_converter (AVCodecContext * context)
+{
+    SwrContext * swr = nullptr;
+#if CHECK_LIBAVCODEC_VERSION(59, 37, 100, 59, 37, 100)
+    if (LOG (swr_alloc_set_opts2, & swr, & context->ch_layout, AV_SAMPLE_FMT_FLT, context->sample_rate,
+            & context->ch_layout, context->sample_fmt, context->sample_rate, 0, nullptr) < 0)
+        return nullptr;
+#else
+    int64_t layout = context->channel_layout ? (int64_t) context->channel_layout
+            : av_get_default_channel_layout (context->channels);
+    swr = swr_alloc_set_opts (nullptr, layout, AV_SAMPLE_FMT_FLT, context->sample_rate,
+            layout, context->sample_fmt, context->sample_rate, 0, nullptr);
+#endif
+    if (swr && LOG (swr_init, swr) < 0)
+        swr_free (& swr);
+
+    return swr;
+}
+#endif
+
+/* SET UP MULTI-THREADED DECODING PER USER'S CONFIG (BEFORE OPENING THE CODEC), kind IS "audio" OR "video": */
+static void set_codec_threads (AVCodecContext * context, const char * kind)
+{
+    int threads = aud_get_int ("ffaudio", str_concat ({kind, "_threads"}));
+    int type = 0;
+
+    if (aud_get_bool ("ffaudio", str_concat ({kind, "_frame_threads"})))
+        type |= FF_THREAD_FRAME;
+    if (aud_get_bool ("ffaudio", str_concat ({kind, "_slice_threads"})))
+        type |= FF_THREAD_SLICE;
+
+    context->thread_count = (type && threads != 1) ? aud::max (threads, 0) : 1;  // 0 LETS libavcodec PICK (ONE PER CORE).
+    context->thread_type = type;
+}
+
+/* DESCRIBE THE THREADING libavcodec ACTUALLY SETTLED ON (AFTER OPENING THE CODEC), FOR THE CODEC FIELD: */
+static StringBuf describe_codec_threads (const char * kind, AVCodecContext * context)
+{
+    int threads = context->active_thread_type ? context->thread_count : 1;
+    const char * type = (context->active_thread_type & FF_THREAD_FRAME) ? " (frame)"
+            : (context->active_thread_type & FF_THREAD_SLICE) ? " (slice)" : "";
+
+    return str_printf ("%s: %d %s%s", kind, threads, (threads == 1) ? "thread" : "threads", type);
+}
+
+/* PLAY-TIME OF THE FILE PER THE CONTAINER HEADERS ALONE (IN MICROSECONDS), OR 0 IF THEY DON'T SAY: */
+static int64_t header_duration (AVFormatContext * c)
+{
+    if (c->duration > 0)
+        return c->duration;
+
+    int64_t duration = 0;
+    for (unsigned i = 0; i < c->nb_streams; i ++)
+    {
+        AVStream * st = c->streams[i];
+        if (st->duration > 0)
+            duration = aud::max (duration, av_rescale_q (st->duration, st->time_base, AV_TIME_BASE_Q));
+    }
+
+    return duration;
+}
+
+/* FILL IN THE STREAM INFO FOR read_tag () FROM THE CONTAINER HEADERS, WITHOUT avformat_find_stream_info ()
+   OR A CODEC CONTEXT, SO THAT NO PACKETS GET READ OR DECODED.  RETURNS false (AND SETS NOTHING) IF THE HEADERS
+   LACK SOMETHING (MOST OFTEN THE DURATION), IN WHICH CASE THE CALLER MUST DO IT THE SLOW WAY: */
+static bool scan_headers (AVFormatContext * c, VFSFile & file, Tuple & tuple, AVStream * * stream)
+{
+#ifndef ALLOC_CONTEXT
+#define codecpar codec
+#endif
+    int idx = av_find_best_stream (c, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
+    if (idx < 0)
+        return false;
+
+    AVStream * st = c->streams[idx];
+    AVCodec * codec = (AVCodec *) avcodec_find_decoder (st->codecpar->codec_id);
+#if CHECK_LIBAVCODEC_VERSION(59, 37, 100, 59, 37, 100)
+    int channels = st->codecpar->ch_layout.nb_channels;
+#else
+    int channels = st->codecpar->channels;
+#endif
+    int64_t bitrate = c->bit_rate ? c->bit_rate : st->codecpar->bit_rate;
+#undef codecpar
+
+    int64_t duration = header_duration (c);
+    if (! codec || channels <= 0 || duration <= 0)
+        return false;
+
+    if (! bitrate)
+    {
+        int64_t size = file.fsize ();
+        if (size > 0)
+            bitrate = av_rescale (size, 8 * AV_TIME_BASE, duration);
+    }
+
+    tuple.set_int (Tuple::Length, duration / 1000);
+    tuple.set_int (Tuple::Bitrate, bitrate / 1000);
+    tuple.set_int (Tuple::Channels, channels);
+
+    if (codec->long_name)
+        tuple.set_str (Tuple::Codec, codec->long_name);
+
+    * stream = st;
+    return true;
+}
+
 bool FFaudio::is_our_file (const char * filename, VFSFile & file)
 {
     return (bool) get_format (filename, file);
@@ -760,32 +888,52 @@ bool FFaudio::read_tag (const char * filename, VFSFile & file, Tuple & tuple, In
 {
     if (strncmp (filename, "stdin://", 8))  /* WE'RE NOT STDIN! */
     {
-        SmartPtr<AVFormatContext, close_input_file> ic (open_input_file (filename, file));
+        /* TRY THE QUICK HEADER-ONLY SCAN FIRST (UNLESS USER TURNED IT OFF), SINCE ADDING A BIG FOLDER
+           OTHERWISE DECODES PACKETS FROM EVERY FILE IN IT: */
+        bool header_only = aud_get_bool ("ffaudio", "fast_read_tag");
+        SmartPtr<AVFormatContext, close_input_file> ic (open_input_file (filename, file, header_only));
         if (! ic)
             return false;
 
-        CodecInfo cinfo;
+        CodecInfo cinfo = CodecInfo ();
+        AVStream * stream = nullptr;
 
-        if (! find_codec (ic.get (), & cinfo, nullptr))   //CAN CHANGE play_video!
-            return false;
+        if (! header_only || ! scan_headers (ic.get (), file, tuple, & stream))
+        {
+            if (header_only)  /* HEADERS DIDN'T TELL US ENOUGH, SO START OVER THE SLOW WAY: */
+            {
+                AUDDBG ("i:Header-only scan came up short for %s, probing fully.\n", filename);
+                ic.clear ();
+                if (file.fseek (0, VFS_SEEK_SET) < 0)
+                    return false;
+                ic.capture (open_input_file (filename, file));
+                if (! ic)
+                    return false;
+            }
 
-        if ((int)ic->duration != 0)
-            tuple.set_int (Tuple::Length, ic->duration / 1000);
+            if (! find_codec (ic.get (), & cinfo, nullptr))   //CAN CHANGE play_video!
+                return false;
 
-        tuple.set_int (Tuple::Bitrate, ic->bit_rate / 1000);
+            if ((int)ic->duration != 0)
+                tuple.set_int (Tuple::Length, ic->duration / 1000);
+
+            tuple.set_int (Tuple::Bitrate, ic->bit_rate / 1000);
 #if CHECK_LIBAVCODEC_VERSION(59, 37, 100, 59, 37, 100)
-        tuple.set_int (Tuple::Channels, cinfo.context->ch_layout.nb_channels);
+            tuple.set_int (Tuple::Channels, cinfo.context->ch_layout.nb_channels);
 #else
-        tuple.set_int (Tuple::Channels, cinfo.context->channels);
+            tuple.set_int (Tuple::Channels, cinfo.context->channels);
 #endif
 
-        if (cinfo.codec->long_name)
-            tuple.set_str (Tuple::Codec, cinfo.codec->long_name);
+            if (cinfo.codec->long_name)
+                tuple.set_str (Tuple::Codec, cinfo.codec->long_name);
+
+            stream = cinfo.stream;
+        }
 
         if (ic->metadata)
             read_metadata_dict (tuple, ic->metadata);
-        if (cinfo.stream->metadata)
-            read_metadata_dict (tuple, cinfo.stream->metadata);
+        if (stream->metadata)
+            read_metadata_dict (tuple, stream->metadata);
 
         if (! file.fseek (0, VFS_SEEK_SET) && ! audtag::read_tag (file, tuple, image)
                 && tuple.fetch_stream_info (file))
@@ -806,12 +954,15 @@ bool FFaudio::read_tag (const char * filename, VFSFile & file, Tuple & tuple, In
         }
 
 #endif
+        if (cinfo.context)
+        {
 #ifdef ALLOC_CONTEXT
-        avcodec_free_context (& cinfo.context);
-        av_free (cinfo.context);
+            avcodec_free_context (& cinfo.context);
+            av_free (cinfo.context);
 #else
-        avcodec_close (cinfo.context);
+            avcodec_close (cinfo.context);
 #endif
+        }
     }
     else  /* JWT:THIS STUFF DEFERRED UNTIL PLAY() FOR STDIN(nonseekable), BUT SEEMS TO HAVE TO BE HERE FOR DIRECT */
     {
@@ -844,21 +995,28 @@ static bool convert_format (int ff_fmt, int & aud_fmt, bool & planar)
         case AV_SAMPLE_FMT_FLTP: aud_fmt = FMT_FLOAT; planar = true; break;
 
     default:
-        AUDERR ("Unsupported audio format %d\n", (int) ff_fmt);
         return false;
     }
 
     return true;
 }
 
-void FFaudio::write_audioframe (CodecInfo * cinfo, AVPacket * pkt, int out_fmt, bool planar)
+void FFaudio::write_audioframe (CodecInfo * cinfo, AVPacket * pkt, AudioOut & aout)
 {
 #if CHECK_LIBAVCODEC_VERSION(59, 37, 100, 59, 37, 100)
     int channels = cinfo->context->ch_layout.nb_channels;
 #else
     int channels = cinfo->context->channels;
 #endif
-    Index<char> buf;
+    Index<char> & buf = aout.buf;
+
+    if (dsd_pcm)  /* CONVERTING DSD TO PCM OURSELVES (NOTHING TO DO FOR THE EMPTY FLUSH PACKET): */
+    {
+        int frames = (pkt->size > 0) ? dsd_pcm->process (pkt->data, pkt->size, dsd_pcm_buf) : 0;
+        if (frames > 0)
+            write_audio (dsd_pcm_buf.begin (), frames * channels * (int) sizeof (float));
+        return;
+    }
 
     // DSD Processing
     if (is_codec_dsd(cinfo->context->codec_id) && aud_get_bool("ffaudio", "enable_dsd"))
@@ -867,7 +1025,8 @@ void FFaudio::write_audioframe (CodecInfo * cinfo, AVPacket * pkt, int out_fmt,
         if ( cinfo->context->codec_id == AV_CODEC_ID_DSD_LSBF
             || cinfo->context->codec_id == AV_CODEC_ID_DSD_LSBF_PLANAR)
         {
-            buf.resize(pkt->size);
+            if (pkt->size > buf.len ())
+                buf.resize (pkt->size);
             // Bit reverse DSD LSB Least Significant Bit first
             dsf_interlace_loop(pkt->data, (uint8_t *)buf.begin(),
                 cinfo->context->codec_id == AV_CODEC_ID_DSD_LSBF_PLANAR, channels, (pkt->size)/channels);
@@ -890,15 +1049,16 @@ void FFaudio::write_audioframe (CodecInfo * cinfo, AVPacket * pkt, int out_fmt,
     int len = 0;
 #endif
 
+    AVFrame * frame = aout.frame.ptr;
+
     while (pkt->size > 0)
     {
-        ScopedFrame frame;
 #ifdef SEND_PACKET
-        if (LOG (avcodec_receive_frame, cinfo->context, frame.ptr) < 0)
+        if (LOG (avcodec_receive_frame, cinfo->context, frame) < 0)
             break; /* read next packet (continue past errors) */
 #else
         decoded = 0;
-        len = LOG (avcodec_decode_audio4, cinfo->context, frame.ptr, & decoded, pkt);
+        len = LOG (avcodec_decode_audio4, cinfo->context, frame, & decoded, pkt);
         if (len < 0)
         {
             AUDERR ("decode_audio() failed, code %d\n", len);
@@ -916,80 +1076,55 @@ void FFaudio::write_audioframe (CodecInfo * cinfo, AVPacket * pkt, int out_fmt,
             break;
         }
 #endif
-        size = FMT_SIZEOF (out_fmt) * channels * frame->nb_samples;
+        size = FMT_SIZEOF (aout.fmt) * channels * frame->nb_samples;
+
+#ifdef HAVE_SWRESAMPLE
+        if (aout.swr)
+        {
+            if (size > buf.len ())
+                buf.resize (size);
 
-        if (planar)
+            uint8_t * out = (uint8_t *) buf.begin ();
+            int frames = swr_convert (aout.swr, & out, frame->nb_samples,
+                    (const uint8_t * *) frame->extended_data, frame->nb_samples);
+            if (frames > 0)
+                write_audio (buf.begin (), FMT_SIZEOF (aout.fmt) * channels * frames);
+        }
+        else
+#endif
+        if (aout.planar)
         {
             if (size > buf.len ())
                 buf.resize (size);
 
-            audio_interlace ((const void * *) frame->data, out_fmt,
+            /* extended_data, NOT data, SINCE data ONLY HOLDS THE FIRST 8 PLANES: */
+            interleave_planar ((const void * const *) frame->extended_data, aout.fmt,
                     channels, buf.begin (), frame->nb_samples);
             write_audio (buf.begin (), size);
         }
         else
             write_audio (frame->data[0], size);
+
+#if CHECK_LIBAVCODEC_VERSION (55, 45, 101, 55, 28, 1)
+        av_frame_unref (frame);
+#endif
     }
     return;
 }
 
-/* JWT: NEW FUNCTION TO WRITE VIDEO FRAMES TO THE POPUP WINDOW: */
-void FFaudio::write_videoframe (SDL_Renderer * renderer, CodecInfo * vcinfo,
-    SDL_Texture * bmp, AVPacket *pkt, int video_width,
-    int video_height, bool last_resized, bool * windowIsStable)
+/* NEW FUNCTION TO WRITE VIDEO FRAMES TO THE POPUP WINDOW (DECODED BY THE VideoDecoder THREAD): */
+void FFaudio::write_videoframe (SDL_Renderer * renderer, SDL_Texture * bmp, AVFrame * vframe,
+    bool last_resized, bool * windowIsStable)
 {
-#ifdef SEND_PACKET
-    if (LOG (avcodec_send_packet, vcinfo->context, pkt) < 0)
-        return;
-#else
-    int subframeCnt = 0;
-    int frameFinished = 0;
-    int len = 0;
-    while (subframeCnt < 16)
+    if (last_resized)  /* BLIT THE FRAME, BUT ONLY IF WE'RE NOT CURRENTLY RESIZING THE WINDOW! */
     {
-#endif
-        ScopedFrame vframe;
-#ifdef SEND_PACKET
-        if (LOG (avcodec_receive_frame, vcinfo->context, vframe.ptr) < 0)
-            return; /* read next packet (continue past errors) */
-#else
-        frameFinished = 0;
-        len = LOG (avcodec_decode_video2, vcinfo->context, vframe.ptr, & frameFinished, pkt);
-        /* Did we get a video frame? */
-        if (len < 0)
-        {
-            AUDERR ("decode_video() failed, code %d\n", len);
-            return;
-        }
-        if (frameFinished)
-        {
-#endif
-            if (last_resized)  /* BLIT THE FRAME, BUT ONLY IF WE'RE NOT CURRENTLY RESIZING THE WINDOW! */
-            {
-                //SDL_RenderClear (renderer);
-                SDL_UpdateYUVTexture (bmp, nullptr, vframe->data[0], vframe->linesize[0],
-                    vframe->data[1], vframe->linesize[1], vframe->data[2], vframe->linesize[2]);
-                SDL_RenderCopy (renderer, bmp, nullptr, nullptr);  // USE NULL TO GET IMAGE TO FIT WINDOW!
-                SDL_RenderPresent (renderer);  // JWT:NOTE, WILL SEGFAULT HERE IF SQL IS ALREADY SHUT DOWN!
-                (*windowIsStable) = true;
-            }
-            return;
-#ifndef SEND_PACKET
-        }
-        else
-        {
-            if (pkt->size <= 0 || pkt->data < 0)
-                return;
-            pkt->size -= len;
-            pkt->data += len;
-            if (pkt->size <= 0)
-                return;
-        }
-        ++subframeCnt;
+        //SDL_RenderClear (renderer);
+        SDL_UpdateYUVTexture (bmp, nullptr, vframe->data[0], vframe->linesize[0],
+            vframe->data[1], vframe->linesize[1], vframe->data[2], vframe->linesize[2]);
+        SDL_RenderCopy (renderer, bmp, nullptr, nullptr);  // USE NULL TO GET IMAGE TO FIT WINDOW!
+        SDL_RenderPresent (renderer);  // JWT:NOTE, WILL SEGFAULT HERE IF SQL IS ALREADY SHUT DOWN!
+        (*windowIsStable) = true;
     }
-    AUDERR ("w:write_videoframe: runaway frame skipped (more than 16 parts)\n");
-    return;
-#endif
 }
 
 static SDL_Renderer * createSDL2Renderer (SDL_Window * sdl_window, bool myplay_video)
@@ -1094,7 +1229,8 @@ static void * reader_thread_fn (void * data)
 {
     int ret;
     int minbuffer = 12;
-    AVPacket * pkt;
+    int aserial, vserial;
+    AVPacket * pkt = nullptr;
     DataShared2Thread * TD = (DataShared2Thread *) data;
     TD->errcount = 0;
     long reader_sleep_ms = (long) aud_get_int ("ffaudio", "reader_sleep_ms") * 1000000L;
@@ -1106,8 +1242,8 @@ static void * reader_thread_fn (void * data)
     /* OUTER LOOP TO READ, QUEUE AND PROCESS AUDIO & VIDEO PACKETS FROM THE STREAM: */
     while (thread_exit < 2)
     {
-        /* READ NEXT FRAME (OR MORE) OF DATA */
-        if (! (pkt = av_packet_alloc ()))
+        /* READ NEXT FRAME (OR MORE) OF DATA INTO A RECYCLED PACKET (ONLY ALLOCATES ON THE QUEUES' FIRST LAP): */
+        if (! pkt && ! (pkt = av_packet_alloc ()))
         {
             AUDERR ("FFMpeg error: could not allocate memory for packet, giving up.\n");
             thread_exit = -1;  // ERROR
@@ -1115,6 +1251,8 @@ static void * reader_thread_fn (void * data)
         }
 
         pthread_mutex_lock (& read_mutex);  // BLOCK READING WHILST SEEKING (CHANGING POSITION)!
+        aserial = TD->apktQ->serial ();     // (PACKETS READ BEFORE A SEEK GET DROPPED BY THE PLAYBACK THREAD)
+        vserial = TD->pktQ->serial ();
         ret = LOG (av_read_frame, TD->ic, pkt);
         pthread_mutex_unlock (& read_mutex);
 
@@ -1124,70 +1262,62 @@ static void * reader_thread_fn (void * data)
             if (ret == (int) AVERROR_EOF)
             {
                 AUDDBG ("eof reached\n");
-                av_packet_free (& pkt);
                 thread_exit = 1;  // EOF
                 goto THREAD_EXIT;
             }
             else if (TD->errcount > 4)
             {
                 AUDERR ("av_read_frame error %d, giving up.\n", ret);
-                av_packet_free (& pkt);
                 thread_exit = -1;  // ERROR
                 goto THREAD_EXIT;
             }
             else
-            {
-                av_packet_free (& pkt);
                 continue;
-            }
         }
         else
             TD->errcount = 0;
 
         /* NOW PROCESS THE CURRENTLY-READ PACKET: */
+        PacketQueue * Q, * otherQ;
+        int serial;
         if (pkt->stream_index == TD->cinfo.stream_idx)  /* WE READ AN AUDIO PACKET: */
         {
-            if (TD->apktQ->size == TD->apktQ->capacity)
-            {
-                do
-                {
-                    nanosleep (& sleeptime, NULL);
-                    if (thread_exit == 2)
-                    {
-                        av_packet_free (& pkt);
-                        goto THREAD_EXIT;
-                    }
-                }
-                while (TD->pktQ->size > minbuffer && TD->apktQ->size > minbuffer);
-            }
-            if (! Enqueue (TD->apktQ, pkt))
-                av_packet_free (& pkt);
+            Q = TD->apktQ;
+            otherQ = TD->videoalso ? TD->pktQ : nullptr;
+            serial = aserial;
         }
         else if (TD->videoalso && pkt->stream_index == TD->vcinfo.stream_idx)  /* WE READ A VIDEO PACKET: */
         {
-            if (TD->pktQ->size == TD->pktQ->capacity)
-            {
-                do
-                {
-                    nanosleep (& sleeptime, NULL);
-                    if (thread_exit == 2)
-                    {
-                        av_packet_free (& pkt);
-                        goto THREAD_EXIT;
-                    }
-                }
-                while (TD->apktQ->size > minbuffer && TD->pktQ->size > minbuffer);
-            }
-            if (! Enqueue (TD->pktQ, pkt))
-                av_packet_free (& pkt);
+            Q = TD->pktQ;
+            otherQ = TD->apktQ;
+            serial = vserial;
         }
         else
-            av_packet_free (& pkt);
+        {
+            av_packet_unref (pkt);  // NOT OURS, REUSE IT FOR THE NEXT READ.
+            continue;
+        }
+
+        /* WAIT WHILST THIS QUEUE IS FULL (BY COUNT, BYTES OR PLAY-TIME), BUT IF THE OTHER QUEUE IS
+           RUNNING DRY, KEEP READING (AS LONG AS THERE'S ROOM) SO THE PLAYBACK THREAD DOESN'T STARVE: */
+        while (Q->full ())
+        {
+            if (otherQ && otherQ->size () <= minbuffer && Q->size () < Q->capacity ())
+                break;
+
+            nanosleep (& sleeptime, NULL);
+            if (thread_exit == 2)
+                goto THREAD_EXIT;
+        }
+
+        if (! Q->push (pkt, serial))  // (ON SUCCESS, SWAPS IN AN EMPTY PACKET THE CONSUMER IS DONE WITH)
+            av_packet_unref (pkt);
     }
 
 THREAD_EXIT:
-    pthread_mutex_unlock (& queue_mutex);
     pthread_mutex_unlock (& read_mutex);
+    if (pkt)
+        av_packet_free (& pkt);
 
     pthread_exit (nullptr);
 
@@ -1198,7 +1328,6 @@ bool FFaudio::play (const char * filename, VFSFile & file)
 {
     AUDDBG ("FFaudio::play(%s).\n", filename);
 
-    int out_fmt;
     int vx = 0;
     int vy = 0;
     int video_width = 0;     // INITIAL VIDEO WINDOW-SIZE:
@@ -1214,11 +1343,12 @@ bool FFaudio::play (const char * filename, VFSFile & file)
     int video_doreset_width = 0;   // WINDOW-SIZE BELOW WHICH WINDOW WILL SNAP BACK TO SIZE REQUESTED BY VIDEO STREAM:
     int video_doreset_height = 0;
     int video_qsize = 0;
+    int64_t queue_max_bytes, queue_max_usec;  // SOFT LIMITS ON EACH PACKET QUEUE (0 = COUNT ONLY).
     float video_aspect_ratio = 0;  // ASPECT RATIO OF VIDEO, SAVED TO PERMIT RE-ASPECTING AFTER USER RESIZES (WARPS) WINDOW.
     bool myplay_video = play_video; // WHETHER OR NOT TO DISPLAY THE VIDEO.
     bool codec_opened = false;     // TRUE IF SUCCESSFULLY OPENED CODECS:
     bool vcodec_opened = false;
-    bool planar;                   // USED BY Audacious
+    AudioOut aout;                 // OUTPUT FORMAT AND DECODING SCRATCH FOR write_audioframe ().
     bool returnok = false;
     bool last_resized = true;      // TRUE IF VIDEO-WINDOW HAS BEEN RE-ASPECTED SINCE LAST RESIZE EVENT (HAS CORRECT ASPECT RATIO).
     SDL_Event       event;         // SDL EVENTS, IE. RESIZE, KILL WINDOW, ETC.
@@ -1235,8 +1365,10 @@ bool FFaudio::play (const char * filename, VFSFile & file)
     bool noresize_optimizations = aud_get_bool ("ffaudio", "noresize_optimizations");
 
     DataShared2Thread TD;
+    VideoDecoder * vdecoder = nullptr;  // VIDEO DECODER THREAD (IF PLAYING VIDEO).
+    struct timespec idle_time = {0, 2000000};  // 2 MS. NAP WHEN THERE'S NOTHING TO DO.
 
-    TD.ic = open_input_file (filename, file);
+    TD.ic = open_input_file (filename, file, false, true);
     if (! TD.ic)
         return false;
 
@@ -1290,11 +1422,31 @@ bool FFaudio::play (const char * filename, VFSFile & file)
     }
     AUDDBG ("got codec %s for stream index %d, opening\n", TD.cinfo.codec->name, TD.cinfo.stream_idx);
 
+    set_codec_threads (TD.cinfo.context, "audio");
     if (LOG (avcodec_open2, TD.cinfo.context, TD.cinfo.codec, nullptr) < 0)
         goto error_exit;
 
-    if (! convert_format (TD.cinfo.context->sample_fmt, out_fmt, planar))
-        goto error_exit;
+    {
+        bool known_fmt = convert_format (TD.cinfo.context->sample_fmt, aout.fmt, aout.planar);
+#ifdef HAVE_SWRESAMPLE
+        /* LET libswresample CONVERT FORMATS WE CAN'T PASS ON (IE. DOUBLE), OR EVERYTHING IF THE USER
+           WANTS FLOAT STRAIGHT TO THE EFFECTS (SAVES THE CORE CONVERTING IT): */
+        if (! known_fmt || (aud_get_bool ("ffaudio", "audio_float") && aout.fmt != FMT_FLOAT))
+        {
+            if ((aout.swr = new_float_converter (TD.cinfo.context)))
+            {
+                aout.fmt = FMT_FLOAT;
+                aout.planar = false;
+                known_fmt = true;
+            }
+        }
+#endif
+        if (! known_fmt)
+        {
+            AUDERR ("Unsupported audio format %d\n", (int) TD.cinfo.context->sample_fmt);
+            goto error_exit;
+        }
+    }
 
     myplay_video = play_video;
     /* JWT: IF abUSER ALSO WANTS TO PLAY VIDEO THEN WE SET UP POP-UP VIDEO SCREEN: */
@@ -1332,6 +1484,7 @@ bool FFaudio::play (const char * filename, VFSFile & file)
         if (video_xmove == -1)
             needWinSzFudge = false;  // NO FUDGING NEEDED IF WINDOW TO BE PLACED RANDOMLY BY WINDOWMANAGER!
 
+        set_codec_threads (TD.vcinfo.context, "video");
         if (LOG (avcodec_open2, TD.vcinfo.context, TD.vcinfo.codec, nullptr) < 0)
             goto error_exit;
 
@@ -1416,6 +1569,22 @@ breakout1:
     AUDDBG ("opening audio output - bitrate=%ld=\n", (long) TD.ic->bit_rate);
 
     set_stream_bitrate (TD.ic->bit_rate);
+    {   /* SHOW HOW MANY THREADS EACH DECODER ENDED UP WITH AFTER THE CODEC NAME IN THE STREAM INFO
+            (QUALITY IS LEFT ALONE, IT SAYS LOSSLESS/LOSSY): */
+        StringBuf threadinfo = describe_codec_threads ("audio", TD.cinfo.context);
+        if (myplay_video)
+        {
+            threadinfo.combine (str_copy (", "));
+            threadinfo.combine (describe_codec_threads ("video", TD.vcinfo.context));
+        }
+
+        AUDINFO ("i:decoder threads: %s\n", (const char *) threadinfo);
+        Tuple tuple = get_playback_tuple ();
+        String codec = tuple.get_str (Tuple::Codec);
+        tuple.set_str (Tuple::Codec, codec ? str_printf ("%s [%s]", (const char *) codec,
+                (const char *) threadinfo) : threadinfo);
+        set_playback_tuple (tuple.ref ());
+    }
     {
 #if CHECK_LIBAVCODEC_VERSION(59, 37, 100, 59, 37, 100)
         int channels = TD.cinfo.context->ch_layout.nb_channels;
@@ -1425,17 +1594,33 @@ breakout1:
         int sample_rate = TD.cinfo.context->sample_rate;
         if (is_codec_dsd(TD.cinfo.context->codec_id) && aud_get_bool("ffaudio", "enable_dsd"))
         {
-            out_fmt = FMT_DSD_MSB8;
+            aout.fmt = FMT_DSD_MSB8;
             sample_rate /= 4; // Convert to ALSA sample rate
         }
+        else if (is_codec_dsd (TD.cinfo.context->codec_id) && aud_get_bool ("ffaudio", "dsd_to_pcm"))
+        {
+            enum AVCodecID id = TD.cinfo.context->codec_id;
+
+            dsd_pcm = new DSDDecimator;
+            if (dsd_pcm->init (channels, sample_rate, aud_get_int ("ffaudio", "dsd_pcm_rate"),
+                    id == AV_CODEC_ID_DSD_LSBF || id == AV_CODEC_ID_DSD_LSBF_PLANAR,
+                    id == AV_CODEC_ID_DSD_LSBF_PLANAR || id == AV_CODEC_ID_DSD_MSBF_PLANAR))
+            {
+                aout.fmt = FMT_FLOAT;
+                sample_rate = dsd_pcm->rate ();
+            }
+            else  /* FALL BACK TO libavcodec's DSD DECODER: */
+            {
+                delete dsd_pcm;
+                dsd_pcm = nullptr;
+            }
+        }
 
-        open_audio (out_fmt, sample_rate, channels);
+        open_audio (aout.fmt, sample_rate, channels);
     }
     int seek_value;
-    /* JWT:video_qsize:  MAX # PACKETS TO QUEUE UP FOR INTERLACING TO SMOOTH VIDEO
-        PLAYBACK - GOOD RANGE IS 6-12, DEFAULT IS 6:
-        NOT ENOUGH = JITTERY VIDEO
-        TOO MANY = AUDIO/VIDEO BECOME NOTICABLY OUT OF SYNC!
+    /* video_qsize:  MAX # PACKETS TO QUEUE UP (x12) TO SMOOTH VIDEO PLAYBACK - GOOD RANGE IS 6-12,
+        DEFAULT IS 6 (NOT ENOUGH = JITTERY VIDEO, TOO MANY = MORE MEMORY):
     */
     if (video_qsize < 2)
         video_qsize = (aud_get_int ("ffaudio", "video_qsize"))
@@ -1444,8 +1629,14 @@ breakout1:
         video_qsize = 8;
 
     /* TYPICALLY THERE'S TWICE AS MANY AUDIO PACKETS AS VIDEO, SO THIS IS COUNTER-INTUITIVE, BUT IT WORKS BEST! */
-    TD.pktQ = createQueue (12 * video_qsize);  // ALLOW FOR A BUNCH OF VIDEO PACKETS (USUALLY AT STARTUP),
-    TD.apktQ = createQueue (12 * video_qsize); // BUT, GENERALLY THE AUDIO QUEUE WILL FILL FIRST FORCING OUTPUT:
+    /* THE READER ALSO HOLDS OFF ONCE A QUEUE HOLDS queue_max_kb BYTES OR queue_max_ms OF PLAY-TIME
+       (KEEPS HIGH-BITRATE, IE. 4K VIDEO FROM EATING ALL MEMORY): */
+    queue_max_bytes = (int64_t) aud_get_int ("ffaudio", "queue_max_kb") * 1024;
+    queue_max_usec = (int64_t) aud_get_int ("ffaudio", "queue_max_ms") * 1000;
+    TD.pktQ = new PacketQueue (12 * video_qsize,  // ALLOW FOR A BUNCH OF VIDEO PACKETS (USUALLY AT STARTUP),
+            queue_max_bytes, queue_max_usec, vcodec_opened ? TD.vcinfo.stream->time_base : TD.cinfo.stream->time_base);
+    TD.apktQ = new PacketQueue (12 * video_qsize,  // BUT, GENERALLY THE AUDIO QUEUE WILL FILL FIRST FORCING OUTPUT:
+            queue_max_bytes, queue_max_usec, TD.cinfo.stream->time_base);
     returnok = true;
     AUDDBG ("i:video queue size %d\n", video_qsize);
 
@@ -1472,6 +1663,17 @@ breakout1:
     if (! bmp)
         myplay_video = false;
 
+    if (myplay_video)  /* START UP VIDEO DECODER THREAD (IT CONSUMES THE VIDEO PACKET QUEUE): */
+    {
+        vdecoder = new VideoDecoder (TD.vcinfo.context, TD.vcinfo.stream->time_base,
+                TD.ic->start_time, * TD.pktQ);
+        if (! vdecoder->start ())
+        {
+            AUDERR ("s:Error creating video decoder thread - no video play!\n");
+            myplay_video = false;
+        }
+    }
+
     TD.videoalso = myplay_video;
     /* START UP READER THREAD: */
     pthread_attr_t thread_attrs;
@@ -1516,58 +1718,29 @@ breakout1:
         SDL_SetWindowTitle (sdl_window, (const char *) titleBuf);
     }
 
-    /* LOOP TO PROCESS QUEUED AUDIO & VIDEO PACKETS FROM THE STREAM, INTERLACE AND OUTPUT THEM: */
+    /* LOOP TO PROCESS QUEUED AUDIO PACKETS AND SHOW VIDEO FRAMES AS THE AUDIO CLOCK REACHES 'EM: */
     while (! thread_exit)
     {
+        bool busy = false;  // FALSE IF THERE WAS NOTHING TO DO THIS TIME AROUND (SO WE DON'T SPIN).
+
+        if ((pkt = TD.apktQ->peek ()))
+        {   // PROCESS NEXT AUDIO FRAME IN QUEUE:
+            write_audioframe (& TD.cinfo, pkt, aout);
+            TD.apktQ->pop ();
+            busy = true;
+        }
         if (myplay_video)
         {
-            if (TD.apktQ->size > 0)
-            {   // PROCESS NEXT AUDIO FRAME(S) IN QUEUE:
-                write_audioframe (& TD.cinfo, TD.apktQ->elements[TD.apktQ->front], out_fmt, planar);
-                Dequeue (TD.apktQ);
-                /* NOTE:THE HARDCODED MULTIPLES STAGGERED B/C AFTER 2X, WE HESITATE A BIT TO ADD MORE: */
-                /* (MAINTAIN THE A/V RATIO AS CLOSE TO 1:1-ISH OR THE VIDEO'S OVERALL RATIO AS POSSIBLE) */
-                if (TD.apktQ->size > int(1.1 * TD.pktQ->size))  // CLOSER TO 2X AUDIOS QUEUED THAN VIDEOS, PROCESS AN EXTRA ONE!
-                {
-                    write_audioframe (& TD.cinfo, TD.apktQ->elements[TD.apktQ->front], out_fmt, planar);
-                    Dequeue (TD.apktQ);
-                    if (TD.apktQ->size > int(2.7 * TD.pktQ->size))  // CLOSER TO 3X AUDIOS QUEUED THAN VIDEOS, PROCESS ANOTHER EXTRA ONE!
-                    {
-                        write_audioframe (& TD.cinfo, TD.apktQ->elements[TD.apktQ->front], out_fmt, planar);
-                        Dequeue (TD.apktQ);
-                        if (TD.apktQ->size > int(4.3 * TD.pktQ->size))  // CLOSER TO 4X AUDIOS QUEUED THAN VIDEOS, PROCESS ANOTHER EXTRA ONE!
-                        {
-                            write_audioframe (& TD.cinfo, TD.apktQ->elements[TD.apktQ->front], out_fmt, planar);
-                            Dequeue (TD.apktQ);
-                        }
-                    }
-                }
-            }
             if (thread_exit == 2)  //abUser MAY HAVE KILLED FAUXDACIOUS (& SDL) WHILST WRITING AUDIO-FRAMES!:
                 break;             //IF SO, WE BREAK HERE B4 WRITING VIDEO FRAMES LEST WE SEGFAULT!
-            else if (TD.pktQ->size > 0)
-            {   // PROCESS NEXT VIDEO FRAME(S) IN QUEUE:
-                write_videoframe (renderer.get (), & TD.vcinfo, bmpptr, TD.pktQ->elements[TD.pktQ->front],
-                        video_width, video_height, last_resized, & windowIsStable);
-                Dequeue (TD.pktQ);
-                if (TD.pktQ->size > int(1.4 * TD.apktQ->size))  // CLOSER TO 2X VIDEOS QUEUED THAN AUDIOS, PROCESS AN EXTRA ONE!
-                {
-                    write_videoframe (renderer.get (), & TD.vcinfo, bmpptr, TD.pktQ->elements[TD.pktQ->front],
-                            video_width, video_height, last_resized, & windowIsStable);
-                    Dequeue (TD.pktQ);
-                    if (TD.pktQ->size > int(2.8 * TD.apktQ->size))  // CLOSER TO 3X VIDEOS QUEUED THAN AUDIOS, PROCESS ANOTHER EXTRA ONE!
-                    {
-                        write_videoframe (renderer.get (), & TD.vcinfo, bmpptr, TD.pktQ->elements[TD.pktQ->front],
-                                video_width, video_height, last_resized, & windowIsStable);
-                        Dequeue (TD.pktQ);
-                        if (TD.pktQ->size > int(4.2 * TD.apktQ->size))  // CLOSER TO 4X VIDEOS QUEUED THAN AUDIOS, PROCESS ANOTHER EXTRA ONE!
-                        {
-                            write_videoframe (renderer.get (), & TD.vcinfo, bmpptr, TD.pktQ->elements[TD.pktQ->front],
-                                    video_width, video_height, last_resized, & windowIsStable);
-                            Dequeue (TD.pktQ);
-                        }
-                    }
-                }
+
+            /* SHOW THE VIDEO FRAME DUE AT THE CURRENT AUDIO-OUTPUT TIME (LATE ONES GET DROPPED): */
+            AVFrame * vframe = vdecoder->due_frame (aud_drct_get_time ());
+            if (vframe)
+            {
+                write_videoframe (renderer.get (), bmpptr, vframe, last_resized, & windowIsStable);
+                vdecoder->pop ();
+                busy = true;
             }
             if (SDL_PollEvent (& event))
             {
@@ -1779,11 +1952,9 @@ breakout1:
                 needWinSzFudge = false;  // WE HAVE OUR DECORATION FUDGE-FACTOR (IF ANY)!
             }
         }
-        else if (TD.apktQ->size > 0)
-        {   // WE'RE JUST DOING AUDIO, SO JUST PROCESS NEXT AUDIO FRAME IN QUEUE:
-            write_audioframe (& TD.cinfo, TD.apktQ->elements[TD.apktQ->front], out_fmt, planar);
-            Dequeue (TD.apktQ);
-        }
+
+        if (! busy)  // NOTHING QUEUED OR DUE YET, GIVE THE OTHER THREADS A MOMENT:
+            nanosleep (& idle_time, nullptr);
 
         /* CHECK IF WE NEED TO QUIT (EOF OR USER PRESSED STOP BUTTON OR WENT TO ANOTHER SONG): */
         if (check_stop ())
@@ -1796,14 +1967,17 @@ breakout1:
         seek_value = check_seek ();
         if (seek_value >= 0)
         {
-            /* JWT:FIRST, FLUSH ANY PACKETS SITTING IN THE QUEUES TO CLEAR THE QUEUES! */
-            QFlush (TD.apktQ);
-            QFlush (TD.pktQ);
-            /* JWT: HAD TO CHANGE THIS FROM "AVSEEK_FLAG_ANY" TO AVSEEK_FLAG_BACKWARD
-                TO GET SEEK TO NOT RANDOMLY BRICK?! */
-
             pthread_mutex_lock (& read_mutex);  // BLOCK READING WHILST SEEKING (CHANGING POSITION)!
 
+            /* JWT:FIRST, FLUSH ANY PACKETS SITTING IN THE QUEUES TO CLEAR THE QUEUES!
+               (DONE UNDER THE READ LOCK SO ANY PACKET THE READER IS STILL HOLDING FROM
+               BEFORE THE SEEK CARRIES THE OLD SERIAL AND GETS DROPPED, NOT PLAYED) */
+            TD.apktQ->flush ();
+            if (dsd_pcm)
+                dsd_pcm->reset ();
+            TD.pktQ->invalidate ();  // (VIDEO DECODER THREAD DROPS THESE AND RESETS ITSELF)
+            /* JWT: HAD TO CHANGE THIS FROM "AVSEEK_FLAG_ANY" TO AVSEEK_FLAG_BACKWARD
+                TO GET SEEK TO NOT RANDOMLY BRICK?! */
             if (LOG (av_seek_frame, TD.ic, -1, (int64_t) seek_value *
                     AV_TIME_BASE / 1000, AVSEEK_FLAG_BACKWARD) >= 0)
                 TD.errcount = 0;
@@ -1828,30 +2002,52 @@ breakout1:
         returnok = false;
     else if (thread_exit < 2)  // OUTPUT ANYTHING LEFT IN THE QUEUES (UNLESS USER HIT STOP-BUTTON):
     {
-        while (TD.apktQ->size > 0 || TD.pktQ->size > 0)
-        {
-            if (TD.apktQ->size > 0)
-            {   // PROCESS NEXT AUDIO FRAME IN QUEUE:
-                write_audioframe (& TD.cinfo, TD.apktQ->elements[TD.apktQ->front], out_fmt, planar);
-                Dequeue (TD.apktQ);
-            }
-            if (myplay_video && TD.pktQ->size > 0)
-            {   // PROCESS NEXT VIDEO FRAME IN QUEUE:
-                write_videoframe (renderer.get (), & TD.vcinfo, bmpptr, TD.pktQ->elements[TD.pktQ->front],
-                        video_width, video_height, last_resized, & windowIsStable);
-                Dequeue (TD.pktQ);
+        while ((pkt = TD.apktQ->peek ()))
+        {   // PROCESS NEXT AUDIO FRAME IN QUEUE:
+            write_audioframe (& TD.cinfo, pkt, aout);
+            TD.apktQ->pop ();
+            if (myplay_video)
+            {
+                AVFrame * vframe = vdecoder->due_frame (aud_drct_get_time ());
+                if (vframe)
+                {
+                    write_videoframe (renderer.get (), bmpptr, vframe, last_resized, & windowIsStable);
+                    vdecoder->pop ();
+                }
             }
         }
         if ((pkt = av_packet_alloc ()))
         {
             pkt->data=nullptr; pkt->size=0;
-            write_audioframe (& TD.cinfo, pkt, out_fmt, planar);
-            if (myplay_video)  /* IF VIDEO-WINDOW STILL INTACT (NOT CLOSED BY USER PRESSING WINDOW'S CORNER [X]): */
-                write_videoframe (renderer.get (), & TD.vcinfo, bmpptr, pkt,
-                        video_width, video_height, last_resized, & windowIsStable);
-
+            write_audioframe (& TD.cinfo, pkt, aout);
             av_packet_free (& pkt);
         }
+        if (myplay_video)
+        {   /* LET THE VIDEO THREAD DECODE WHAT'S LEFT AND SHOW IT AS THE AUDIO STILL BUFFERED PLAYS OUT
+               (GIVE UP IF THE AUDIO CLOCK STOPS MOVING, IE. THE LAST FRAMES RUN PAST THE END OF THE AUDIO): */
+            int last_clock = -1;
+            int stalled_ms = 0;
+
+            vdecoder->drain ();
+            while (! vdecoder->finished () && stalled_ms < 500 && ! check_stop ())
+            {
+                int clock = aud_drct_get_time ();
+                AVFrame * vframe = vdecoder->due_frame (clock);
+                if (vframe)
+                {
+                    write_videoframe (renderer.get (), bmpptr, vframe, last_resized, & windowIsStable);
+                    vdecoder->pop ();
+                }
+                else
+                    nanosleep (& idle_time, nullptr);
+
+                if (clock != last_clock || aud_drct_get_paused ())
+                    stalled_ms = 0;
+                else
+                    stalled_ms += 2;
+                last_clock = clock;
+            }
+        }
     }
 
 #ifdef _WIN32
@@ -1867,10 +2063,16 @@ breakout1:
 error_exit:  /* WE END UP HERE WHEN PLAYBACK IS STOPPED: */
 
     AUDDBG ("end of playback.\n");
-    if (TD.pktQ)
-        destroyQueue (TD.pktQ);
-    if (TD.apktQ)
-        destroyQueue (TD.apktQ);
+    if (vdecoder)
+    {
+        AUDDBG ("i:%d late video frames dropped.\n", vdecoder->dropped ());
+        delete vdecoder;  // (STOPS THE THREAD BEFORE WE FREE ITS CODEC AND QUEUE BELOW)
+    }
+    delete TD.pktQ;
+    delete TD.apktQ;
+    delete dsd_pcm;
+    dsd_pcm = nullptr;
+    dsd_pcm_buf.clear ();
 
     if (myplay_video && sdl_window)
     {
@@ -0,0 +1,350 @@
+/*
+ * Fauxdacious FFaudio Plugin - DSD to PCM conversion
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include <libfauxdcore/objects.h>
+#include <libfauxdcore/runtime.h>
+
+#include "ffaudio-dsd.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HAVE_NEON
+#endif
+
+#define STAGE1_TAPS 64           /* 8 bytes of the bitstream */
+#define STAGE1_BETA 7.0          /* Kaiser window: ~70 dB */
+#define HALFBAND_BETA 8.0        /* ~80 dB */
+#define HALFBAND_SHORT 8         /* side taps of the early half-band stages */
+#define HALFBAND_LONG 28         /* side taps of the last, steepest one */
+
+/* ---- filter design ---- */
+
+static double bessel_i0 (double x)
+{
+    double sum = 1, term = 1;
+
+    for (int k = 1; k < 50 && term > sum * 1e-12; k ++)
+    {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+
+    return sum;
+}
+
+/* Kaiser window of length <len>, evaluated at <n> (may be fractional) */
+static double kaiser (double n, int len, double beta)
+{
+    double r = 2 * n / (len - 1) - 1;
+    return bessel_i0 (beta * sqrt (aud::max (1 - r * r, 0.0))) / bessel_i0 (beta);
+}
+
+/* windowed-sinc low-pass; <cutoff> as a fraction of the sample rate */
+static void design_lowpass (double * h, int len, double cutoff, double beta)
+{
+    double center = (len - 1) / 2.0, sum = 0;
+
+    for (int n = 0; n < len; n ++)
+    {
+        double x = n - center;
+        double sinc = (x == 0) ? 2 * cutoff : sin (2 * M_PI * cutoff * x) / (M_PI * x);
+        h[n] = sinc * kaiser (n, len, beta);
+        sum += h[n];
+    }
+
+    for (int n = 0; n < len; n ++)
+        h[n] /= sum;  /* unity gain at DC */
+}
+
+static void design_halfband (int half_len, float & center, Index<float> & coefs)
+{
+    int len = 4 * half_len - 1;
+    Index<double> h;
+    h.insert (0, len);
+
+    design_lowpass (h.begin (), len, 0.25, HALFBAND_BETA);
+
+    /* taps at even distances from the center are zero by construction */
+    int c = len / 2;
+    center = h[c];
+    coefs.clear ();
+    for (int k = 0; k < half_len; k ++)
+        coefs.append (h[c + 2 * k + 1]);
+}
+
+/* ---- half-band kernels ----
+ *
+ * y[i] = center * odd[i + K - 1] + sum (k < K) coefs[k] * (even[i + K - 1 - k] + even[i + K + k])
+ *
+ * where even[] and odd[] are the input samples at even and odd positions.  Each
+ * kernel starts at output <i> and returns the index of the first output not
+ * done; the scalar one finishes the rest. */
+
+static void halfband_c (const float * even, const float * odd, const float * coefs,
+ int half_len, float center, float * out, int i, int n)
+{
+    for (; i < n; i ++)
+    {
+        const float * e = even + i + half_len;
+        float acc = center * odd[i + half_len - 1];
+
+        for (int k = 0; k < half_len; k ++)
+            acc += coefs[k] * (e[-1 - k] + e[k]);
+
+        out[i] = acc;
+    }
+}
+
+#ifdef __SSE2__
+static int halfband_sse2 (const float * even, const float * odd, const float * coefs,
+ int half_len, float center, float * out, int i, int n)
+{
+    __m128 c = _mm_set1_ps (center);
+
+    for (; i + 4 <= n; i += 4)
+    {
+        const float * e = even + i + half_len;
+        __m128 acc = _mm_mul_ps (c, _mm_loadu_ps (odd + i + half_len - 1));
+
+        for (int k = 0; k < half_len; k ++)
+        {
+            __m128 pair = _mm_add_ps (_mm_loadu_ps (e - 1 - k), _mm_loadu_ps (e + k));
+            acc = _mm_add_ps (acc, _mm_mul_ps (_mm_set1_ps (coefs[k]), pair));
+        }
+
+        _mm_storeu_ps (out + i, acc);
+    }
+
+    return i;
+}
+#endif
+
+#ifdef HAVE_NEON
+static int halfband_neon (const float * even, const float * odd, const float * coefs,
+ int half_len, float center, float * out, int i, int n)
+{
+    for (; i + 4 <= n; i += 4)
+    {
+        const float * e = even + i + half_len;
+        float32x4_t acc = vmulq_n_f32 (vld1q_f32 (odd + i + half_len - 1), center);
+
+        for (int k = 0; k < half_len; k ++)
+        {
+            float32x4_t pair = vaddq_f32 (vld1q_f32 (e - 1 - k), vld1q_f32 (e + k));
+            acc = vmlaq_n_f32 (acc, pair, coefs[k]);
+        }
+
+        vst1q_f32 (out + i, acc);
+    }
+
+    return i;
+}
+#endif
+
+/* ---- DSDDecimator ---- */
+
+bool DSDDecimator::init (int channels, int byte_rate, int target_rate, bool lsb_first, bool planar)
+{
+    if (channels < 1 || byte_rate <= 0 || target_rate <= 0)
+        return false;
+
+    /* halve until the next halving would go well below the target, so that
+     * 48 kHz-based DSD lands on 96/192 kHz rather than 48/96 */
+    int rate = byte_rate, stages = 0;
+    while (rate / 2 >= target_rate * 9 / 10 && stages < max_stages)
+    {
+        rate /= 2;
+        stages ++;
+    }
+
+    if (rate > target_rate * 2)
+    {
+        AUDERR ("DSD rate %d is too high to convert to %d Hz.\n", byte_rate * 8, target_rate);
+        return false;
+    }
+
+    m_channels = channels;
+    m_rate = rate;
+    m_stages = stages;
+    m_planar = planar;
+
+    /* first stage: cut off at half the rate it decimates to; later stages
+     * take care of the final band edge */
+    double h[STAGE1_TAPS];
+    design_lowpass (h, STAGE1_TAPS, 1.0 / 16, STAGE1_BETA);
+
+    for (int j = 0; j < 8; j ++)
+    {
+        for (int v = 0; v < 256; v ++)
+        {
+            double sum = 0;
+            for (int b = 0; b < 8; b ++)
+            {
+                /* bit b is the b-th oldest in the byte; 1 = +1, 0 = -1 */
+                int bit = lsb_first ? (v >> b) & 1 : (v >> (7 - b)) & 1;
+                sum += bit ? h[8 * j + b] : -h[8 * j + b];
+            }
+
+            m_table[j][v] = sum;
+        }
+    }
+
+    for (int s = 0; s < stages; s ++)
+        design_halfband ((s == stages - 1) ? HALFBAND_LONG : HALFBAND_SHORT,
+         m_hb[s].center, m_hb[s].coefs);
+
+    for (int s = 0; s < stages; s ++)
+        m_hb[s].half_len = m_hb[s].coefs.len ();
+
+    m_chans.clear ();
+    m_chans.insert (0, channels);
+
+    AUDINFO ("DSD at %d bit/s to %d Hz PCM, %d half-band stage(s).\n", byte_rate * 8, rate, stages);
+    return true;
+}
+
+void DSDDecimator::reset ()
+{
+    for (Channel & ch : m_chans)
+    {
+        ch.bytes.clear ();
+        for (auto & pcm : ch.pcm)
+            pcm.clear ();
+    }
+}
+
+/* filters and decimates by 8: one output per input byte, from that byte and
+ * the 7 before it */
+void DSDDecimator::stage1 (Channel & ch)
+{
+    int n = ch.bytes.len () - 7;
+    if (n <= 0)
+        return;
+
+    Index<float> & out = ch.pcm[0];
+    int at = out.len ();
+    out.insert (at, n);
+
+    const unsigned char * b = ch.bytes.begin ();
+    float * y = out.begin () + at;
+
+    for (int m = 0; m < n; m ++)
+    {
+        const unsigned char * p = b + m;
+        y[m] = (m_table[0][p[0]] + m_table[1][p[1]]) + (m_table[2][p[2]] + m_table[3][p[3]]) +
+               (m_table[4][p[4]] + m_table[5][p[5]]) + (m_table[6][p[6]] + m_table[7][p[7]]);
+    }
+
+    ch.bytes.remove (0, n);
+}
+
+void DSDDecimator::halfband (const HalfBand & hb, Index<float> & in, Index<float> & out)
+{
+    int K = hb.half_len;
+    int taps = 4 * K - 1;
+    int len = in.len ();
+
+    if (len < taps)
+        return;
+
+    /* output i uses input 2i .. 2i + taps - 1 */
+    int n = (len - taps) / 2 + 1;
+    int n_even = n + 2 * K - 1, n_odd = n + K - 1;
+
+    m_even.resize (n_even);
+    m_odd.resize (n_odd);
+
+    const float * x = in.begin ();
+    for (int j = 0; j < n_even; j ++)
+        m_even[j] = x[2 * j];
+    for (int j = 0; j < n_odd; j ++)
+        m_odd[j] = x[2 * j + 1];
+
+    int at = out.len ();
+    out.insert (at, n);
+    float * y = out.begin () + at;
+    int i = 0;
+
+#if defined(__SSE2__)
+    i = halfband_sse2 (m_even.begin (), m_odd.begin (), hb.coefs.begin (), K, hb.center, y, i, n);
+#elif defined(HAVE_NEON)
+    i = halfband_neon (m_even.begin (), m_odd.begin (), hb.coefs.begin (), K, hb.center, y, i, n);
+#endif
+    halfband_c (m_even.begin (), m_odd.begin (), hb.coefs.begin (), K, hb.center, y, i, n);
+
+    in.remove (0, 2 * n);
+}
+
+int DSDDecimator::process (const unsigned char * data, int size, Index<float> & out)
+{
+    int per_channel = size / m_channels;
+    int frames = -1;
+
+    for (int c = 0; c < m_channels; c ++)
+    {
+        Channel & ch = m_chans[c];
+
+        /* planar packets hold each channel's bytes in one block, interleaved
+         * ones alternate channels byte by byte */
+        int at = ch.bytes.len ();
+        ch.bytes.insert (at, per_channel);
+        unsigned char * dst = ch.bytes.begin () + at;
+
+        if (m_planar)
+            memcpy (dst, data + c * per_channel, per_channel);
+        else
+        {
+            const unsigned char * src = data + c;
+            for (int i = 0; i < per_channel; i ++, src += m_channels)
+                dst[i] = * src;
+        }
+
+        stage1 (ch);
+
+        for (int s = 0; s < m_stages; s ++)
+            halfband (m_hb[s], ch.pcm[s], ch.pcm[s + 1]);
+
+        int avail = ch.pcm[m_stages].len ();
+        frames = (frames < 0) ? avail : aud::min (frames, avail);
+    }
+
+    if (frames <= 0)
+        return 0;
+
+    out.resize (frames * m_channels);
+
+    for (int c = 0; c < m_channels; c ++)
+    {
+        Index<float> & pcm = m_chans[c].pcm[m_stages];
+        float * dst = out.begin () + c;
+
+        for (int i = 0; i < frames; i ++, dst += m_channels)
+            * dst = pcm[i];
+
+        pcm.remove (0, frames);
+    }
+
+    return frames;
+}
@@ -0,0 +1,80 @@
+/*
+ * Fauxdacious FFaudio Plugin - DSD to PCM conversion
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef __FFAUDIO_DSD_H__GUARD
+#define __FFAUDIO_DSD_H__GUARD
+
+#include <libfauxdcore/index.h>
+
+/*
+ * Converts a 1-bit DSD stream (DSD64, 128, 256 or 512) to float PCM at 88.2
+ * or 176.4 kHz (96 or 192 kHz for the rarer 48 kHz-based DSD rates), so DSF
+ * and DFF files play on any output and through the effect plugins.
+ *
+ * The first stage filters the bitstream and decimates by 8 in one go: the
+ * FIR's taps are grouped per input byte into 256-entry tables, so each output
+ * sample costs eight table lookups instead of 64 multiplies.  Each further
+ * stage is a polyphase half-band filter decimating by 2; only every other tap
+ * is non-zero, and the inner loop works on four outputs at a time (SSE2 or
+ * NEON where available).
+ */
+
+class DSDDecimator
+{
+public:
+    static constexpr int max_stages = 5;  // DSD512 down to 88.2 kHz
+
+    /* byte_rate: bytes per second per channel, as in AVCodecContext::sample_rate
+     * of libavcodec's DSD codecs; target_rate: 88200 or 176400 */
+    bool init (int channels, int byte_rate, int target_rate, bool lsb_first, bool planar);
+
+    int rate () const
+        { return m_rate; }
+
+    /* drops the filter state (after a seek) */
+    void reset ();
+
+    /* converts one packet; returns the number of frames left in <out>,
+     * interleaved */
+    int process (const unsigned char * data, int size, Index<float> & out);
+
+private:
+    struct HalfBand {
+        int half_len;          // non-zero side taps (K); the filter is 4K - 1 long
+        float center;
+        Index<float> coefs;    // side taps, nearest the center first
+    };
+
+    struct Channel {
+        Index<unsigned char> bytes;       // not yet filtered by the first stage
+        Index<float> pcm[max_stages + 1]; // input to each half-band stage, then output
+    };
+
+    void stage1 (Channel & ch);
+    void halfband (const HalfBand & hb, Index<float> & in, Index<float> & out);
+
+    int m_channels = 0, m_rate = 0, m_stages = 0;
+    bool m_planar = false;
+
+    float m_table[8][256];
+    HalfBand m_hb[max_stages];
+    Index<Channel> m_chans;
+    Index<float> m_even, m_odd;  // scratch
+};
+
+#endif
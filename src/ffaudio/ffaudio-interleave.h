@@ -0,0 +1,344 @@
+/*
+ * Fauxdacious FFaudio Plugin - planar to interleaved audio
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef __FFAUDIO_INTERLEAVE_H__GUARD
+#define __FFAUDIO_INTERLEAVE_H__GUARD
+
+#include <stdint.h>
+#include <string.h>
+
+#include <libfauxdcore/audio.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define FFAUDIO_HAVE_NEON
+#endif
+
+/*
+ * Most libavcodec audio decoders (AAC, AC-3, Opus, Vorbis, ...) put out
+ * planar samples, which have to be interleaved for the output on every frame.
+ * The kernels here cover the common cases -- 2, 6 and 8 channels of 32-bit
+ * (float, S32) or 16-bit samples -- and only move bits around, so the sample
+ * type beyond its width does not matter.  Like the other kernels in the tree,
+ * each starts at frame <i>, does as many whole vectors as it can and returns
+ * the first frame not done; a scalar loop finishes the rest.  Anything else
+ * goes to the generic audio_interlace ().
+ *
+ * Header-only so that dvd-ng can use it too.
+ */
+
+/* ---- scalar ---- */
+
+template<class T, int C>
+static inline void interleave_c (const T * const * in, T * out, int i, int frames)
+{
+    for (; i < frames; i ++)
+    {
+        for (int c = 0; c < C; c ++)
+            out[i * C + c] = in[c][i];
+    }
+}
+
+/* ---- SSE2 ---- */
+
+#ifdef __SSE2__
+
+static inline void interleave_transpose4_sse2 (__m128i & a, __m128i & b, __m128i & c, __m128i & d)
+{
+    __m128i ab0 = _mm_unpacklo_epi32 (a, b), ab1 = _mm_unpackhi_epi32 (a, b);
+    __m128i cd0 = _mm_unpacklo_epi32 (c, d), cd1 = _mm_unpackhi_epi32 (c, d);
+
+    a = _mm_unpacklo_epi64 (ab0, cd0);
+    b = _mm_unpackhi_epi64 (ab0, cd0);
+    c = _mm_unpacklo_epi64 (ab1, cd1);
+    d = _mm_unpackhi_epi64 (ab1, cd1);
+}
+
+#define LOAD(p) _mm_loadu_si128 ((const __m128i *) (p))
+#define STORE(p, v) _mm_storeu_si128 ((__m128i *) (p), (v))
+
+static inline int interleave32_2_sse2 (const uint32_t * const * in, uint32_t * out, int i, int frames)
+{
+    for (; i + 4 <= frames; i += 4)
+    {
+        __m128i l = LOAD (in[0] + i), r = LOAD (in[1] + i);
+        STORE (out + 2 * i, _mm_unpacklo_epi32 (l, r));
+        STORE (out + 2 * i + 4, _mm_unpackhi_epi32 (l, r));
+    }
+
+    return i;
+}
+
+static inline int interleave32_6_sse2 (const uint32_t * const * in, uint32_t * out, int i, int frames)
+{
+    for (; i + 4 <= frames; i += 4)
+    {
+        __m128i f[4] = {LOAD (in[0] + i), LOAD (in[1] + i), LOAD (in[2] + i), LOAD (in[3] + i)};
+        __m128i c4 = LOAD (in[4] + i), c5 = LOAD (in[5] + i);
+        __m128i lfe[2] = {_mm_unpacklo_epi32 (c4, c5), _mm_unpackhi_epi32 (c4, c5)};
+
+        interleave_transpose4_sse2 (f[0], f[1], f[2], f[3]);
+
+        uint32_t * o = out + 6 * i;
+        for (int k = 0; k < 4; k ++, o += 6)
+        {
+            __m128i rest = (k & 1) ? _mm_srli_si128 (lfe[k >> 1], 8) : lfe[k >> 1];
+            STORE (o, f[k]);
+            _mm_storel_epi64 ((__m128i *) (o + 4), rest);
+        }
+    }
+
+    return i;
+}
+
+static inline int interleave32_8_sse2 (const uint32_t * const * in, uint32_t * out, int i, int frames)
+{
+    for (; i + 4 <= frames; i += 4)
+    {
+        __m128i lo[4] = {LOAD (in[0] + i), LOAD (in[1] + i), LOAD (in[2] + i), LOAD (in[3] + i)};
+        __m128i hi[4] = {LOAD (in[4] + i), LOAD (in[5] + i), LOAD (in[6] + i), LOAD (in[7] + i)};
+
+        interleave_transpose4_sse2 (lo[0], lo[1], lo[2], lo[3]);
+        interleave_transpose4_sse2 (hi[0], hi[1], hi[2], hi[3]);
+
+        uint32_t * o = out + 8 * i;
+        for (int k = 0; k < 4; k ++, o += 8)
+        {
+            STORE (o, lo[k]);
+            STORE (o + 4, hi[k]);
+        }
+    }
+
+    return i;
+}
+
+static inline int interleave16_2_sse2 (const uint16_t * const * in, uint16_t * out, int i, int frames)
+{
+    for (; i + 8 <= frames; i += 8)
+    {
+        __m128i l = LOAD (in[0] + i), r = LOAD (in[1] + i);
+        STORE (out + 2 * i, _mm_unpacklo_epi16 (l, r));
+        STORE (out + 2 * i + 8, _mm_unpackhi_epi16 (l, r));
+    }
+
+    return i;
+}
+
+static inline int interleave16_8_sse2 (const uint16_t * const * in, uint16_t * out, int i, int frames)
+{
+    for (; i + 8 <= frames; i += 8)
+    {
+        __m128i c[8];
+        for (int k = 0; k < 8; k ++)
+            c[k] = LOAD (in[k] + i);
+
+        /* pairs of channels, then quads, then whole frames */
+        __m128i p[8], q[8];
+        for (int k = 0; k < 4; k ++)
+        {
+            p[k] = _mm_unpacklo_epi16 (c[2 * k], c[2 * k + 1]);      // frames 0-3
+            p[k + 4] = _mm_unpackhi_epi16 (c[2 * k], c[2 * k + 1]);  // frames 4-7
+        }
+        for (int h = 0; h < 8; h += 4)
+        {
+            q[h] = _mm_unpacklo_epi32 (p[h], p[h + 1]);      // ch 0-3, frames h, h+1
+            q[h + 1] = _mm_unpacklo_epi32 (p[h + 2], p[h + 3]);  // ch 4-7, frames h, h+1
+            q[h + 2] = _mm_unpackhi_epi32 (p[h], p[h + 1]);  // ch 0-3, frames h+2, h+3
+            q[h + 3] = _mm_unpackhi_epi32 (p[h + 2], p[h + 3]);  // ch 4-7, frames h+2, h+3
+        }
+
+        uint16_t * o = out + 8 * i;
+        for (int k = 0; k < 8; k += 2, o += 16)
+        {
+            STORE (o, _mm_unpacklo_epi64 (q[k], q[k + 1]));
+            STORE (o + 8, _mm_unpackhi_epi64 (q[k], q[k + 1]));
+        }
+    }
+
+    return i;
+}
+
+#undef LOAD
+#undef STORE
+
+#endif // __SSE2__
+
+/* ---- NEON ---- */
+
+#ifdef FFAUDIO_HAVE_NEON
+
+static inline void interleave_transpose4_neon (uint32x4_t & a, uint32x4_t & b, uint32x4_t & c, uint32x4_t & d)
+{
+    uint32x4x2_t ab = vtrnq_u32 (a, b), cd = vtrnq_u32 (c, d);
+
+    a = vcombine_u32 (vget_low_u32 (ab.val[0]), vget_low_u32 (cd.val[0]));
+    b = vcombine_u32 (vget_low_u32 (ab.val[1]), vget_low_u32 (cd.val[1]));
+    c = vcombine_u32 (vget_high_u32 (ab.val[0]), vget_high_u32 (cd.val[0]));
+    d = vcombine_u32 (vget_high_u32 (ab.val[1]), vget_high_u32 (cd.val[1]));
+}
+
+static inline int interleave32_2_neon (const uint32_t * const * in, uint32_t * out, int i, int frames)
+{
+    for (; i + 4 <= frames; i += 4)
+    {
+        uint32x4x2_t v = {{vld1q_u32 (in[0] + i), vld1q_u32 (in[1] + i)}};
+        vst2q_u32 (out + 2 * i, v);
+    }
+
+    return i;
+}
+
+static inline int interleave32_6_neon (const uint32_t * const * in, uint32_t * out, int i, int frames)
+{
+    for (; i + 4 <= frames; i += 4)
+    {
+        uint32x4_t f[4] = {vld1q_u32 (in[0] + i), vld1q_u32 (in[1] + i), vld1q_u32 (in[2] + i), vld1q_u32 (in[3] + i)};
+        uint32x4x2_t lfe = vzipq_u32 (vld1q_u32 (in[4] + i), vld1q_u32 (in[5] + i));
+
+        interleave_transpose4_neon (f[0], f[1], f[2], f[3]);
+
+        uint32_t * o = out + 6 * i;
+        for (int k = 0; k < 4; k ++, o += 6)
+        {
+            uint32x4_t v = lfe.val[k >> 1];
+            vst1q_u32 (o, f[k]);
+            vst1_u32 (o + 4, (k & 1) ? vget_high_u32 (v) : vget_low_u32 (v));
+        }
+    }
+
+    return i;
+}
+
+static inline int interleave32_8_neon (const uint32_t * const * in, uint32_t * out, int i, int frames)
+{
+    for (; i + 4 <= frames; i += 4)
+    {
+        uint32x4_t lo[4] = {vld1q_u32 (in[0] + i), vld1q_u32 (in[1] + i), vld1q_u32 (in[2] + i), vld1q_u32 (in[3] + i)};
+        uint32x4_t hi[4] = {vld1q_u32 (in[4] + i), vld1q_u32 (in[5] + i), vld1q_u32 (in[6] + i), vld1q_u32 (in[7] + i)};
+
+        interleave_transpose4_neon (lo[0], lo[1], lo[2], lo[3]);
+        interleave_transpose4_neon (hi[0], hi[1], hi[2], hi[3]);
+
+        uint32_t * o = out + 8 * i;
+        for (int k = 0; k < 4; k ++, o += 8)
+        {
+            vst1q_u32 (o, lo[k]);
+            vst1q_u32 (o + 4, hi[k]);
+        }
+    }
+
+    return i;
+}
+
+static inline int interleave16_2_neon (const uint16_t * const * in, uint16_t * out, int i, int frames)
+{
+    for (; i + 8 <= frames; i += 8)
+    {
+        uint16x8x2_t v = {{vld1q_u16 (in[0] + i), vld1q_u16 (in[1] + i)}};
+        vst2q_u16 (out + 2 * i, v);
+    }
+
+    return i;
+}
+
+#endif // FFAUDIO_HAVE_NEON
+
+/* ---- dispatch ---- */
+
+#if defined(__SSE2__)
+#define INTERLEAVE_KERNEL(name) name##_sse2
+#elif defined(FFAUDIO_HAVE_NEON)
+#define INTERLEAVE_KERNEL(name) name##_neon
+#endif
+
+/* Interleaves <frames> frames of planar audio in the given format (one plane
+ * per channel) into <out>. */
+static inline void interleave_planar (const void * const * planes, int format,
+ int channels, void * out, int frames)
+{
+    int width = FMT_SIZEOF (format);
+    int i = 0;
+
+    if (channels == 1)
+    {
+        memcpy (out, planes[0], (size_t) width * frames);
+        return;
+    }
+
+    if (width == 4)
+    {
+        auto in = (const uint32_t * const *) planes;
+        auto o = (uint32_t *) out;
+
+        switch (channels)
+        {
+        case 2:
+#ifdef INTERLEAVE_KERNEL
+            i = INTERLEAVE_KERNEL (interleave32_2) (in, o, i, frames);
+#endif
+            interleave_c<uint32_t, 2> (in, o, i, frames);
+            return;
+        case 6:
+#ifdef INTERLEAVE_KERNEL
+            i = INTERLEAVE_KERNEL (interleave32_6) (in, o, i, frames);
+#endif
+            interleave_c<uint32_t, 6> (in, o, i, frames);
+            return;
+        case 8:
+#ifdef INTERLEAVE_KERNEL
+            i = INTERLEAVE_KERNEL (interleave32_8) (in, o, i, frames);
+#endif
+            interleave_c<uint32_t, 8> (in, o, i, frames);
+            return;
+        }
+    }
+    else if (width == 2)
+    {
+        auto in = (const uint16_t * const *) planes;
+        auto o = (uint16_t *) out;
+
+        switch (channels)
+        {
+        case 2:
+#ifdef INTERLEAVE_KERNEL
+            i = INTERLEAVE_KERNEL (interleave16_2) (in, o, i, frames);
+#endif
+            interleave_c<uint16_t, 2> (in, o, i, frames);
+            return;
+        case 6:
+            interleave_c<uint16_t, 6> (in, o, i, frames);
+            return;
+        case 8:
+#ifdef __SSE2__
+            i = interleave16_8_sse2 (in, o, i, frames);
+#endif
+            interleave_c<uint16_t, 8> (in, o, i, frames);
+            return;
+        }
+    }
+
+    audio_interlace ((const void * *) planes, format, channels, out, frames);
+}
+
+#undef INTERLEAVE_KERNEL
+
+#endif
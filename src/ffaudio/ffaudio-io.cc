@@ -19,71 +19,341 @@
 #define WANT_VFS_STDIO_COMPAT
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
 #include "ffaudio-stdinc.h"
+#include <libfauxdcore/audstrings.h>
 #include <libfauxdcore/runtime.h>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #define IOBUF 4096
+#define TEEBUF (4 << 20)       /* bytes the save-video writer may fall behind */
+#define READAHEAD (1 << 20)    /* bytes to prefetch after seeking a mapped file */
+
+/* Echoes the video stream out to a file (optional).  Reads hand their data to
+ * a background thread, so a slow disk does not stall demuxing; only if the
+ * writer falls more than TEEBUF behind does the reader wait for it. */
+class TeeWriter
+{
+public:
+    bool open (const char * path)
+    {
+        if (! (m_file = ::fopen (path, "w")))
+            return false;
+
+        if (! m_buf)
+            m_buf = (unsigned char *) malloc (TEEBUF);
+
+        m_head = m_len = 0;
+        m_quit = false;
+
+        if (! m_buf || pthread_create (& m_thread, nullptr, run, this))
+        {
+            ::fclose (m_file);
+            m_file = nullptr;
+            return false;
+        }
+
+        return true;
+    }
+
+    bool is_open () const
+        { return m_file; }
+
+    void write (const unsigned char * data, int len)
+    {
+        pthread_mutex_lock (& m_mutex);
+
+        while (len > 0)
+        {
+            while (m_len == TEEBUF)
+                pthread_cond_wait (& m_cond, & m_mutex);
+
+            int tail = (m_head + m_len) % TEEBUF;
+            int copy = aud::min (len, aud::min (TEEBUF - m_len, TEEBUF - tail));
+
+            memcpy (m_buf + tail, data, copy);
+            m_len += copy;
+            data += copy;
+            len -= copy;
+
+            pthread_cond_broadcast (& m_cond);
+        }
+
+        pthread_mutex_unlock (& m_mutex);
+    }
+
+    void close ()
+    {
+        if (! m_file)
+            return;
+
+        pthread_mutex_lock (& m_mutex);
+        m_quit = true;
+        pthread_cond_broadcast (& m_cond);
+        pthread_mutex_unlock (& m_mutex);
+
+        pthread_join (m_thread, nullptr);
+
+        ::fclose (m_file);
+        m_file = nullptr;
 
-static FILE * m_savefile = NULL;    /* File to echo video stream out to (optional). */
+        free (m_buf);
+        m_buf = nullptr;
+    }
+
+private:
+    static void * run (void * me)
+    {
+        ((TeeWriter *) me)->write_loop ();
+        return nullptr;
+    }
+
+    void write_loop ()
+    {
+        pthread_mutex_lock (& m_mutex);
+
+        while (1)
+        {
+            while (! m_len && ! m_quit)
+                pthread_cond_wait (& m_cond, & m_mutex);
+
+            if (! m_len)
+                break;
+
+            /* the reader only appends past m_head + m_len, so this part is
+             * ours until we hand it back */
+            int head = m_head;
+            int len = aud::min (m_len, TEEBUF - m_head);
+
+            pthread_mutex_unlock (& m_mutex);
+            ::fwrite (m_buf + head, len, 1, m_file);
+            pthread_mutex_lock (& m_mutex);
+
+            m_head = (m_head + len) % TEEBUF;
+            m_len -= len;
+            pthread_cond_broadcast (& m_cond);
+        }
+
+        pthread_mutex_unlock (& m_mutex);
+    }
+
+    FILE * m_file = nullptr;
+    pthread_t m_thread;
+    pthread_mutex_t m_mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t m_cond = PTHREAD_COND_INITIALIZER;
+    bool m_quit = false;
+
+    unsigned char * m_buf = nullptr;
+    int m_head = 0, m_len = 0;
+};
 
-static int read_cb (void * file, unsigned char * buf, int size)
+/* What the AVIOContext reads from: either the VFSFile, or (for local files,
+ * if enabled) a read-only mapping of the whole file.  Only the context that
+ * playback reads through records to the save-video file. */
+struct IOSource
 {
-    int res = ((VFSFile *) file)->fread (buf, 1, size);
-    if (m_savefile && res > 0)
-        ::fwrite (buf, res, 1, m_savefile);
+    VFSFile * file;
+    const unsigned char * map = nullptr;
+    int64_t map_size = 0;
+    int64_t pos = 0;
+    TeeWriter savefile;
+};
+
+static int read_cb (void * opaque, unsigned char * buf, int size)
+{
+    IOSource * src = (IOSource *) opaque;
+    int res;
+
+    if (src->map)
+    {
+        res = (int) aud::min ((int64_t) size, src->map_size - src->pos);
+        if (res > 0)
+        {
+            memcpy (buf, src->map + src->pos, res);
+            src->pos += res;
+        }
+    }
+    else
+        res = src->file->fread (buf, 1, size);
+
+    if (src->savefile.is_open () && res > 0)
+        src->savefile.write (buf, res);
+
     return (res > 0) ? res : AVERROR_EOF;
 }
 
-static int64_t seek_cb (void * file, int64_t offset, int whence)
+static int64_t seek_cb (void * opaque, int64_t offset, int whence)
 {
+    IOSource * src = (IOSource *) opaque;
+
+    if (! src->map)
+    {
+        if (whence == AVSEEK_SIZE)
+            return src->file->fsize ();
+        if (src->savefile.is_open () || src->file->fseek (offset, to_vfs_seek_type (whence & ~(int) AVSEEK_FORCE)))
+            return -1;
+        return src->file->ftell ();
+    }
+
     if (whence == AVSEEK_SIZE)
-        return ((VFSFile *) file)->fsize ();
-    if (m_savefile || ((VFSFile *) file)->fseek (offset, to_vfs_seek_type (whence & ~(int) AVSEEK_FORCE)))
+        return src->map_size;
+    if (src->savefile.is_open ())
+        return -1;
+
+    switch (whence & ~(int) AVSEEK_FORCE)
+    {
+        case SEEK_SET: break;
+        case SEEK_CUR: offset += src->pos; break;
+        case SEEK_END: offset += src->map_size; break;
+        default: return -1;
+    }
+
+    if (offset < 0 || offset > src->map_size)
         return -1;
-    return ((VFSFile *) file)->ftell ();
+
+    src->pos = offset;
+
+#ifndef _WIN32
+    /* sequential readahead is lost after a jump; prefetch from the new spot */
+    int64_t page = sysconf (_SC_PAGESIZE);
+    int64_t start = offset - offset % page;
+    madvise ((void *) (src->map + start), aud::min ((int64_t) READAHEAD, src->map_size - start), MADV_WILLNEED);
+#endif
+
+    return offset;
 }
 
-AVIOContext * io_context_new (VFSFile & file)
+#ifndef _WIN32
+static bool map_local_file (IOSource * src)
 {
-    void * buf = av_malloc (IOBUF);
-    if (aud_get_bool ("ffaudio", "save_video"))
+    const char * uri = src->file->filename ();
+    if (! uri || strncmp (uri, "file://", 7) || ! aud_get_bool ("ffaudio", "io_mmap"))
+        return false;
+
+    StringBuf path = uri_to_filename (uri);
+    if (! path)
+        return false;
+
+    int fd = ::open (path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    void * map = MAP_FAILED;
+
+    if (! fstat (fd, & st) && S_ISREG (st.st_mode) && st.st_size > 0 &&
+     (uint64_t) st.st_size <= (uint64_t) SIZE_MAX)
+        map = mmap (nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    ::close (fd);  // the mapping stays valid
+
+    if (map == MAP_FAILED)
     {
-        String save_video_file = aud_get_str ("ffaudio", "save_video_file");
-        if (! save_video_file[0])
+        AUDDBG ("Could not map %s, reading it instead.\n", (const char *) path);
+        return false;
+    }
+
+    madvise (map, st.st_size, MADV_SEQUENTIAL);
+
+    src->map = (const unsigned char *) map;
+    src->map_size = st.st_size;
+    src->pos = src->file->ftell ();  // probing may have read ahead already
+    if (src->pos < 0 || src->pos > src->map_size)
+        src->pos = 0;
+
+    return true;
+}
+#endif
+
+static void open_savefile (IOSource * src)
+{
+    if (! aud_get_bool ("ffaudio", "save_video"))
+        return;
+
+    String save_video_file = aud_get_str ("ffaudio", "save_video_file");
+    if (! save_video_file[0])
 #ifdef _WIN32
-            save_video_file = String ("C:\\Temp\\lastvideo");
+        save_video_file = String ("C:\\Temp\\lastvideo");
 #else
-            save_video_file = String ("/tmp/lastvideo");
+        save_video_file = String ("/tmp/lastvideo");
 #endif
-        m_savefile = ::fopen ((const char *)save_video_file, "w");
-    }
-    return avio_alloc_context ((unsigned char *) buf, IOBUF, 0, & file, read_cb, nullptr, seek_cb);
+    if (! src->savefile.open (save_video_file))
+        AUDERR ("Could not open %s for recording.\n", (const char *) save_video_file);
 }
 
-AVIOContext * io_context_new2 (VFSFile & file)
+static AVIOContext * new_context (VFSFile & file, bool seekable, bool playing)
 {
-    void * buf = av_malloc (IOBUF);
-    if (aud_get_bool ("ffaudio", "save_video"))
+    IOSource * src = new IOSource;
+    src->file = & file;
+
+    /* local files get a much larger buffer (and are optionally mapped), so
+     * demuxing big containers doesn't turn into thousands of tiny reads;
+     * streams keep the small one so playback starts without a long fill */
+    int bufsize = IOBUF;
+    const char * uri = file.filename ();
+
+    if (uri && ! strncmp (uri, "file://", 7))
     {
-        String save_video_file = aud_get_str ("ffaudio", "save_video_file");
-        if (! save_video_file[0])
-#ifdef _WIN32
-            save_video_file = String ("C:\\Temp\\lastvideo");
-#else
-            save_video_file = String ("/tmp/lastvideo");
+        bufsize = aud::clamp (aud_get_int ("ffaudio", "io_buffer_kb"), 4, 16384) * 1024;
+#ifndef _WIN32
+        map_local_file (src);
+#endif
+    }
+
+    void * buf = av_malloc (bufsize);
+    if (playing)
+        open_savefile (src);
+
+    AVIOContext * io = avio_alloc_context ((unsigned char *) buf, bufsize, 0, src,
+     read_cb, nullptr, seekable ? seek_cb : nullptr);
+
+    if (! io)
+    {
+        av_free (buf);
+        src->savefile.close ();
+#ifndef _WIN32
+        if (src->map)
+            munmap ((void *) src->map, src->map_size);
 #endif
-        m_savefile = ::fopen ((const char *)save_video_file, "w");
+        delete src;
     }
-    return avio_alloc_context ((unsigned char *) buf, IOBUF, 0, & file, read_cb, nullptr, nullptr);
+
+    return io;
+}
+
+AVIOContext * io_context_new (VFSFile & file, bool playing)
+{
+    return new_context (file, true, playing);
+}
+
+AVIOContext * io_context_new2 (VFSFile & file, bool playing)
+{
+    return new_context (file, false, playing);
 }
 
 void io_context_free (AVIOContext * io)
 {
-    if (m_savefile)
+    IOSource * src = (IOSource *) io->opaque;
+
+    src->savefile.close ();
+
+#ifndef _WIN32
+    if (src->map)
     {
-        ::fclose (m_savefile);
-        m_savefile = nullptr;
+        /* leave the VFSFile where a plain read would have left it */
+        src->file->fseek (src->pos, VFS_SEEK_SET);
+        munmap ((void *) src->map, src->map_size);
     }
+#endif
+
+    delete src;
     av_free (io->buffer);
     av_free (io);
 }
@@ -0,0 +1,210 @@
+/*
+ * ffaudio-probecache.cc
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+/* Remembers which demuxer content probing picked for a file, so that files
+ * without a usable extension (streams, stdin://, podcast URLs) are probed only
+ * once.  Local files are keyed by URI, size and modification time; anything
+ * else by URI plus a hash of its first block, which has to be read anyway for
+ * probing.  The most recently used entries are kept in memory and written to
+ * the user's config directory on shutdown. */
+
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "ffaudio-stdinc.h"
+#include <libfauxdcore/audstrings.h>
+#include <libfauxdcore/index.h>
+#include <libfauxdcore/multihash.h>
+#include <libfauxdcore/runtime.h>
+
+#include "../cache-common/cache-files.h"
+
+#define CACHE_NAME "ffaudio-probe-cache"
+
+struct CacheEntry {
+    String demuxer;
+    int64_t used;  /* larger = more recently used */
+};
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static SimpleHash<String, CacheEntry> cache;
+static int64_t cache_clock = 0;
+static bool cache_loaded = false, cache_dirty = false;
+
+static int cache_limit ()
+{
+    return aud::max (aud_get_int ("ffaudio", "probe_cache_size"), 0);
+}
+
+/* call with cache_mutex held */
+static void trim_cache (int limit)
+{
+    while (cache.n_items () > limit)
+    {
+        const String * oldest = nullptr;
+        int64_t oldest_used = 0;
+
+        cache.iterate ([& oldest, & oldest_used] (const String & key, CacheEntry & entry) {
+            if (! oldest || entry.used < oldest_used)
+            {
+                oldest = & key;
+                oldest_used = entry.used;
+            }
+        });
+
+        cache.remove (String (* oldest));
+    }
+}
+
+/* call with cache_mutex held; lines are "demuxer<TAB>key", oldest first */
+static void load_cache ()
+{
+    cache_loaded = true;
+
+    VFSFile file (filename_to_uri (cache_path (CACHE_NAME)), "r");
+    if (! file)
+        return;
+
+    Index<char> data = file.read_all ();
+    data.append (0);
+
+    for (const String & line : str_list_to_index (data.begin (), "\n"))
+    {
+        const char * tab = strchr (line, '\t');
+        if (! tab || tab == line || ! tab[1])
+            continue;
+
+        cache.add (String (tab + 1), {String (str_copy (line, tab - line)), ++ cache_clock});
+    }
+
+    trim_cache (cache_limit ());
+    AUDDBG ("Loaded %d probe cache entries.\n", cache.n_items ());
+}
+
+String probe_cache_file_key (const char * name)
+{
+    if (strncmp (name, "file://", 7))
+        return String ();
+
+    StringBuf path = uri_to_filename (name);
+    struct stat st;
+
+    if (! path || stat (path, & st) < 0)
+        return String ();
+
+    return String (str_printf ("file\t%s\t%lld\t%lld", name,
+     (long long) st.st_size, (long long) st.st_mtime));
+}
+
+String probe_cache_data_key (const char * name, const void * data, int len)
+{
+    /* together with the URI and length, plenty to tell files apart */
+    uint64_t hash = cache_hash (data, len);
+
+    /* stdin:// says nothing about what is behind it, so go by content alone */
+    if (! strncmp (name, "stdin://", 8))
+        name = "stdin://";
+
+    return String (str_printf ("data\t%s\t%d\t%016llx", name, len, (unsigned long long) hash));
+}
+
+AVInputFormat * probe_cache_lookup (const char * key)
+{
+    if (! key || ! cache_limit ())
+        return nullptr;
+
+    AVInputFormat * f = nullptr;
+    pthread_mutex_lock (& cache_mutex);
+
+    if (! cache_loaded)
+        load_cache ();
+
+    CacheEntry * entry = cache.lookup (String (key));
+    if (entry)
+    {
+        f = (AVInputFormat *) av_find_input_format (entry->demuxer);
+        if (f)
+            entry->used = ++ cache_clock;
+        else  /* demuxer went away with an FFmpeg upgrade */
+        {
+            cache.remove (String (key));
+            cache_dirty = true;
+        }
+    }
+
+    pthread_mutex_unlock (& cache_mutex);
+    return f;
+}
+
+void probe_cache_add (const char * key, AVInputFormat * f)
+{
+    int limit = cache_limit ();
+    if (! key || ! f || ! limit)
+        return;
+
+    pthread_mutex_lock (& cache_mutex);
+
+    if (! cache_loaded)
+        load_cache ();
+
+    cache.add (String (key), {String (f->name), ++ cache_clock});
+    trim_cache (limit);
+    cache_dirty = true;
+
+    pthread_mutex_unlock (& cache_mutex);
+}
+
+void probe_cache_save ()
+{
+    pthread_mutex_lock (& cache_mutex);
+
+    if (cache_dirty)
+    {
+        struct Line {
+            String text;
+            int64_t used;
+        };
+
+        Index<Line> lines;
+
+        trim_cache (cache_limit ());
+        cache.iterate ([& lines] (const String & key, CacheEntry & entry) {
+            lines.append (Line {String (str_concat ({entry.demuxer, "\t", key, "\n"})), entry.used});
+        });
+
+        lines.sort ([] (const Line & a, const Line & b)
+            { return (a.used < b.used) ? -1 : (a.used > b.used); });
+
+        VFSFile file (filename_to_uri (cache_path (CACHE_NAME)), "w");
+        if (file)
+        {
+            for (const Line & line : lines)
+                file.fwrite (line.text, 1, strlen (line.text));
+        }
+        else
+            AUDERR ("Could not write %s.\n", (const char *) cache_path (CACHE_NAME));
+
+        cache_dirty = false;
+    }
+
+    cache.clear ();
+    cache_loaded = false;
+
+    pthread_mutex_unlock (& cache_mutex);
+}
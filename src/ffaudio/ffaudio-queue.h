@@ -0,0 +1,200 @@
+/*
+ * Fauxdacious FFaudio Plugin - packet queues
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef __FFAUDIO_QUEUE_H__GUARD
+#define __FFAUDIO_QUEUE_H__GUARD
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <atomic>
+
+#include "ffaudio-stdinc.h"
+
+/*
+ * Queue carrying demuxed packets from the reader thread to a consumer (the
+ * playback thread, or a decoder thread of its own).  It is a bounded
+ * single-producer/single-consumer ring: only the reader pushes and only the
+ * consumer peeks and pops, so neither side ever takes a lock.  Positions are
+ * free-running counters; the slot is the position modulo the capacity.
+ *
+ * Packets are not freed during playback.  The consumer unreferences each
+ * packet it is done with but leaves it in its slot, and when the reader next
+ * pushes into that slot it gets the empty packet back in exchange, to read
+ * into next.  New packets are allocated only during the first lap.
+ *
+ * Besides the packet count, a queue is "full" once it holds more than a given
+ * number of bytes or a given play time, so that high-bitrate video does not
+ * balloon memory and low-bitrate audio still buffers a useful amount.
+ *
+ * A seek bumps the queue's serial number.  The reader tags every packet with
+ * the serial current at the time it was read, and packets read before the
+ * seek are dropped by the consumer instead of being played.
+ */
+
+class PacketQueue
+{
+public:
+    PacketQueue (int capacity, int64_t max_bytes, int64_t max_usec, AVRational time_base) :
+        m_capacity (capacity),
+        m_max_bytes (max_bytes),
+        m_max_usec (max_usec),
+        m_time_base (time_base),
+        m_ring ((Entry *) calloc (capacity, sizeof (Entry))) {}
+
+    ~PacketQueue ()
+    {
+        for (int i = 0; i < m_capacity; i ++)
+            av_packet_free (& m_ring[i].pkt);
+
+        free (m_ring);
+    }
+
+    int capacity () const
+        { return m_capacity; }
+
+    /* number of packets queued (may include stale ones not yet dropped) */
+    int size () const
+    {
+        return (int) (m_write_pos.load (std::memory_order_acquire) -
+         m_read_pos.load (std::memory_order_acquire));
+    }
+
+    /* reader side: must be sampled under the same lock as the seek */
+    int serial () const
+        { return m_serial.load (std::memory_order_acquire); }
+
+    /* reader side: true if the reader should hold off pushing for now */
+    bool full () const
+    {
+        int n = size ();
+        if (n >= m_capacity)
+            return true;
+
+        /* always allow a couple of packets, however large */
+        if (n < 2)
+            return false;
+
+        return (m_max_bytes > 0 && m_bytes.load (std::memory_order_relaxed) >= m_max_bytes) ||
+         (m_max_usec > 0 && m_usec.load (std::memory_order_relaxed) >= m_max_usec);
+    }
+
+    /* reader side: queues the packet unless the ring is full; on success,
+     * pkt is swapped for a recycled empty packet (nullptr on the first lap) */
+    bool push (AVPacket * & pkt, int serial)
+    {
+        unsigned w = m_write_pos.load (std::memory_order_relaxed);
+        if (w - m_read_pos.load (std::memory_order_acquire) >= (unsigned) m_capacity)
+            return false;
+
+        Entry & e = m_ring[w % m_capacity];
+        AVPacket * empty = e.pkt;
+
+        e.pkt = pkt;
+        e.serial = serial;
+        e.bytes = pkt->size;
+        e.usec = (pkt->duration > 0) ? av_rescale_q (pkt->duration, m_time_base, av_get_time_base_q ()) : 0;
+
+        m_bytes.fetch_add (e.bytes, std::memory_order_relaxed);
+        m_usec.fetch_add (e.usec, std::memory_order_relaxed);
+        m_write_pos.store (w + 1, std::memory_order_release);
+
+        pkt = empty;
+        return true;
+    }
+
+    /* consumer side: returns the next current packet, or nullptr if none
+     * (optionally also the serial it was read under) */
+    AVPacket * peek (int * pkt_serial = nullptr)
+    {
+        int serial = m_serial.load (std::memory_order_acquire);
+        unsigned r = m_read_pos.load (std::memory_order_relaxed);
+
+        while (r != m_write_pos.load (std::memory_order_acquire))
+        {
+            Entry & e = m_ring[r % m_capacity];
+            if (e.serial == serial)
+            {
+                if (pkt_serial)
+                    * pkt_serial = serial;
+                return e.pkt;
+            }
+
+            release (e);  // read before the last seek
+            m_read_pos.store (++ r, std::memory_order_release);
+        }
+
+        return nullptr;
+    }
+
+    /* consumer side: recycles the packet returned by peek () */
+    void pop ()
+    {
+        unsigned r = m_read_pos.load (std::memory_order_relaxed);
+        if (r == m_write_pos.load (std::memory_order_acquire))
+            return;
+
+        release (m_ring[r % m_capacity]);
+        m_read_pos.store (r + 1, std::memory_order_release);
+    }
+
+    /* any thread: marks everything queued so far, and anything still in
+     * flight from before the call, as stale; peek () will skip it */
+    void invalidate ()
+        { m_serial.fetch_add (1, std::memory_order_acq_rel); }
+
+    /* consumer side: invalidate () and drop the stale packets right away */
+    void flush ()
+    {
+        invalidate ();
+
+        unsigned r = m_read_pos.load (std::memory_order_relaxed);
+        unsigned w = m_write_pos.load (std::memory_order_acquire);
+
+        for (; r != w; r ++)
+            release (m_ring[r % m_capacity]);
+
+        m_read_pos.store (r, std::memory_order_release);
+    }
+
+private:
+    struct Entry {
+        AVPacket * pkt;
+        int serial;
+        int bytes;
+        int64_t usec;
+    };
+
+    void release (Entry & e)
+    {
+        m_bytes.fetch_sub (e.bytes, std::memory_order_relaxed);
+        m_usec.fetch_sub (e.usec, std::memory_order_relaxed);
+        av_packet_unref (e.pkt);
+    }
+
+    const int m_capacity;
+    const int64_t m_max_bytes, m_max_usec;
+    const AVRational m_time_base;
+    Entry * m_ring;
+
+    std::atomic<unsigned> m_read_pos {0}, m_write_pos {0};
+    std::atomic<int> m_serial {0};
+    std::atomic<int64_t> m_bytes {0}, m_usec {0};
+};
+
+#endif
@@ -42,8 +42,14 @@ extern "C" {
 #error Please define either HAVE_FFMPEG or HAVE_LIBAV
 #endif
 
-AVIOContext * io_context_new (VFSFile & file);
-AVIOContext * io_context_new2 (VFSFile & file);
+AVIOContext * io_context_new (VFSFile & file, bool playing = false);
+AVIOContext * io_context_new2 (VFSFile & file, bool playing = false);
 void io_context_free (AVIOContext * context);
 
+String probe_cache_file_key (const char * name);
+String probe_cache_data_key (const char * name, const void * data, int len);
+AVInputFormat * probe_cache_lookup (const char * key);
+void probe_cache_add (const char * key, AVInputFormat * f);
+void probe_cache_save ();
+
 #endif
@@ -0,0 +1,336 @@
+/*
+ * Fauxdacious FFaudio Plugin - video decoder thread
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef __FFAUDIO_VIDEO_H__GUARD
+#define __FFAUDIO_VIDEO_H__GUARD
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <atomic>
+
+#include "ffaudio-stdinc.h"
+#include "ffaudio-queue.h"
+
+/*
+ * Decodes a video stream on its own thread, so that neither decoding nor
+ * presenting video ever holds up the audio writes.
+ *
+ * The decoder thread is the consumer of the video PacketQueue.  Decoded
+ * frames go into a small ring of AVFrames (again single-producer/single-
+ * consumer), each tagged with its presentation time in milliseconds from the
+ * start of the stream.  The playback thread, which owns the SDL renderer,
+ * asks for the frame that is due at the current audio clock (as returned by
+ * aud_drct_get_time ()), shows it and pops it.  Frames that have been
+ * overtaken by a later due frame are dropped without being shown, so video
+ * catches up instead of drifting when decoding or rendering falls behind.
+ *
+ * Nothing here depends on FFaudio itself, so other input plugins that demux
+ * with libavformat (i.e. dvd-ng) can drive it the same way.
+ */
+
+class VideoDecoder
+{
+public:
+    /* frames due this close to the clock are shown now rather than next time */
+    static constexpr int present_lead_ms = 10;
+    /* frames stamped further ahead than this are assumed to have bogus
+     * timestamps and are shown right away rather than stalling the stream */
+    static constexpr int max_lead_ms = 1000;
+
+    VideoDecoder (AVCodecContext * context, AVRational time_base,
+     int64_t start_time, PacketQueue & packets, int max_frames = 4) :
+        m_context (context),
+        m_time_base (time_base),
+        m_start_ms ((start_time == AV_NOPTS_VALUE) ? 0 : start_time / (AV_TIME_BASE / 1000)),
+        m_packets (packets),
+        m_max_frames (max_frames),
+        m_slots ((Slot *) calloc (max_frames, sizeof (Slot)))
+    {
+        for (int i = 0; i < m_max_frames; i ++)
+            m_slots[i].frame = av_frame_alloc ();
+    }
+
+    ~VideoDecoder ()
+    {
+        stop ();
+
+#if ! CHECK_LIBAVCODEC_VERSION (57, 37, 100, 57, 16, 0)
+        av_packet_free (& m_pending);
+#endif
+
+        for (int i = 0; i < m_max_frames; i ++)
+            av_frame_free (& m_slots[i].frame);
+
+        free (m_slots);
+    }
+
+    bool start ()
+    {
+        for (int i = 0; i < m_max_frames; i ++)
+        {
+            if (! m_slots[i].frame)
+                return false;
+        }
+
+        m_quit = false;
+        m_running = ! pthread_create (& m_thread, nullptr, run, this);
+        return m_running;
+    }
+
+    void stop ()
+    {
+        if (! m_running)
+            return;
+
+        m_quit = true;
+        pthread_join (m_thread, nullptr);
+        m_running = false;
+    }
+
+    /* playback thread: returns the frame to show at the given clock, or
+     * nullptr if none is due yet; call pop () once it has been shown */
+    AVFrame * due_frame (int clock_ms)
+    {
+        int serial = m_packets.serial ();
+
+        for (;;)
+        {
+            unsigned r = m_read_pos.load (std::memory_order_relaxed);
+            unsigned w = m_write_pos.load (std::memory_order_acquire);
+
+            if (r == w)
+                return nullptr;
+
+            Slot & slot = m_slots[r % m_max_frames];
+
+            if (slot.serial != serial)  // decoded before the last seek
+            {
+                pop ();
+                continue;
+            }
+
+            int64_t pts = (slot.pts_ms == AV_NOPTS_VALUE) ? clock_ms : slot.pts_ms;
+
+            if (pts > clock_ms + present_lead_ms && pts < clock_ms + max_lead_ms)
+                return nullptr;
+
+            if (r + 1 != w)
+            {
+                Slot & next = m_slots[(r + 1) % m_max_frames];
+
+                if (next.serial == serial && next.pts_ms != AV_NOPTS_VALUE &&
+                 next.pts_ms <= clock_ms + present_lead_ms)
+                {
+                    m_dropped ++;
+                    pop ();
+                    continue;
+                }
+            }
+
+            return slot.frame;
+        }
+    }
+
+    /* playback thread: releases the frame returned by due_frame () */
+    void pop ()
+    {
+        unsigned r = m_read_pos.load (std::memory_order_relaxed);
+        if (r == m_write_pos.load (std::memory_order_acquire))
+            return;
+
+        av_frame_unref (m_slots[r % m_max_frames].frame);
+        m_read_pos.store (r + 1, std::memory_order_release);
+    }
+
+    /* playback thread: no more packets are coming, decode what is left */
+    void drain ()
+        { m_draining.store (true, std::memory_order_release); }
+
+    /* playback thread: true once drained and every frame has been taken */
+    bool finished () const
+    {
+        return m_eof.load (std::memory_order_acquire) &&
+         m_read_pos.load (std::memory_order_relaxed) == m_write_pos.load (std::memory_order_acquire);
+    }
+
+    int dropped () const
+        { return m_dropped; }
+
+private:
+    struct Slot {
+        AVFrame * frame;
+        int64_t pts_ms;
+        int serial;
+    };
+
+    static void * run (void * me)
+    {
+        ((VideoDecoder *) me)->decode_loop ();
+        return nullptr;
+    }
+
+    static void idle ()
+    {
+        struct timespec ts = {0, 2000000};  // 2 ms
+        nanosleep (& ts, nullptr);
+    }
+
+    void decode_loop ()
+    {
+        int serial = m_packets.serial ();
+        bool sent_eof = false;
+
+        while (! m_quit)
+        {
+            unsigned w = m_write_pos.load (std::memory_order_relaxed);
+            if (w - m_read_pos.load (std::memory_order_acquire) >= (unsigned) m_max_frames)
+            {
+                idle ();  // presentation is behind the decoder, which is fine
+                continue;
+            }
+
+            Slot & slot = m_slots[w % m_max_frames];
+            int ret = receive (slot.frame);
+
+            if (ret == 0)
+            {
+                int64_t ts = slot.frame->best_effort_timestamp;
+                if (ts == AV_NOPTS_VALUE)
+                    ts = slot.frame->pts;
+
+                slot.pts_ms = (ts == AV_NOPTS_VALUE) ? AV_NOPTS_VALUE :
+                 av_rescale_q (ts, m_time_base, {1, 1000}) - m_start_ms;
+                slot.serial = serial;
+
+                m_write_pos.store (w + 1, std::memory_order_release);
+                continue;
+            }
+
+            if (ret == AVERROR_EOF)
+            {
+                m_eof.store (true, std::memory_order_release);
+                idle ();
+                continue;
+            }
+
+            /* decoder wants more input */
+            int pkt_serial;
+            AVPacket * pkt = m_packets.peek (& pkt_serial);
+
+            if (pkt && pkt_serial != serial)
+            {
+                /* first packet after a seek: forget the old reference frames */
+                avcodec_flush_buffers (m_context);
+                serial = pkt_serial;
+            }
+
+            if (pkt)
+            {
+                if (send (pkt) != AVERROR (EAGAIN))
+                    m_packets.pop ();
+            }
+            else if (m_draining.load (std::memory_order_acquire) && ! sent_eof)
+            {
+                send (nullptr);
+                sent_eof = true;
+            }
+            else
+                idle ();
+        }
+    }
+
+#if CHECK_LIBAVCODEC_VERSION (57, 37, 100, 57, 16, 0)
+    int send (AVPacket * pkt)
+        { return avcodec_send_packet (m_context, pkt); }
+
+    int receive (AVFrame * frame)
+    {
+        int ret = avcodec_receive_frame (m_context, frame);
+        return (ret == 0 || ret == AVERROR_EOF) ? ret : AVERROR (EAGAIN);
+    }
+#else
+    /* older libavcodec: emulate send/receive on top of avcodec_decode_video2 (),
+     * decoding from our own reference so the queued packet can be recycled */
+    int send (AVPacket * pkt)
+    {
+        if (! m_pending && ! (m_pending = av_packet_alloc ()))
+            return AVERROR (ENOMEM);
+
+        av_packet_unref (m_pending);
+        if (pkt && av_packet_ref (m_pending, pkt) < 0)
+            return AVERROR (ENOMEM);
+
+        m_flushing = ! pkt;
+        m_have_input = true;
+        return 0;
+    }
+
+    int receive (AVFrame * frame)
+    {
+        while (m_have_input)
+        {
+            int got = 0;
+            int len = avcodec_decode_video2 (m_context, frame, & got, m_pending);
+
+            if (got)
+            {
+                if (! m_flushing && len > 0)
+                {
+                    m_pending->size -= len;
+                    m_pending->data += len;
+                    m_have_input = (m_pending->size > 0);
+                }
+
+                return 0;
+            }
+
+            if (m_flushing)
+            {
+                m_have_input = false;
+                return AVERROR_EOF;
+            }
+
+            if (len < 0 || (m_pending->size -= len, m_pending->data += len, m_pending->size <= 0))
+                m_have_input = false;
+        }
+
+        return AVERROR (EAGAIN);
+    }
+
+    AVPacket * m_pending = nullptr;
+    bool m_have_input = false, m_flushing = false;
+#endif
+
+    AVCodecContext * m_context;
+    const AVRational m_time_base;
+    const int64_t m_start_ms;
+    PacketQueue & m_packets;
+
+    const int m_max_frames;
+    Slot * m_slots;
+    std::atomic<unsigned> m_read_pos {0}, m_write_pos {0};
+
+    pthread_t m_thread;
+    bool m_running = false;
+    std::atomic<bool> m_quit {false}, m_draining {false}, m_eof {false};
+    int m_dropped = 0;  // only touched by the playback thread
+};
+
+#endif
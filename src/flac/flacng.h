@@ -23,6 +23,8 @@
 #include <FLAC/all.h>
 
 #include <libfauxdcore/i18n.h>
+#include <libfauxdcore/index.h>
+#include <libfauxdcore/objects.h>
 #include <libfauxdcore/plugin.h>
 
 class FLACng : public InputPlugin
@@ -55,8 +57,8 @@ public:
 #define BUFFER_SIZE_SAMP (FLAC__MAX_BLOCK_SIZE * FLAC__MAX_CHANNELS)
 #define BUFFER_SIZE_BYTE (BUFFER_SIZE_SAMP * (FLAC__MAX_BITS_PER_SAMPLE/8))
 
-#define SAMPLE_SIZE(a) (a == 8 ? 1 : (a == 16 ? 2 : 4))
-#define SAMPLE_FMT(a) (a == 8 ? FMT_S8 : (a == 16 ? FMT_S16_NE : (a == 24 ? FMT_S24_NE : FMT_S32_NE)))
+#define SAMPLE_SIZE(a) (a == 8 ? 1 : (a == 16 ? 2 : (a == 24 ? 3 : 4)))
+#define SAMPLE_FMT(a) (a == 8 ? FMT_S8 : (a == 16 ? FMT_S16_NE : (a == 24 ? FMT_S24_3LE : FMT_S32_NE)))
 
 struct callback_info
 {
@@ -64,15 +66,21 @@ struct callback_info
     unsigned sample_rate = 0;
     unsigned channels = 0;
     unsigned long total_samples = 0;
-    Index<int32_t> output_buffer;
-    int32_t *write_pointer = nullptr;
-    unsigned buffer_used = 0;
+    Index<char> output_buffer;  /* already in SAMPLE_FMT(bits_per_sample) */
+    char *write_pointer = nullptr;
+    unsigned buffer_used = 0;     /* bytes */
     VFSFile *fd = nullptr;
     int bitrate = 0;
+    FLAC__byte md5[16] = {0};
+    bool has_seektable = false;
+    int64_t skip_to = -1;         /* drop decoded samples before this one */
+    int64_t check_sample = -1;    /* the next frame should start here */
+    int64_t frame_sample = 0;     /* first sample of the last frame decoded */
+    unsigned frames_decoded = 0;
 
     void alloc()
     {
-        output_buffer.resize(BUFFER_SIZE_SAMP);
+        output_buffer.resize(BUFFER_SIZE_BYTE);
         reset();
     }
 
@@ -83,6 +91,34 @@ struct callback_info
     }
 };
 
+/* seektable.c: frame offsets noted during playback, for files without a
+ * SEEKTABLE */
+class SeekCache
+{
+public:
+    /* false if the file can't be cached (no MD5 in STREAMINFO); <audio_start>
+     * is where the first frame is, <audio_end> the file size */
+    bool load(const FLAC__byte md5[16], unsigned sample_rate, int64_t audio_start,
+     int64_t audio_end);
+    void add(int64_t sample, int64_t offset);
+    bool find(int64_t sample, int64_t &frame_sample, int64_t &offset) const;
+    void forget();
+    void save();
+
+private:
+    struct Point {
+        int64_t sample, offset;
+    };
+
+    int search(int64_t sample) const;
+
+    Index<Point> m_points;
+    String m_uri;
+    unsigned m_rate = 0;
+    int64_t m_base = 0;  /* offsets are kept relative to the first frame */
+    bool m_changed = false;
+};
+
 /* metadata.c */
 bool flac_update_song_tuple(const char *filename, VFSFile &fd, const Tuple &tuple);
 Index<char> flac_get_image(const char *filename, VFSFile &fd);
@@ -101,4 +137,7 @@ void metadata_callback(const FLAC__StreamDecoder *decoder, const FLAC__StreamMet
 /* tools.c */
 bool read_metadata(FLAC__StreamDecoder* decoder, callback_info* info);
 
+/* pack.c */
+void pack_samples(const int32_t *const *in, unsigned channels, unsigned frames, unsigned bits, void *out);
+
 #endif
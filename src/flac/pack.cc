@@ -0,0 +1,204 @@
+/*
+ * Sample packing for the FLAC plugin
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+/*
+ * Interleaves the decoder's per-channel int32 blocks straight into the sample
+ * format handed to write_audio(): S8, S16, packed S24 or S32.  The scalar
+ * loops are instantiated per channel count, so the inner loop is fully
+ * unrolled; stereo 16 and 32 bit, by far the most common, also have SSE2 and
+ * NEON versions.  Like the other kernels, the SIMD ones take the starting
+ * frame and return the first frame they did not do.
+ */
+
+#include <stdint.h>
+
+#include <libfauxdcore/runtime.h>
+
+#include "flacng.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HAVE_NEON
+#endif
+
+template<class T, int C>
+static void pack_c(const int32_t *const *in, T *out, unsigned i, unsigned frames)
+{
+    for (; i < frames; i++)
+        for (int c = 0; c < C; c++)
+            out[i * C + c] = in[c][i];
+}
+
+/* always little endian, whatever the host (see SAMPLE_FMT) */
+template<int C>
+static void pack24_c(const int32_t *const *in, uint8_t *out, unsigned i, unsigned frames)
+{
+    for (uint8_t *p = out + i * 3 * C; i < frames; i++)
+    {
+        for (int c = 0; c < C; c++, p += 3)
+        {
+            int32_t s = in[c][i];
+            p[0] = s; p[1] = s >> 8; p[2] = s >> 16;
+        }
+    }
+}
+
+#ifdef __SSE2__
+static unsigned pack16_2_sse2(const int32_t *const *in, int16_t *out, unsigned i, unsigned frames)
+{
+    for (; i + 8 <= frames; i += 8)
+    {
+        /* the samples fit in 16 bits, so saturating is just narrowing */
+        __m128i l = _mm_packs_epi32(_mm_loadu_si128((const __m128i *)(in[0] + i)),
+         _mm_loadu_si128((const __m128i *)(in[0] + i + 4)));
+        __m128i r = _mm_packs_epi32(_mm_loadu_si128((const __m128i *)(in[1] + i)),
+         _mm_loadu_si128((const __m128i *)(in[1] + i + 4)));
+
+        _mm_storeu_si128((__m128i *)(out + 2 * i), _mm_unpacklo_epi16(l, r));
+        _mm_storeu_si128((__m128i *)(out + 2 * i + 8), _mm_unpackhi_epi16(l, r));
+    }
+
+    return i;
+}
+
+static unsigned pack32_2_sse2(const int32_t *const *in, int32_t *out, unsigned i, unsigned frames)
+{
+    for (; i + 4 <= frames; i += 4)
+    {
+        __m128i l = _mm_loadu_si128((const __m128i *)(in[0] + i));
+        __m128i r = _mm_loadu_si128((const __m128i *)(in[1] + i));
+
+        _mm_storeu_si128((__m128i *)(out + 2 * i), _mm_unpacklo_epi32(l, r));
+        _mm_storeu_si128((__m128i *)(out + 2 * i + 4), _mm_unpackhi_epi32(l, r));
+    }
+
+    return i;
+}
+#endif
+
+#ifdef HAVE_NEON
+static unsigned pack16_2_neon(const int32_t *const *in, int16_t *out, unsigned i, unsigned frames)
+{
+    for (; i + 4 <= frames; i += 4)
+    {
+        int16x4x2_t lr;
+        lr.val[0] = vmovn_s32(vld1q_s32(in[0] + i));
+        lr.val[1] = vmovn_s32(vld1q_s32(in[1] + i));
+        vst2_s16(out + 2 * i, lr);
+    }
+
+    return i;
+}
+
+static unsigned pack32_2_neon(const int32_t *const *in, int32_t *out, unsigned i, unsigned frames)
+{
+    for (; i + 4 <= frames; i += 4)
+    {
+        int32x4x2_t lr;
+        lr.val[0] = vld1q_s32(in[0] + i);
+        lr.val[1] = vld1q_s32(in[1] + i);
+        vst2q_s32(out + 2 * i, lr);
+    }
+
+    return i;
+}
+#endif
+
+template<class T>
+static void pack_any(const int32_t *const *in, unsigned channels, T *out, unsigned frames)
+{
+    switch (channels)
+    {
+        case 1: pack_c<T, 1>(in, out, 0, frames); break;
+        case 2: pack_c<T, 2>(in, out, 0, frames); break;
+        case 3: pack_c<T, 3>(in, out, 0, frames); break;
+        case 4: pack_c<T, 4>(in, out, 0, frames); break;
+        case 5: pack_c<T, 5>(in, out, 0, frames); break;
+        case 6: pack_c<T, 6>(in, out, 0, frames); break;
+        case 7: pack_c<T, 7>(in, out, 0, frames); break;
+        case 8: pack_c<T, 8>(in, out, 0, frames); break;
+    }
+}
+
+static void pack_stereo(const int32_t *const *in, int16_t *out, unsigned frames)
+{
+    unsigned i = 0;
+#if defined(__SSE2__)
+    i = pack16_2_sse2(in, out, i, frames);
+#elif defined(HAVE_NEON)
+    i = pack16_2_neon(in, out, i, frames);
+#endif
+    pack_c<int16_t, 2>(in, out, i, frames);
+}
+
+static void pack_stereo(const int32_t *const *in, int32_t *out, unsigned frames)
+{
+    unsigned i = 0;
+#if defined(__SSE2__)
+    i = pack32_2_sse2(in, out, i, frames);
+#elif defined(HAVE_NEON)
+    i = pack32_2_neon(in, out, i, frames);
+#endif
+    pack_c<int32_t, 2>(in, out, i, frames);
+}
+
+static void pack24(const int32_t *const *in, unsigned channels, uint8_t *out, unsigned frames)
+{
+    switch (channels)
+    {
+        case 1: pack24_c<1>(in, out, 0, frames); break;
+        case 2: pack24_c<2>(in, out, 0, frames); break;
+        case 3: pack24_c<3>(in, out, 0, frames); break;
+        case 4: pack24_c<4>(in, out, 0, frames); break;
+        case 5: pack24_c<5>(in, out, 0, frames); break;
+        case 6: pack24_c<6>(in, out, 0, frames); break;
+        case 7: pack24_c<7>(in, out, 0, frames); break;
+        case 8: pack24_c<8>(in, out, 0, frames); break;
+    }
+}
+
+void pack_samples(const int32_t *const *in, unsigned channels, unsigned frames, unsigned bits, void *out)
+{
+    switch (bits)
+    {
+        case 8:
+            pack_any(in, channels, (int8_t *) out, frames);
+            break;
+
+        case 16:
+            if (channels == 2)
+                pack_stereo(in, (int16_t *) out, frames);
+            else
+                pack_any(in, channels, (int16_t *) out, frames);
+            break;
+
+        case 24:
+            pack24(in, channels, (uint8_t *) out, frames);
+            break;
+
+        default:
+            if (channels == 2)
+                pack_stereo(in, (int32_t *) out, frames);
+            else
+                pack_any(in, channels, (int32_t *) out, frames);
+    }
+}
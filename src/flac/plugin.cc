@@ -44,6 +44,9 @@ bool FLACng::init()
         return false;
     }
 
+    /* only to tell whether the file has one; see seektable.cc */
+    FLAC__stream_decoder_set_metadata_respond(decoder, FLAC__METADATA_TYPE_SEEKTABLE);
+
     if (FLAC__STREAM_DECODER_INIT_STATUS_OK != (ret = FLAC__stream_decoder_init_stream(
         decoder,
         read_callback,
@@ -125,39 +128,28 @@ bool FLACng::is_our_file(const char *filename, VFSFile &file)
     return false;
 }
 
-static void squeeze_audio(int32_t* src, void* dst, unsigned count, unsigned res)
+/* jumps to a noted frame near <sample>; write_callback() drops what comes
+ * before <sample> */
+static bool seek_noted(FLAC__StreamDecoder *dec, const SeekCache &cache, int64_t sample)
 {
-    int32_t* rp = src;
-    int8_t*  wp = (int8_t*) dst;
-    int16_t* wp2 = (int16_t*) dst;
-    int32_t* wp4 = (int32_t*) dst;
+    int64_t frame_sample, offset;
 
-    switch (res)
-    {
-        case 8:
-            for (unsigned i = 0; i < count; i++, wp++, rp++)
-                *wp = *rp & 0xff;
-            break;
-
-        case 16:
-            for (unsigned i = 0; i < count; i++, wp2++, rp++)
-                *wp2 = *rp & 0xffff;
-            break;
+    if (!cache.find(sample, frame_sample, offset))
+        return false;
 
-        case 24:
-        case 32:
-            for (unsigned i = 0; i < count; i++, wp4++, rp++)
-                *wp4 = *rp;
-            break;
+    if (cinfo->fd->fseek(offset, VFS_SEEK_SET) < 0 || !FLAC__stream_decoder_flush(dec))
+        return false;
 
-        default:
-            AUDERR ("Can not convert to %u bps\n", res);
-    }
+    cinfo->reset();
+    cinfo->skip_to = sample;
+    cinfo->check_sample = frame_sample;
+    return true;
 }
 
 bool FLACng::play(const char *filename, VFSFile &file)
 {
-    Index<char> play_buffer;
+    SeekCache seek_cache;
+    bool use_cache = false;
     bool error = false;
     bool stream = (file.fsize () < 0);
     Tuple tuple;
@@ -184,7 +176,17 @@ bool FLACng::play(const char *filename, VFSFile &file)
         goto ERR_NO_CLOSE;
     }
 
-    play_buffer.resize(BUFFER_SIZE_BYTE);
+    /* native FLAC only: Ogg pages put other bytes between the frames */
+    if (which_decoder == decoder && !stream && !cinfo->has_seektable)
+    {
+        FLAC__uint64 audio_start;
+        if (FLAC__stream_decoder_get_decode_position(which_decoder, &audio_start))
+            use_cache = seek_cache.load(cinfo->md5, cinfo->sample_rate, audio_start,
+             file.fsize());
+    }
+
+    cinfo->skip_to = -1;
+    cinfo->check_sample = -1;
 
     set_stream_bitrate(cinfo->bitrate);
 
@@ -200,28 +202,72 @@ bool FLACng::play(const char *filename, VFSFile &file)
 
         int seek_value = check_seek ();
         if (seek_value >= 0)
-            FLAC__stream_decoder_seek_absolute (which_decoder, (int64_t)
-             seek_value * cinfo->sample_rate / 1000);
+        {
+            int64_t sample = (int64_t) seek_value * cinfo->sample_rate / 1000;
+
+            if (!use_cache || !seek_noted(which_decoder, seek_cache, sample))
+            {
+                cinfo->skip_to = -1;
+                cinfo->check_sample = -1;
+                FLAC__stream_decoder_seek_absolute (which_decoder, sample);
+            }
+        }
+
+        /* where the next frame starts */
+        FLAC__uint64 frame_pos = 0;
+        bool have_pos = use_cache &&
+         FLAC__stream_decoder_get_decode_position(which_decoder, &frame_pos);
+
+        cinfo->frames_decoded = 0;
 
         /* Try to decode a single frame of audio */
-        if (FLAC__stream_decoder_process_single(which_decoder) == false)
+        bool decoded = FLAC__stream_decoder_process_single(which_decoder);
+
+        /* the jump did not land on the noted frame (or on none at all): the
+         * file has changed since, so let libFLAC find the target instead */
+        if (cinfo->check_sample >= 0)
+        {
+            int64_t sample = cinfo->skip_to;
+
+            seek_cache.forget();
+            use_cache = false;
+
+            cinfo->skip_to = -1;
+            cinfo->check_sample = -1;
+            cinfo->reset();
+
+            if (!FLAC__stream_decoder_flush(which_decoder) ||
+             !FLAC__stream_decoder_seek_absolute(which_decoder, sample))
+            {
+                AUDERR ("Could not seek after a bad seek table!\n");
+                error = true;
+                break;
+            }
+
+            continue;
+        }
+
+        if (!decoded)
         {
             AUDERR ("Error while decoding!\n");
             error = true;
             break;
         }
 
+        if (have_pos && cinfo->frames_decoded == 1)
+            seek_cache.add(cinfo->frame_sample, frame_pos);
+
         if (stream && tuple.fetch_stream_info (file))
             set_playback_tuple (tuple.ref ());
 
-        squeeze_audio(cinfo->output_buffer.begin(), play_buffer.begin(),
-         cinfo->buffer_used, cinfo->bits_per_sample);
-        write_audio(play_buffer.begin(), cinfo->buffer_used *
-         SAMPLE_SIZE(cinfo->bits_per_sample));
+        if (cinfo->buffer_used)
+            write_audio(cinfo->output_buffer.begin(), cinfo->buffer_used);
 
         cinfo->reset();
     }
 
+    seek_cache.save();
+
 ERR_NO_CLOSE:
     cinfo->reset();
 
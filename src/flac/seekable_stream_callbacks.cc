@@ -125,15 +125,47 @@ FLAC__StreamDecoderWriteStatus write_callback(const FLAC__StreamDecoder *decoder
     if (!info->output_buffer.len())
         info->alloc();
 
-    for (unsigned sample = 0; sample < frame->header.blocksize; sample++)
+    info->frame_sample = frame->header.number.sample_number;
+    info->frames_decoded++;
+
+    /* the frame jumped to must be the one noted there; if not, check_sample
+     * stays set and the player seeks again */
+    if (info->check_sample >= 0)
     {
-        for (unsigned channel = 0; channel < frame->header.channels; channel++)
-        {
-            *(info->write_pointer++) = buffer[channel][sample];
-            info->buffer_used += 1;
-        }
+        if (info->frame_sample != info->check_sample)
+            return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+
+        info->check_sample = -1;
+    }
+
+    /* after seeking to a noted frame, decode up to the target */
+    const FLAC__int32 *from[FLAC__MAX_CHANNELS];
+    unsigned skip = 0;
+
+    if (info->skip_to >= 0)
+    {
+        if (info->frame_sample + frame->header.blocksize <= info->skip_to)
+            return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+
+        skip = aud::max(info->skip_to - info->frame_sample, (int64_t) 0);
+        info->skip_to = -1;
     }
 
+    for (unsigned channel = 0; channel < frame->header.channels; channel++)
+        from[channel] = buffer[channel] + skip;
+
+    unsigned frames = frame->header.blocksize - skip;
+    unsigned bytes = frames * frame->header.channels * SAMPLE_SIZE(info->bits_per_sample);
+
+    if (info->buffer_used + bytes > (unsigned) info->output_buffer.len())
+        return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+
+    pack_samples((const int32_t *const *) from, frame->header.channels,
+     frames, info->bits_per_sample, info->write_pointer);
+
+    info->write_pointer += bytes;
+    info->buffer_used += bytes;
+
     return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
 
@@ -161,6 +193,9 @@ void metadata_callback(const FLAC__StreamDecoder *decoder, const FLAC__StreamMet
         info->sample_rate = metadata->data.stream_info.sample_rate;
         AUDDBG("sample_rate=%d\n", metadata->data.stream_info.sample_rate);
 
+        memcpy(info->md5, metadata->data.stream_info.md5sum, sizeof info->md5);
+        info->has_seektable = false;  /* SEEKTABLE, if any, comes after */
+
         size = info->fd->fsize ();
 
         if (size == -1 || info->total_samples == 0)
@@ -170,4 +205,6 @@ void metadata_callback(const FLAC__StreamDecoder *decoder, const FLAC__StreamMet
 
         AUDDBG("bitrate=%d\n", info->bitrate);
     }
+    else if (metadata->type == FLAC__METADATA_TYPE_SEEKTABLE)
+        info->has_seektable = (metadata->data.seek_table.num_points > 0);
 }
@@ -0,0 +1,195 @@
+/*
+ * Remembered seek tables for the FLAC plugin
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+/*
+ * Without a SEEKTABLE block, libFLAC seeks by bisecting the file, which over
+ * a network transport means many small ranged reads per seek.  Instead, the
+ * byte offset of a frame about every second is noted while playing, and
+ * kept in the user's config directory under the file's STREAMINFO MD5 and
+ * the length of its audio.  The offsets count from the first frame, so
+ * renaming or retagging the file does not lose them.  A seek near a known
+ * frame then takes one jump plus decoding up to the target sample; the
+ * player checks that the frame found there is the one noted, and forgets
+ * the table if not (see FLACng::play).
+ *
+ * Tables are touched when loaded; after writing one, only the MAX_TABLES
+ * most recently used are kept.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libfauxdcore/audstrings.h>
+#include <libfauxdcore/runtime.h>
+#include <libfauxdcore/vfs.h>
+
+#include "flacng.h"
+#include "../cache-common/cache-files.h"
+
+#define SEEK_CACHE_DIR "flac-seektables"
+#define MAX_TABLES 1000
+
+bool SeekCache::load(const FLAC__byte md5[16], unsigned sample_rate, int64_t audio_start,
+ int64_t audio_end)
+{
+    static const FLAC__byte unset[16] = {0};
+
+    m_points.clear();
+    m_uri = String();
+    m_rate = sample_rate;
+    m_base = audio_start;
+    m_changed = false;
+
+    /* the MD5 is optional (all zero if the encoder left it out) */
+    if (!sample_rate || !memcmp(md5, unset, 16) || audio_start <= 0 || audio_end <= audio_start)
+        return false;
+
+    /* the same audio encoded another way has its frames elsewhere */
+    char name[33 + 17];
+    for (int i = 0; i < 16; i++)
+        snprintf(name + 2 * i, 3, "%02x", md5[i]);
+
+    snprintf(name + 32, 18, "-%llx", (unsigned long long)(audio_end - audio_start));
+
+    m_uri = String(filename_to_uri(filename_build({cache_path(SEEK_CACHE_DIR), name})));
+
+    VFSFile file(m_uri, "r");
+    if (!file)
+        return true;  // nothing noted yet
+
+    cache_touch(m_uri);
+
+    Index<char> data = file.read_all();
+    data.append(0);
+
+    /* lines of "sample offset", in order */
+    char *p = data.begin();
+    while (1)
+    {
+        char *end;
+        Point pt;
+
+        pt.sample = strtoll(p, &end, 10);
+        if (end == p)
+            break;
+
+        p = end;
+        pt.offset = strtoll(p, &end, 10);
+        if (end == p)
+            break;
+
+        p = end;
+        if (pt.sample < 0 || pt.offset < 0 ||
+         (m_points.len() && pt.sample <= m_points[m_points.len() - 1].sample))
+        {
+            AUDWARN("Ignoring damaged FLAC seek table %s.\n", (const char *) m_uri);
+            m_points.clear();
+            break;
+        }
+
+        m_points.append(pt);
+    }
+
+    AUDDBG("Loaded %d seek points.\n", m_points.len());
+    return true;
+}
+
+/* index of the last point at or before <sample>, or -1 */
+int SeekCache::search(int64_t sample) const
+{
+    int lo = 0, hi = m_points.len();
+
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (m_points[mid].sample <= sample)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo - 1;
+}
+
+void SeekCache::add(int64_t sample, int64_t offset)
+{
+    if (!m_uri)
+        return;
+
+    int at = search(sample) + 1;
+
+    /* one point a second is plenty */
+    if ((at > 0 && m_points[at - 1].sample > sample - m_rate) ||
+     (at < m_points.len() && m_points[at].sample < sample + m_rate))
+        return;
+
+    m_points.insert(at, 1);
+    m_points[at] = {sample, offset - m_base};
+    m_changed = true;
+}
+
+bool SeekCache::find(int64_t sample, int64_t &frame_sample, int64_t &offset) const
+{
+    int at = search(sample);
+
+    /* a point far back (playback skipped that stretch) is no better than
+     * letting libFLAC search */
+    if (at < 0 || sample - m_points[at].sample > 2 * (int64_t)m_rate)
+        return false;
+
+    frame_sample = m_points[at].sample;
+    offset = m_points[at].offset + m_base;
+    return true;
+}
+
+/* a noted frame was not where it should be: the table is no good */
+void SeekCache::forget()
+{
+    if (!m_uri)
+        return;
+
+    AUDWARN("FLAC seek table %s is out of date, discarding it.\n", (const char *) m_uri);
+
+    m_points.clear();
+    m_changed = true;
+}
+
+void SeekCache::save()
+{
+    if (!m_uri || !m_changed)
+        return;
+
+    cache_make_dir(SEEK_CACHE_DIR);
+
+    VFSFile file(m_uri, "w");
+    if (!file)
+    {
+        AUDERR("Could not write %s.\n", (const char *) m_uri);
+        return;
+    }
+
+    for (const Point &pt : m_points)
+    {
+        StringBuf line = str_printf("%lld %lld\n", (long long)pt.sample, (long long)pt.offset);
+        file.fwrite(line, 1, line.len());
+    }
+
+    m_changed = false;
+    cache_prune(SEEK_CACHE_DIR, MAX_TABLES);
+}
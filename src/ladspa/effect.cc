@@ -21,6 +21,7 @@
 
 #include "ladspa.h"
 #include "plugin.h"
+#include "../dsp/dsp.h"
 
 #include <libfauxdcore/runtime.h>
 
@@ -106,15 +107,8 @@ static void run_plugin (LoadedPlugin & loaded, audio_sample * data, int samples)
             for (int p = 0; p < ports; p ++)
             {
                 int channel = ports * i + p;
-                audio_sample * get = data + channel;
-                LADSPA_Data * in = loaded.in_bufs[channel].begin ();
-                const LADSPA_Data * in_end = in + frames;
-
-                while (in < in_end)
-                {
-                    * in ++ = * get;
-                    get += ladspa_channels;
-                }
+                dsp_get_channel (data, ladspa_channels, channel,
+                 loaded.in_bufs[channel].begin (), frames);
             }
 
             desc.run (handle, frames);
@@ -122,15 +116,8 @@ static void run_plugin (LoadedPlugin & loaded, audio_sample * data, int samples)
             for (int p = 0; p < ports; p ++)
             {
                 int channel = ports * i + p;
-                audio_sample * set = data + channel;
-                LADSPA_Data * out = loaded.out_bufs[channel].begin ();
-                const LADSPA_Data * out_end = out + frames;
-
-                while (out < out_end)
-                {
-                    * set = * out ++;
-                    set += ladspa_channels;
-                }
+                dsp_set_channel (loaded.out_bufs[channel].begin (), data,
+                 ladspa_channels, channel, frames);
             }
         }
 
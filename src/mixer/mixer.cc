@@ -32,6 +32,8 @@
 #include <libfauxdcore/plugin.h>
 #include <libfauxdcore/preferences.h>
 
+#include "../dsp/dsp.h"
+
 class ChannelMixer : public EffectPlugin
 {
 public:
@@ -59,135 +61,47 @@ public:
 
 EXPORT ChannelMixer aud_plugin_instance;
 
-typedef Index<audio_sample> & (* Converter) (Index<audio_sample> & data);
-
 static Index<audio_sample> mixer_buf;
 
-static Index<audio_sample> & mono_to_stereo (Index<audio_sample> & data)
-{
-    int frames = data.len ();
-    mixer_buf.resize (2 * frames);
-
-    audio_sample * get = data.begin ();
-    audio_sample * set = mixer_buf.begin ();
-
-    while (frames --)
-    {
-        audio_sample val = * get ++;
-        * set ++ = val;
-        * set ++ = val;
-    }
-
-    return mixer_buf;
-}
-
-static Index<audio_sample> & stereo_to_mono (Index<audio_sample> & data)
-{
-    int frames = data.len () / 2;
-    mixer_buf.resize (frames);
-
-    audio_sample * get = data.begin ();
-    audio_sample * set = mixer_buf.begin ();
-
-    while (frames --)
-    {
-        audio_sample val = * get ++;
-        val += * get ++;
-        * set ++ = val / 2;
-    }
-
-    return mixer_buf;
-}
-
-static Index<audio_sample> & quadro_to_stereo (Index<audio_sample> & data)
-{
-    int frames = data.len () / 4;
-    mixer_buf.resize (2 * frames);
-
-    audio_sample * get = data.begin ();
-    audio_sample * set = mixer_buf.begin ();
-
-    while (frames --)
-    {
-        audio_sample front_left  = * get ++;
-        audio_sample front_right = * get ++;
-        audio_sample back_left   = * get ++;
-        audio_sample back_right  = * get ++;
-        * set ++ = front_left + (back_left * 0.7);
-        * set ++ = front_right + (back_right * 0.7);
-    }
-
-    return mixer_buf;
-}
-
-static Index<audio_sample> & stereo_to_quadro (Index<audio_sample> & data)
-{
-    int frames = data.len () / 2;
-    mixer_buf.resize (4 * frames);
+/* Each converter is a matrix with one row per output channel, giving how much
+ * of each input channel goes into it. */
 
-    audio_sample * get = data.begin ();
-    audio_sample * set = mixer_buf.begin();
-
-    while (frames --)
-    {
-        audio_sample left  = * get ++;
-        audio_sample right = * get ++;
-        * set ++ = left;   // front left
-        * set ++ = right;  // front right
-        * set ++ = left;   // rear left
-        * set ++ = right;  // rear right
-    }
-
-    return mixer_buf;
-}
+static const float mono_to_stereo[] = {
+    1,
+    1
+};
 
-static Index<audio_sample> & surround_5p1_to_stereo (Index<audio_sample> & data)
-{
-    int frames = data.len () / 6;
-    mixer_buf.resize (2 * frames);
+static const float stereo_to_mono[] = {
+    0.5, 0.5
+};
 
-    audio_sample * get = data.begin ();
-    audio_sample * set = mixer_buf.begin ();
+static const float quadro_to_stereo[] = {
+ /* front left, front right, back left, back right */
+    1, 0, 0.7, 0,
+    0, 1, 0, 0.7
+};
 
-    while (frames --)
-    {
-        audio_sample front_left  = * get ++;
-        audio_sample front_right = * get ++;
-        audio_sample center = * get ++;
-        audio_sample lfe    = * get ++;
-        audio_sample rear_left   = * get ++;
-        audio_sample rear_right  = * get ++;
-        * set ++ = front_left + (center * 0.5) + (lfe * 0.5) + (rear_left * 0.5);
-        * set ++ = front_right + (center * 0.5) + (lfe * 0.5) + (rear_right * 0.5);
-    }
+static const float stereo_to_quadro[] = {
+    1, 0,  // front left
+    0, 1,  // front right
+    1, 0,  // rear left
+    0, 1   // rear right
+};
 
-    return mixer_buf;
-}
+static const float surround_5p1_to_stereo[] = {
+ /* front left, front right, center, lfe, rear left, rear right */
+    1, 0, 0.5, 0.5, 0.5, 0,
+    0, 1, 0.5, 0.5, 0, 0.5
+};
 
 /* 5 channels case. Quad + center channel */
-static Index<audio_sample> & quadro_5_to_stereo (Index<audio_sample> & data)
-{
-    int frames = data.len () / 5;
-    mixer_buf.resize (2 * frames);
-
-    audio_sample * get = data.begin ();
-    audio_sample * set = mixer_buf.begin ();
-
-    while (frames --)
-    {
-        audio_sample front_left  = * get ++;
-        audio_sample front_right = * get ++;
-        audio_sample center = * get ++;
-        audio_sample rear_left   = * get ++;
-        audio_sample rear_right  = * get ++;
-        * set ++ = front_left + (center * 0.5) + rear_left;
-        * set ++ = front_right + (center * 0.5) + rear_right;
-    }
-
-    return mixer_buf;
-}
+static const float quadro_5_to_stereo[] = {
+ /* front left, front right, center, rear left, rear right */
+    1, 0, 0.5, 1, 0,
+    0, 1, 0.5, 0, 1
+};
 
-static Converter get_converter (int in, int out)
+static const float * get_converter (int in, int out)
 {
     if (in == 1 && out == 2)
         return mono_to_stereo;
@@ -230,11 +144,17 @@ Index<audio_sample> & ChannelMixer::process (Index<audio_sample> & data)
     if (input_channels == output_channels)
         return data;
 
-    Converter converter = get_converter (input_channels, output_channels);
-    if (converter)
-        return converter (data);
+    const float * converter = get_converter (input_channels, output_channels);
+    if (! converter)
+        return data;
 
-    return data;
+    int frames = data.len () / input_channels;
+    mixer_buf.resize (output_channels * frames);
+
+    dsp_remix (data.begin (), input_channels, mixer_buf.begin (), output_channels,
+     converter, frames);
+
+    return mixer_buf;
 }
 
 const char * const ChannelMixer::defaults[] = {
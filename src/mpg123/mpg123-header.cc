@@ -0,0 +1,240 @@
+/*
+ * MPEG audio frame header parsing for the mpg123 plugin
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <string.h>
+
+#include <libfauxdcore/runtime.h>
+#include <libfauxdcore/vfs.h>
+
+#include "mpg123-header.h"
+
+#define SCAN_SIZE 16384   /* enough for the first two frames of any layer */
+#define MAX_JUNK 4096     /* give up on sync past this much junk */
+
+struct FrameHeader
+{
+    int version, layer, rate, channels, bitrate;
+    int size;             // bytes, including the header
+    int samples;          // per frame
+    int side_info;        // layer 3 side info length
+};
+
+static const short bitrates[2][3][16] = {
+    {   /* MPEG-1 */
+        {0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448},
+        {0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384},
+        {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320}
+    },
+    {   /* MPEG-2 and 2.5 */
+        {0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256},
+        {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160},
+        {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160}
+    }
+};
+
+static const int rates[3] = {44100, 48000, 32000};
+
+static uint32_t get_be32 (const unsigned char * p)
+{
+    return (uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/* free-format frames (bitrate index 0) are rejected; their size is only
+ * known by searching for the next sync */
+static bool parse_header (const unsigned char * p, FrameHeader & h)
+{
+    if (p[0] != 0xff || (p[1] & 0xe0) != 0xe0)
+        return false;
+
+    int ver_bits = (p[1] >> 3) & 3;    // 0 = 2.5, 1 = reserved, 2 = 2, 3 = 1
+    int layer_bits = (p[1] >> 1) & 3;  // 0 = reserved, 1 = III, 2 = II, 3 = I
+    int br_index = p[2] >> 4;
+    int rate_index = (p[2] >> 2) & 3;
+    int padding = (p[2] >> 1) & 1;
+
+    if (ver_bits == 1 || ! layer_bits || ! br_index || br_index == 15 || rate_index == 3)
+        return false;
+
+    h.version = (ver_bits == 3) ? 0 : (ver_bits == 2) ? 1 : 2;
+    h.layer = 4 - layer_bits;
+    h.rate = rates[rate_index] >> h.version;
+    h.channels = ((p[3] >> 6) == 3) ? 1 : 2;
+    h.bitrate = bitrates[h.version ? 1 : 0][h.layer - 1][br_index];
+
+    int bps = h.bitrate * 1000;
+
+    if (h.layer == 1)
+    {
+        h.samples = 384;
+        h.size = (12 * bps / h.rate + padding) * 4;
+    }
+    else if (h.layer == 2 || ! h.version)
+    {
+        h.samples = 1152;
+        h.size = 144 * bps / h.rate + padding;
+    }
+    else
+    {
+        h.samples = 576;
+        h.size = 72 * bps / h.rate + padding;
+    }
+
+    if (! h.version)
+        h.side_info = (h.channels == 1) ? 17 : 32;
+    else
+        h.side_info = (h.channels == 1) ? 9 : 17;
+
+    return true;
+}
+
+static int id3v2_size (const unsigned char * p, int len)
+{
+    if (len < 10 || memcmp (p, "ID3", 3) || ((p[6] | p[7] | p[8] | p[9]) & 0x80))
+        return 0;
+
+    int size = 10 + (p[6] << 21 | p[7] << 14 | p[8] << 7 | p[9]);
+    if (p[5] & 0x10)
+        size += 10;  // footer
+
+    return size;
+}
+
+/* Xing/Info (with an optional LAME extension) or VBRI, in the first frame */
+static bool parse_vbr_tag (const unsigned char * frame, const FrameHeader & h,
+ int64_t & frames, int & delay, int & padding)
+{
+    const unsigned char * x = frame + 4 + h.side_info;
+    const unsigned char * end = frame + h.size;
+
+    if (x + 8 <= end && (! memcmp (x, "Xing", 4) || ! memcmp (x, "Info", 4)))
+    {
+        uint32_t flags = get_be32 (x + 4);
+        const unsigned char * p = x + 8;
+
+        frames = -1;
+        if (flags & 1)
+        {
+            if (p + 4 > end)
+                return false;
+            frames = get_be32 (p);
+            p += 4;
+        }
+
+        if (flags & 2)
+            p += 4;    // bytes
+        if (flags & 4)
+            p += 100;  // TOC
+        if (flags & 8)
+            p += 4;    // quality
+
+        /* encoder delay and padding, 12 bits each, 21 bytes into the tag */
+        if (p + 24 <= end && (! memcmp (p, "LAME", 4) || ! memcmp (p, "Lav", 3)))
+        {
+            delay = p[21] << 4 | p[22] >> 4;
+            padding = (p[22] & 0xf) << 8 | p[23];
+        }
+
+        return true;
+    }
+
+    const unsigned char * v = frame + 4 + 32;
+
+    if (v + 18 <= end && ! memcmp (v, "VBRI", 4))
+    {
+        frames = get_be32 (v + 14);
+        return true;
+    }
+
+    return false;
+}
+
+bool mp3_read_info (VFSFile & file, int64_t size, MP3Info & info)
+{
+    unsigned char buf[SCAN_SIZE];
+    int64_t start = 0;
+    int len = file.fread (buf, 1, sizeof buf);
+
+    /* skip ID3v2 tags (there may be several in a row) */
+    int tag;
+    while ((tag = id3v2_size (buf, len)) > 0)
+    {
+        start += tag;
+        if (start >= size || file.fseek (start, VFS_SEEK_SET) < 0)
+            return false;
+
+        len = file.fread (buf, 1, sizeof buf);
+    }
+
+    FrameHeader h, next;
+    int pos = 0;
+
+    for (; pos + 4 <= aud::min (len, MAX_JUNK); pos ++)
+    {
+        if (! parse_header (buf + pos, h) || pos + h.size + 4 > len)
+            continue;
+
+        /* a single header is too easy to fake; the next frame must agree */
+        if (parse_header (buf + pos + h.size, next) && next.version == h.version &&
+         next.layer == h.layer && next.rate == h.rate && next.channels == h.channels)
+            break;
+    }
+
+    if (pos + 4 > aud::min (len, MAX_JUNK))
+        return false;
+
+    info.version = h.version;
+    info.layer = h.layer;
+    info.rate = h.rate;
+    info.channels = h.channels;
+    info.bitrate = h.bitrate;
+    info.exact = false;
+
+    int64_t frames = -1;
+    int delay = 0, padding = 0;
+
+    if (h.layer == 3 && parse_vbr_tag (buf + pos, h, frames, delay, padding))
+    {
+        /* the tag frame holds no audio; the bitrate of the first real one
+         * is what the decoder would have reported */
+        info.bitrate = next.bitrate;
+        start += h.size;
+    }
+
+    if (frames > 0)
+    {
+        info.samples = aud::max (frames * h.samples - delay - padding, (int64_t) 0);
+        info.exact = true;
+    }
+    else
+    {
+        /* no frame count: assume constant bitrate, leaving out an ID3v1 tag */
+        int64_t bytes = size - start - pos;
+
+        unsigned char tail[3];
+        if (size >= 128 && file.fseek (size - 128, VFS_SEEK_SET) == 0 &&
+         file.fread (tail, 1, 3) == 3 && ! memcmp (tail, "TAG", 3))
+            bytes -= 128;
+
+        if (bytes <= 0)
+            return false;
+
+        info.samples = bytes * 8 * h.rate / (info.bitrate * 1000);
+    }
+
+    return info.samples > 0;
+}
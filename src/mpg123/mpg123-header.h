@@ -0,0 +1,44 @@
+/*
+ * MPEG audio frame header parsing for the mpg123 plugin
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef MPG123_HEADER_H
+#define MPG123_HEADER_H
+
+#include <stdint.h>
+
+class VFSFile;
+
+/* What read_tag() needs, taken from the frame headers (and the Xing/Info,
+ * LAME or VBRI tag, if there is one) without decoding anything. */
+struct MP3Info
+{
+    int version;      // 0 = MPEG-1, 1 = MPEG-2, 2 = MPEG-2.5
+    int layer;
+    int rate;
+    int channels;
+    int bitrate;      // of the first frame, kbps
+    int64_t samples;  // gapless length; estimated from the file size if there is no tag
+    bool exact;       // samples came from a Xing/Info or VBRI frame count
+};
+
+/* Reads from the start of <file>; <size> is its length.  Returns false
+ * whenever the headers don't tell the whole story (no sync, frames that don't
+ * chain, free-format bitrate), in which case the decoder has to look. */
+bool mp3_read_info (VFSFile & file, int64_t size, MP3Info & info);
+
+#endif
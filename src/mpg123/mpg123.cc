@@ -19,7 +19,11 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <atomic>
+#include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #undef EXPORT
 #include <mpg123.h>
@@ -40,8 +44,12 @@
 #include <libfauxdcore/i18n.h>
 #include <libfauxdcore/plugin.h>
 #include <libfauxdcore/preferences.h>
+#include <libfauxdcore/vfs.h>
 #include <fauxdacious/audtag.h>
 
+#include "mpg123-header.h"
+#include "../cache-common/cache-files.h"
+
 class MPG123Plugin : public InputPlugin
 {
 public:
@@ -85,13 +93,16 @@ const char * const MPG123Plugin::mimes[] = {
 
 const char * const MPG123Plugin::defaults[] = {
     "full_scan", "FALSE",
+    "seek_index", "TRUE",
     nullptr
 };
 
 const PreferencesWidget MPG123Plugin::widgets[] = {
     WidgetLabel (N_("<b>Advanced</b>")),
     WidgetCheck (N_("Use accurate length calculation (slow)"),
-        WidgetBool ("mpg123", "full_scan"))
+        WidgetBool ("mpg123", "full_scan")),
+    WidgetCheck (N_("Remember frame positions of VBR files (exact seeking)"),
+        WidgetBool ("mpg123", "seek_index"))
 };
 
 const PluginPreferences MPG123Plugin::prefs = {{widgets}};
@@ -120,6 +131,266 @@ static off_t replace_lseek_dummy (void * file, off_t to, int whence)
     return -1;
 }
 
+/* Creates a decoder with the settings shared by probing, playback and the
+ * background index scan. */
+static mpg123_handle * new_decoder (ssize_t (* read) (void *, void *, size_t),
+ off_t (* lseek) (void *, off_t, int))
+{
+    mpg123_handle * dec = mpg123_new (nullptr, nullptr);
+    mpg123_param (dec, MPG123_ADD_FLAGS, DECODE_OPTIONS, 0);
+    mpg123_replace_reader_handle (dec, read, lseek, nullptr);
+
+    mpg123_format_none (dec);
+
+    for (int rate : {8000, 11025, 12000, 16000, 22050, 24000, 32000, 44100, 48000})
+        mpg123_format (dec, rate, MPG123_MONO | MPG123_STEREO, MPG123_ENC_FLOAT_32);
+
+    return dec;
+}
+
+/*
+ * Seek index cache
+ *
+ * mpg123_scan() reads the whole file to find where every frame starts, which
+ * is what makes seeking in VBR files exact (and their length exact, if there
+ * is no Xing/LAME header).  The resulting frame index is saved per file in the
+ * user's config directory, keyed by URI, size and modification time, so the
+ * scan is done only once: by full_scan, or in the background the first time a
+ * VBR file is played.  Both read_tag() and play() use the saved index.
+ *
+ * Loading an index touches it, and saving one drops all but the MAX_INDEXES
+ * most recently touched, so indexes of files long gone do not pile up.
+ */
+
+#define INDEX_DIR "mpg123-index"
+#define MAX_INDEXES 1000
+
+struct SeekIndex
+{
+    int64_t samples = 0;   // exact length (gapless)
+    off_t step = 0;        // frames between entries
+    Index<off_t> offsets;  // byte position of every step-th frame
+};
+
+static String index_key (const char * filename)
+{
+    if (strncmp (filename, "file://", 7) || ! aud_get_bool ("mpg123", "seek_index"))
+        return String ();
+
+    StringBuf path = uri_to_filename (filename);
+    struct stat st;
+
+    if (! path || stat (path, & st) < 0)
+        return String ();
+
+    return String (str_printf ("%s\t%lld\t%lld", filename,
+     (long long) st.st_size, (long long) st.st_mtime));
+}
+
+/* file format: the key, a line "samples step count", then the offsets */
+static bool seek_index_load (const char * filename, SeekIndex & index)
+{
+    String key = index_key (filename);
+    if (! key)
+        return false;
+
+    VFSFile file (cache_hashed_uri (INDEX_DIR, filename), "r");
+    if (! file)
+        return false;
+
+    Index<char> data = file.read_all ();
+    data.append (0);
+
+    char * p = data.begin ();
+    char * nl = strchr (p, '\n');
+    if (! nl)
+        return false;
+
+    * nl = 0;
+    if (strcmp (p, key))
+        return false;  // file changed (or a hash collision)
+
+    p = nl + 1;
+    long long samples = strtoll (p, & p, 10);
+    long long step = strtoll (p, & p, 10);
+    long long count = strtoll (p, & p, 10);
+
+    if (samples <= 0 || step <= 0 || count <= 0 || count > data.len ())
+        return false;
+
+    index.samples = samples;
+    index.step = step;
+    index.offsets.clear ();
+
+    for (int i = 0; i < count; i ++)
+    {
+        char * end;
+        long long offset = strtoll (p, & end, 10);
+        if (end == p)
+            return false;
+
+        index.offsets.append (offset);
+        p = end;
+    }
+
+    /* keep it from being pruned */
+    cache_touch (cache_hashed_uri (INDEX_DIR, filename));
+
+    AUDDBG ("Loaded seek index for %s (%d entries).\n", filename, index.offsets.len ());
+    return true;
+}
+
+/* takes the index out of a decoder that has scanned the whole file */
+static bool get_index (mpg123_handle * dec, SeekIndex & index)
+{
+    off_t * offsets, step;
+    size_t count;
+
+    if (mpg123_index (dec, & offsets, & step, & count) != MPG123_OK || ! count || step <= 0)
+        return false;
+
+    index.samples = mpg123_length (dec);
+    index.step = step;
+    index.offsets.clear ();
+    index.offsets.insert (offsets, 0, (int) count);
+
+    return index.samples > 0;
+}
+
+static bool set_index (mpg123_handle * dec, SeekIndex & index)
+{
+    return mpg123_set_index (dec, index.offsets.begin (), index.step,
+     index.offsets.len ()) == MPG123_OK;
+}
+
+static void seek_index_save (const char * filename, const SeekIndex & index)
+{
+    String key = index_key (filename);
+    if (! key)
+        return;
+
+    cache_make_dir (INDEX_DIR);
+
+    VFSFile file (cache_hashed_uri (INDEX_DIR, filename), "w");
+    if (! file)
+    {
+        AUDERR ("Could not write seek index for %s.\n", filename);
+        return;
+    }
+
+    StringBuf head = str_printf ("%s\n%lld %lld %d\n", (const char *) key,
+     (long long) index.samples, (long long) index.step, index.offsets.len ());
+    file.fwrite (head, 1, head.len ());
+
+    for (off_t offset : index.offsets)
+    {
+        StringBuf line = str_printf ("%lld\n", (long long) offset);
+        file.fwrite (line, 1, line.len ());
+    }
+
+    cache_prune (INDEX_DIR, MAX_INDEXES);
+}
+
+/* One file at a time is scanned in the background.  The playing file picks up
+ * the result at its next seek; later plays and read_tag() load it from disk. */
+static pthread_mutex_t scan_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t scan_thread;
+static bool scan_running, scan_done, scan_ok;
+static std::atomic<bool> scan_abort;
+static String scan_filename;
+static SeekIndex scan_result;
+
+static ssize_t scan_read (void * file, void * buffer, size_t length)
+{
+    if (scan_abort)
+        return -1;
+
+    return ((VFSFile *) file)->fread (buffer, 1, length);
+}
+
+static void * scan_worker (void *)
+{
+    SeekIndex index;
+    bool ok = false;
+
+    VFSFile file (scan_filename, "r");
+
+    if (file)
+    {
+        mpg123_handle * dec = new_decoder (scan_read, replace_lseek);
+
+        if (mpg123_open_handle (dec, & file) == MPG123_OK &&
+         mpg123_scan (dec) == MPG123_OK && get_index (dec, index))
+        {
+            seek_index_save (scan_filename, index);
+            ok = true;
+        }
+
+        mpg123_delete (dec);
+    }
+
+    pthread_mutex_lock (& scan_mutex);
+    scan_result = std::move (index);
+    scan_ok = ok;
+    scan_done = true;
+    pthread_mutex_unlock (& scan_mutex);
+
+    return nullptr;
+}
+
+/* call with scan_mutex held */
+static void scan_join ()
+{
+    if (scan_running)
+    {
+        pthread_join (scan_thread, nullptr);
+        scan_running = false;
+    }
+}
+
+static void seek_index_build_async (const char * filename)
+{
+    if (! index_key (filename))
+        return;
+
+    pthread_mutex_lock (& scan_mutex);
+
+    if (! scan_running || scan_done)
+    {
+        scan_join ();
+
+        scan_filename = String (filename);
+        scan_result = SeekIndex ();
+        scan_done = scan_ok = false;
+        scan_abort = false;
+
+        if (! pthread_create (& scan_thread, nullptr, scan_worker, nullptr))
+        {
+            AUDDBG ("Building seek index for %s.\n", filename);
+            scan_running = true;
+        }
+    }
+
+    pthread_mutex_unlock (& scan_mutex);
+}
+
+/* gets the index built in the background, if it is for <filename> and ready */
+static bool seek_index_take (const char * filename, SeekIndex & index)
+{
+    bool found = false;
+    pthread_mutex_lock (& scan_mutex);
+
+    if (scan_done && scan_ok && ! strcmp (scan_filename, filename))
+    {
+        index = std::move (scan_result);
+        scan_ok = false;
+        found = true;
+    }
+
+    pthread_mutex_unlock (& scan_mutex);
+    return found;
+}
+
 bool MPG123Plugin::init ()
 {
     aud_config_set_defaults ("mpg123", defaults);
@@ -132,6 +403,13 @@ bool MPG123Plugin::init ()
 
 void MPG123Plugin::cleanup ()
 {
+    pthread_mutex_lock (& scan_mutex);
+    scan_abort = true;
+    scan_join ();
+    scan_result = SeekIndex ();
+    scan_filename = String ();
+    pthread_mutex_unlock (& scan_mutex);
+
     AUDDBG("deinitializing mpg123 library\n");
     mpg123_exit();
 }
@@ -145,6 +423,9 @@ struct DecodeState
     ~DecodeState()
         { mpg123_delete (dec); }
 
+    SeekIndex index;
+    bool indexed = false;  // index loaded, or built by full_scan
+
     long rate;
     int channels, encoding;
     mpg123_frameinfo info;
@@ -154,25 +435,33 @@ struct DecodeState
 
 bool DecodeState::init (const char * filename, VFSFile & file, bool probing, bool stream)
 {
-    dec = mpg123_new (nullptr, nullptr);
-    mpg123_param (dec, MPG123_ADD_FLAGS, DECODE_OPTIONS, 0);
-    mpg123_replace_reader_handle (dec, replace_read,
-     stream ? replace_lseek_dummy : replace_lseek, nullptr);
+    bool cached = false;
+
+    dec = new_decoder (replace_read, stream ? replace_lseek_dummy : replace_lseek);
 
     /* be strict about junk data in file during content probe */
     if (probing)
         mpg123_param (dec, MPG123_RESYNC_LIMIT, 0, 0);
 
-    mpg123_format_none (dec);
-
-    for (int rate : {8000, 11025, 12000, 16000, 22050, 24000, 32000, 44100, 48000})
-        mpg123_format (dec, rate, MPG123_MONO | MPG123_STEREO, MPG123_ENC_FLOAT_32);
-
     if (mpg123_open_handle (dec, & file) < 0)
         goto err;
 
-    if (! stream && aud_get_bool ("mpg123", "full_scan") && mpg123_scan (dec) < 0)
-        goto err;
+    /* a saved index replaces the full scan (it is set once the first frame
+     * has been read, below) */
+    if (! stream && ! probing)
+        cached = seek_index_load (filename, index);
+
+    if (! stream && ! cached && aud_get_bool ("mpg123", "full_scan"))
+    {
+        if (mpg123_scan (dec) < 0)
+            goto err;
+
+        if (! probing && get_index (dec, index))
+        {
+            seek_index_save (filename, index);
+            indexed = true;
+        }
+    }
 
     while (1)
     {
@@ -189,6 +478,9 @@ bool DecodeState::init (const char * filename, VFSFile & file, bool probing, boo
         if (mpg123_info (dec, & info) < 0)
             goto err;
 
+        if (cached)
+            indexed = set_index (dec, index);
+
         // heuristic/sanity check to avoid false positives:
         if (probing && !stream && info.vbr == MPG123_CBR && info.bitrate <= 0)
             goto err;
@@ -223,10 +515,59 @@ static bool detect_id3 (VFSFile & file)
     return is_id3;
 }
 
-static StringBuf make_format_string (const mpg123_frameinfo * info)
+static StringBuf make_format_string (int version, int layer)
 {
     static const char * vers[] = {"1", "2", "2.5"};
-    return str_printf ("MPEG-%s layer %d", vers[info->version], info->layer);
+    return str_printf ("MPEG-%s layer %d", vers[version], layer);
+}
+
+static StringBuf make_format_string (const mpg123_frameinfo * info)
+{
+    return make_format_string (info->version, info->layer);
+}
+
+static void set_info_fields (Tuple & tuple, const char * codec, int channels,
+ int rate, int bitrate, int64_t samples, int64_t size)
+{
+    tuple.set_str (Tuple::Codec, codec);
+    tuple.set_str (Tuple::Quality, str_printf ("%s, %d Hz", (channels == 2) ?
+     _("Stereo") : (channels > 2) ? _("Surround") : _("Mono"), rate));
+    tuple.set_int (Tuple::Bitrate, bitrate);
+    tuple.set_int(Tuple::Channels, channels);
+
+    if (size >= 0 && rate > 0)
+    {
+        int length = aud::rescale<int64_t>(samples, rate, 1000);
+
+        if (length > 0)
+        {
+            tuple.set_int (Tuple::Length, length);
+            tuple.set_int (Tuple::Bitrate, aud::rdiv<int64_t>(8 * size, length));
+        }
+    }
+}
+
+/* Fills in the same fields as read_mpg123_info(), from the headers alone.
+ * The decoder is still needed when the headers are unclear, and when
+ * full_scan asks for an exact length that no tag or saved index gives. */
+static bool read_header_info (const char * filename, VFSFile & file, Tuple & tuple)
+{
+    int64_t size = file.fsize ();
+    MP3Info info;
+
+    if (! mp3_read_info (file, size, info))
+        return false;
+
+    SeekIndex index;
+    if (seek_index_load (filename, index))
+        info.samples = index.samples;
+    else if (! info.exact && aud_get_bool ("mpg123", "full_scan"))
+        return false;
+
+    set_info_fields (tuple, make_format_string (info.version, info.layer),
+     info.channels, info.rate, info.bitrate, info.samples, size);
+
+    return true;
 }
 
 bool MPG123Plugin::is_our_file (const char * filename, VFSFile & file)
@@ -256,23 +597,10 @@ static bool read_mpg123_info (const char * filename, VFSFile & file, Tuple & tup
     if (! s.init (filename, file, false, stream))
         return false;
 
-    tuple.set_str (Tuple::Codec, make_format_string (& s.info));
-    tuple.set_str (Tuple::Quality, str_printf ("%s, %d Hz", (s.channels == 2) ?
-     _("Stereo") : (s.channels > 2) ? _("Surround") : _("Mono"), (int) s.rate));
-    tuple.set_int (Tuple::Bitrate, s.info.bitrate);
-    tuple.set_int(Tuple::Channels, s.channels);
+    int64_t samples = s.indexed ? s.index.samples : stream ? 0 : mpg123_length (s.dec);
 
-    if (! stream && s.rate > 0)
-    {
-        int64_t samples = mpg123_length (s.dec);
-        int length = aud::rescale<int64_t>(samples, s.rate, 1000);
-
-        if (length > 0)
-        {
-            tuple.set_int (Tuple::Length, length);
-            tuple.set_int (Tuple::Bitrate, aud::rdiv<int64_t>(8 * size, length));
-        }
-    }
+    set_info_fields (tuple, make_format_string (& s.info), s.channels, s.rate,
+     s.info.bitrate, samples, size);
 
     return true;
 }
@@ -280,8 +608,16 @@ static bool read_mpg123_info (const char * filename, VFSFile & file, Tuple & tup
 bool MPG123Plugin::read_tag (const char * filename, VFSFile & file, Tuple & tuple, Index<char> * image)
 {
     bool stream = (file.fsize () < 0);
+    bool found = false;
+
+    if (! stream)
+    {
+        found = read_header_info (filename, file, tuple);
+        if (! found && file.fseek (0, VFS_SEEK_SET) != 0)
+            return false;
+    }
 
-    if (! read_mpg123_info (filename, file, tuple))
+    if (! found && ! read_mpg123_info (filename, file, tuple))
         return false;
 
     if (stream)
@@ -327,6 +663,11 @@ bool MPG123Plugin::play (const char * filename, VFSFile & file)
     if (stream && tuple.fetch_stream_info (file))
         set_playback_tuple (tuple.ref ());
 
+    /* exact seeking in VBR files needs the frame index; build it now, to be
+     * used from the next seek on */
+    if (! stream && ! s.indexed && s.info.vbr != MPG123_CBR)
+        seek_index_build_async (filename);
+
     open_audio (FMT_FLOAT, s.rate, s.channels);
 
     while (! check_stop ())
@@ -335,6 +676,9 @@ bool MPG123Plugin::play (const char * filename, VFSFile & file)
 
         if (seek >= 0)
         {
+            if (! s.indexed && seek_index_take (filename, s.index))
+                s.indexed = set_index (s.dec, s.index);
+
             int64_t sample = aud::rescale<int64_t>(seek, 1000, s.rate);
             if (mpg123_seek (s.dec, sample, SEEK_SET) < 0)
                 print_mpg123_error (filename, s.dec);
@@ -20,12 +20,15 @@
  * the use of this software.
  */
 
+#include <atomic>
 #include <cmath>
+#include <time.h>
 
 #include <pipewire/pipewire.h>
 #include <spa/param/audio/format-utils.h>
 #include <spa/param/props.h>
 
+#include <libfauxdcore/hook.h>
 #include <libfauxdcore/i18n.h>
 #include <libfauxdcore/plugin.h>
 #include <libfauxdcore/runtime.h>
@@ -34,6 +37,18 @@
   #define PW_KEY_NODE_RATE "node.rate"
 #endif
 
+// Breakdown of the output delay, in milliseconds
+struct PipeWireDelay
+{
+    int staging;  // still in our own ring buffer
+    int stream;   // queued in stream buffers or the stream's resampler
+    int graph;    // graph and device latency as reported by the driver
+    bool clocked; // false if the stream has not reported timing yet
+
+    int total() const
+        { return staging + stream + graph; }
+};
+
 class PipeWireOutput : public OutputPlugin
 {
 public:
@@ -63,6 +78,7 @@ public:
     void drain();
 
     int get_delay();
+    PipeWireDelay get_delay_info();
 
     void pause(bool pause);
     void flush();
@@ -83,6 +99,11 @@ private:
     static void on_process(void * data);
     static void on_drained(void * data);
 
+    unsigned int ring_used();
+    bool flush_in_progress();
+    unsigned int ring_read(void * dst, unsigned int length);
+    void ring_reset();
+
     static enum spa_audio_format to_pipewire_format(int format);
     template<typename SPAINF>
     static void set_channel_map(SPAINF * info, int channels);
@@ -103,10 +124,20 @@ private:
 
     int m_aud_format = 0;
     int m_core_init_seq = 0;
-
+    std::atomic<int64_t> m_last_graph_delay {-1};
+
+    // Single-producer/single-consumer ring between write_audio() and the
+    // realtime process callback.  The positions are free-running byte
+    // counters; only their difference (modulo m_buffer_size) matters.
+    // A flush from the producer side is handed to the consumer through
+    // m_flush_pos/m_flush_pending so that neither side takes a lock; the
+    // producer writes nothing more until the callback has taken it.
     unsigned char * m_buffer = nullptr;
-    unsigned int m_buffer_at = 0;
     unsigned int m_buffer_size = 0;
+    std::atomic<unsigned int> m_read_pos {0};
+    std::atomic<unsigned int> m_write_pos {0};
+    std::atomic<unsigned int> m_flush_pos {0};
+    std::atomic<bool> m_flush_pending {false};
     unsigned int m_frames = 0;
     unsigned int m_stride = 0;
     unsigned int m_rate = 0;
@@ -163,15 +194,130 @@ void PipeWireOutput::pause(bool pause)
     pw_thread_loop_unlock(m_loop);
 }
 
+// Called from the producer side only: bytes not yet consumed by the
+// process callback, counting a pending flush as already consumed.
+unsigned int PipeWireOutput::ring_used()
+{
+    unsigned int read_pos = m_flush_pending.load(std::memory_order_acquire)
+                          ? m_flush_pos.load(std::memory_order_relaxed)
+                          : m_read_pos.load(std::memory_order_acquire);
+
+    return m_write_pos.load(std::memory_order_relaxed) - read_pos;
+}
+
+// Called from the producer side only: true while the process callback may
+// still be reading the part of the ring that a flush handed back, so that
+// writing into it must wait.  A stream that is not streaming (paused, or not
+// yet started) runs no callback; it takes the flush when it resumes.
+bool PipeWireOutput::flush_in_progress()
+{
+    if (!m_flush_pending.load(std::memory_order_acquire))
+        return false;
+
+    pw_thread_loop_lock(m_loop);
+    bool streaming = (pw_stream_get_state(m_stream, nullptr) == PW_STREAM_STATE_STREAMING);
+    pw_thread_loop_unlock(m_loop);
+
+    return streaming && m_flush_pending.load(std::memory_order_acquire);
+}
+
+// Called from the process callback only.
+unsigned int PipeWireOutput::ring_read(void * dst, unsigned int length)
+{
+    if (m_flush_pending.exchange(false, std::memory_order_acquire))
+        m_read_pos.store(m_flush_pos.load(std::memory_order_relaxed),
+                         std::memory_order_release);
+
+    unsigned int read_pos = m_read_pos.load(std::memory_order_relaxed);
+    unsigned int used = m_write_pos.load(std::memory_order_acquire) - read_pos;
+
+    length = aud::min(length, used);
+    length -= length % m_stride;
+
+    unsigned int offset = read_pos % m_buffer_size;
+    unsigned int part = aud::min(length, m_buffer_size - offset);
+
+    memcpy(dst, m_buffer + offset, part);
+    memcpy((unsigned char *)dst + part, m_buffer, length - part);
+
+    m_read_pos.store(read_pos + length, std::memory_order_release);
+    return length;
+}
+
+void PipeWireOutput::ring_reset()
+{
+    m_read_pos.store(0, std::memory_order_relaxed);
+    m_write_pos.store(0, std::memory_order_relaxed);
+    m_flush_pos.store(0, std::memory_order_relaxed);
+    m_flush_pending.store(false, std::memory_order_relaxed);
+}
+
+PipeWireDelay PipeWireOutput::get_delay_info()
+{
+    PipeWireDelay d {};
+    d.staging = aud::rescale<int64_t>(ring_used() / m_stride, m_rate, 1000);
+
+    struct pw_time t {};
+#if PW_CHECK_VERSION(0, 3, 50)
+    int res = pw_stream_get_time_n(m_stream, &t, sizeof t);
+#else
+    int res = pw_stream_get_time(m_stream, &t);
+#endif
+
+    if (res < 0 || !t.rate.denom || !t.now)
+    {
+        // no timing yet; assume one full quantum in flight
+        d.graph = aud::rescale<int64_t>(m_frames, m_rate, 1000);
+        return d;
+    }
+
+    d.clocked = true;
+
+    // on_process() sets each buffer's size in frames
+    int64_t stream_frames = t.queued;
+#if PW_CHECK_VERSION(0, 3, 50)
+    stream_frames += t.buffered;
+#endif
+    d.stream = aud::rescale<int64_t>(stream_frames, m_rate, 1000);
+
+    // t.delay is in graph ticks (t.rate) and was sampled at t.now;
+    // subtract what has been played since then
+    int64_t graph_ns = t.delay * SPA_NSEC_PER_SEC * t.rate.num / t.rate.denom;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    int64_t elapsed = SPA_TIMESPEC_TO_NSEC(&ts) - t.now;
+
+    if (elapsed > 0)
+        graph_ns -= elapsed;
+
+    d.graph = aud::max<int64_t>(graph_ns, 0) / SPA_NSEC_PER_MSEC;
+    return d;
+}
+
 int PipeWireOutput::get_delay()
 {
-    return (m_buffer_at / m_stride + m_frames) * 1000 / m_rate;
+    PipeWireDelay d = get_delay_info();
+
+    // Each time the graph part moves by 10 ms or more, the breakdown is
+    // passed to the "pipewire delay" hook as int[4] = {total, staging,
+    // stream, graph}, in milliseconds, for anyone tracking A/V sync.
+    if (d.clocked && d.graph / 10 != m_last_graph_delay.exchange(d.graph) / 10)
+    {
+        int parts[4] = {d.total(), d.staging, d.stream, d.graph};
+
+        AUDDBG("PipeWireOutput: delay %d ms (staging %d, stream %d, graph %d)\n",
+               parts[0], parts[1], parts[2], parts[3]);
+        hook_call("pipewire delay", parts);
+    }
+
+    return d.total();
 }
 
 void PipeWireOutput::drain()
 {
     pw_thread_loop_lock(m_loop);
-    if (m_buffer_at > 0)
+    if (ring_used() > 0)
         pw_thread_loop_timed_wait(m_loop, 2);
 
     pw_stream_flush(m_stream, true);
@@ -181,31 +327,43 @@ void PipeWireOutput::drain()
 
 void PipeWireOutput::flush()
 {
+    // The process callback discards everything up to this point the next
+    // time it runs; until then, ring_used() already treats it as gone.
+    m_flush_pos.store(m_write_pos.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    m_flush_pending.store(true, std::memory_order_release);
+
     pw_thread_loop_lock(m_loop);
-    m_buffer_at = 0;
-    pw_thread_loop_unlock(m_loop);
     pw_stream_flush(m_stream, false);
+    pw_thread_loop_unlock(m_loop);
 }
 
 void PipeWireOutput::period_wait()
 {
-    if (m_buffer_at != m_buffer_size)
+    if (ring_used() != m_buffer_size && !flush_in_progress())
         return;
 
     pw_thread_loop_lock(m_loop);
-    pw_thread_loop_timed_wait(m_loop, 1);
+    if (ring_used() == m_buffer_size || m_flush_pending.load(std::memory_order_acquire))
+        pw_thread_loop_timed_wait(m_loop, 1);
     pw_thread_loop_unlock(m_loop);
 }
 
 int PipeWireOutput::write_audio(const void * data, int length)
 {
-    pw_thread_loop_lock(m_loop);
+    // not until the process callback has let go of the flushed data
+    if (flush_in_progress())
+        return 0;
 
-    auto size = aud::min<size_t>(m_buffer_size - m_buffer_at, length);
-    memcpy(m_buffer + m_buffer_at, data, size);
-    m_buffer_at += size;
+    unsigned int write_pos = m_write_pos.load(std::memory_order_relaxed);
+    unsigned int size = aud::min<unsigned int>(m_buffer_size - ring_used(), length);
 
-    pw_thread_loop_unlock(m_loop);
+    unsigned int offset = write_pos % m_buffer_size;
+    unsigned int part = aud::min(size, m_buffer_size - offset);
+
+    memcpy(m_buffer + offset, data, part);
+    memcpy(m_buffer, (const unsigned char *)data + part, size - part);
+
+    m_write_pos.store(write_pos + size, std::memory_order_release);
     return size;
 }
 
@@ -348,6 +506,8 @@ bool PipeWireOutput::init_core()
     m_frames = aud::clamp<int>(64, ceilf(2048 * m_rate / 48000.0f), 8192);
     m_buffer_size = m_frames * m_stride;
     m_buffer = new unsigned char[m_buffer_size];
+    ring_reset();
+    m_last_graph_delay = -1;
 
     return true;
 }
@@ -509,7 +669,9 @@ void PipeWireOutput::on_process(void * data)
     struct spa_buffer * buf;
     void * dst;
 
-    if (!o->m_buffer_at)
+    if (o->m_write_pos.load(std::memory_order_acquire) ==
+        o->m_read_pos.load(std::memory_order_relaxed) &&
+        !o->m_flush_pending.load(std::memory_order_relaxed))
     {
         pw_thread_loop_signal(o->m_loop, false);
         return;
@@ -526,17 +688,22 @@ void PipeWireOutput::on_process(void * data)
     if (!(dst = buf->datas[0].data))
     {
         AUDWARN("PipeWireOutput: no data pointer\n");
+        pw_stream_queue_buffer(o->m_stream, b);
         return;
     }
 
-    auto size = aud::min<uint32_t>(buf->datas[0].maxsize, o->m_buffer_at);
-    memcpy(dst, o->m_buffer, size);
-    o->m_buffer_at -= size;
-    memmove(o->m_buffer, o->m_buffer + size, o->m_buffer_at);
+    uint32_t size = buf->datas[0].maxsize;
+#if PW_CHECK_VERSION(0, 3, 49)
+    if (b->requested)
+        size = aud::min<uint32_t>(size, b->requested * o->m_stride);
+#endif
+
+    size = o->ring_read(dst, size);
 
-    b->buffer->datas[0].chunk->offset = 0;
-    b->buffer->datas[0].chunk->size = o->m_buffer_size;
-    b->buffer->datas[0].chunk->stride = o->m_stride;
+    buf->datas[0].chunk->offset = 0;
+    buf->datas[0].chunk->size = size;
+    buf->datas[0].chunk->stride = o->m_stride;
+    b->size = size / o->m_stride;
 
     pw_stream_queue_buffer(o->m_stream, b);
     pw_thread_loop_signal(o->m_loop, false);
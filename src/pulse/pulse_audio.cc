@@ -20,7 +20,6 @@
   USA.
 ***/
 
-#include <condition_variable>
 #include <mutex>
 
 #include <pulse/pulseaudio.h>
@@ -90,20 +89,32 @@ const char * const PulseOutput::prefs_defaults[] = {
     nullptr
 };
 
+/* pulse_mutex guards the connection as a whole (opening and closing it) and
+ * the saved volume, which must survive while no connection is open.  All
+ * PulseAudio objects are guarded by the threaded main loop's own lock.  The
+ * audio path (write_audio(), period_wait(), etc.) takes only the latter, so
+ * it is never held up by volume changes, and the main loop thread wakes it
+ * via pa_threaded_mainloop_signal() from the stream callbacks. */
 static std::mutex pulse_mutex;
-static std::condition_variable pulse_cond;
 
 static pa_context * context = nullptr;
 static pa_stream * stream = nullptr;
-static pa_mainloop * mainloop = nullptr;
+static pa_threaded_mainloop * mainloop = nullptr;
 
-static bool connected, flushed, polling;
+static bool connected, flushed;
 
 static pa_cvolume volume;
 
 static StereoVolume saved_volume = {0, 0};
 static bool saved_volume_changed = false;
 
+class LoopLock
+{
+public:
+    LoopLock () { pa_threaded_mainloop_lock (mainloop); }
+    ~LoopLock () { pa_threaded_mainloop_unlock (mainloop); }
+};
+
 /* Check whether the connection is still alive. */
 static bool alive ()
 {
@@ -111,38 +122,13 @@ static bool alive ()
      pa_stream_get_state (stream) == PA_STREAM_READY;
 }
 
-/* Cooperative polling method.  Only one thread calls the actual poll function,
- * and dispatches the events received.  Any other threads simply wait for the
- * first thread to finish. */
-static void poll_events (scoped_lock & lock)
-{
-    if (polling)
-        pulse_cond.wait (lock);
-    else
-    {
-        pa_mainloop_prepare (mainloop, -1);
-
-        polling = true;
-        lock.unlock ();
-
-        pa_mainloop_poll (mainloop);
-
-        lock.lock ();
-        polling = false;
-
-        pa_mainloop_dispatch (mainloop);
-
-        pulse_cond.notify_all ();
-    }
-}
-
 /* Wait for an asynchronous operation to complete.  Return immediately if the
- * connection dies. */
-static bool finish (pa_operation * op, scoped_lock & lock)
+ * connection dies.  Must be called with the main loop locked. */
+static bool finish (pa_operation * op)
 {
     pa_operation_state_t state;
     while ((state = pa_operation_get_state (op)) != PA_OPERATION_DONE && alive ())
-        poll_events (lock);
+        pa_threaded_mainloop_wait (mainloop);
 
     pa_operation_unref (op);
     return (state == PA_OPERATION_DONE);
@@ -154,19 +140,30 @@ static bool finish (pa_operation * op, scoped_lock & lock)
 
 #define CHECK(function, ...) do { \
     auto op = function (__VA_ARGS__, & success); \
-    if (! op || ! finish (op, lock) || ! success) \
+    if (! op || ! finish (op) || ! success) \
+        REPORT (#function); \
+} while (0)
+
+/* Start an asynchronous operation without waiting for it. */
+#define START(function, ...) do { \
+    auto op = function (__VA_ARGS__, nullptr); \
+    if (op) \
+        pa_operation_unref (op); \
+    else \
         REPORT (#function); \
 } while (0)
 
 static void info_cb (pa_context *, const pa_sink_input_info * i, int, void * userdata)
 {
-    if (! i)
-        return;
+    if (i)
+    {
+        volume = i->volume;
 
-    volume = i->volume;
+        if (userdata)
+            * (int *) userdata = 1;
+    }
 
-    if (userdata)
-        * (int *) userdata = 1;
+    pa_threaded_mainloop_signal (mainloop, 0);
 }
 
 static void subscribe_cb (pa_context * c, pa_subscription_event_type t, uint32_t index, void *)
@@ -191,22 +188,30 @@ static void stream_success_cb (pa_stream *, int success, void * userdata)
 {
     if (userdata)
         * (int * ) userdata = success;
+
+    pa_threaded_mainloop_signal (mainloop, 0);
 }
 
 static void context_success_cb (pa_context *, int success, void * userdata)
 {
     if (userdata)
         * (int * ) userdata = success;
+
+    pa_threaded_mainloop_signal (mainloop, 0);
 }
 
+static void context_state_cb (pa_context *, void *)
+    { pa_threaded_mainloop_signal (mainloop, 0); }
+static void stream_state_cb (pa_stream *, void *)
+    { pa_threaded_mainloop_signal (mainloop, 0); }
+static void stream_write_cb (pa_stream *, size_t, void *)
+    { pa_threaded_mainloop_signal (mainloop, 0); }
+
+/* The volume is kept up to date by subscribe_cb(), so there is no need to
+ * query the server here. */
 static void get_volume_locked ()
 {
-    if (! polling)
-    {
-        /* read any pending events to get the lastest volume */
-        while (pa_mainloop_iterate (mainloop, 0, nullptr) > 0)
-            continue;
-    }
+    LoopLock loop_lock;
 
     if (volume.channels == 2)
     {
@@ -232,8 +237,10 @@ StereoVolume PulseOutput::get_volume ()
     return saved_volume;
 }
 
-static void set_volume_locked (scoped_lock & lock)
+static void set_volume_locked ()
 {
+    LoopLock loop_lock;
+
     if (volume.channels != 1)
     {
         volume.values[0] = aud::rescale<int> (saved_volume.left, 100, PA_VOLUME_NORM);
@@ -262,12 +269,12 @@ void PulseOutput::set_volume (StereoVolume v)
     saved_volume_changed = true;
 
     if (connected)
-        set_volume_locked (lock);
+        set_volume_locked ();
 }
 
 void PulseOutput::pause (bool pause)
 {
-    scoped_lock lock (pulse_mutex);
+    LoopLock loop_lock;
 
     int success = 0;
     CHECK (pa_stream_cork, stream, pause, stream_success_cb);
@@ -275,7 +282,7 @@ void PulseOutput::pause (bool pause)
 
 int PulseOutput::get_delay ()
 {
-    scoped_lock lock (pulse_mutex);
+    LoopLock loop_lock;
 
     pa_usec_t usec;
     int neg;
@@ -288,7 +295,7 @@ int PulseOutput::get_delay ()
 
 void PulseOutput::drain ()
 {
-    scoped_lock lock (pulse_mutex);
+    LoopLock loop_lock;
 
     int success = 0;
     CHECK (pa_stream_drain, stream, stream_success_cb);
@@ -296,53 +303,81 @@ void PulseOutput::drain ()
 
 void PulseOutput::flush ()
 {
-    scoped_lock lock (pulse_mutex);
+    LoopLock loop_lock;
 
     int success = 0;
     CHECK (pa_stream_flush, stream, stream_success_cb);
 
     /* wake up period_wait() */
     flushed = true;
-    if (polling)
-        pa_mainloop_wakeup (mainloop);
+    pa_threaded_mainloop_signal (mainloop, 0);
 }
 
 void PulseOutput::period_wait ()
 {
-    scoped_lock lock (pulse_mutex);
+    LoopLock loop_lock;
 
-    int success = 0;
-    CHECK (pa_stream_trigger, stream, stream_success_cb);
+    START (pa_stream_trigger, stream, nullptr);
 
-    /* if the connection dies, wait until flush() is called */
+    /* stream_write_cb() signals when there is room again;
+     * if the connection dies, wait until flush() is called */
     while ((! pa_stream_writable_size (stream) || ! alive ()) && ! flushed)
-        poll_events (lock);
+        pa_threaded_mainloop_wait (mainloop);
 }
 
 int PulseOutput::write_audio (const void * ptr, int length)
 {
-    scoped_lock lock (pulse_mutex);
+    LoopLock loop_lock;
     int ret = 0;
 
+    size_t frame = pa_frame_size (pa_stream_get_sample_spec (stream));
     length = aud::min ((size_t) length, pa_stream_writable_size (stream));
 
-    if (pa_stream_write (stream, ptr, length, nullptr, 0, PA_SEEK_RELATIVE) < 0)
-        REPORT ("pa_stream_write");
-    else
-        ret = length;
+    /* copy straight into memory provided by the server */
+    while (ret < length)
+    {
+        void * buf;
+        size_t size = length - ret;
+
+        if (pa_stream_begin_write (stream, & buf, & size) < 0)
+        {
+            REPORT ("pa_stream_begin_write");
+            break;
+        }
+
+        size = aud::min (size, (size_t) (length - ret));
+        size -= size % frame;
+
+        if (! size)
+        {
+            pa_stream_cancel_write (stream);
+            break;
+        }
+
+        memcpy (buf, (const char *) ptr + ret, size);
+
+        if (pa_stream_write (stream, buf, size, nullptr, 0, PA_SEEK_RELATIVE) < 0)
+        {
+            REPORT ("pa_stream_write");
+            break;
+        }
+
+        ret += size;
+    }
 
     flushed = false;
     return ret;
 }
 
-static void close_audio_locked (scoped_lock & lock)
+static void close_audio_locked ()
 {
-    /* wait for any parallel tasks (e.g. set_volume()) to complete */
-    while (polling)
-        pulse_cond.wait (lock);
-
     connected = false;
 
+    if (! mainloop)
+        return;
+
+    pa_threaded_mainloop_lock (mainloop);
+
     if (stream)
     {
         pa_stream_disconnect (stream);
@@ -357,17 +392,17 @@ static void close_audio_locked (scoped_lock & lock)
         context = nullptr;
     }
 
-    if (mainloop)
-    {
-        pa_mainloop_free (mainloop);
-        mainloop = nullptr;
-    }
+    pa_threaded_mainloop_unlock (mainloop);
+    pa_threaded_mainloop_stop (mainloop);
+
+    pa_threaded_mainloop_free (mainloop);
+    mainloop = nullptr;
 }
 
 void PulseOutput::close_audio ()
 {
     scoped_lock lock (pulse_mutex);
-    close_audio_locked (lock);
+    close_audio_locked ();
 }
 
 static pa_sample_format_t to_pulse_format (int aformat)
@@ -424,20 +459,17 @@ static String get_context_name ()
     return context_name;
 }
 
-static bool create_context (scoped_lock & lock)
+/* called with the main loop locked */
+static bool create_context ()
 {
-    if (! (mainloop = pa_mainloop_new ()))
-    {
-        AUDERR ("Failed to allocate main loop\n");
-        return false;
-    }
-
-    if (! (context = pa_context_new (pa_mainloop_get_api (mainloop), get_context_name ())))
+    if (! (context = pa_context_new (pa_threaded_mainloop_get_api (mainloop), get_context_name ())))
     {
         AUDERR ("Failed to allocate context\n");
         return false;
     }
 
+    pa_context_set_state_callback (context, context_state_cb, nullptr);
+
     if (pa_context_connect (context, nullptr, (pa_context_flags_t) 0, nullptr) < 0)
     {
         REPORT ("pa_context_connect");
@@ -454,7 +486,7 @@ static bool create_context (scoped_lock & lock)
             return false;
         }
 
-        poll_events (lock);
+        pa_threaded_mainloop_wait (mainloop);
     }
 
     return true;
@@ -470,7 +502,8 @@ static String get_stream_name ()
     return stream_name;
 }
 
-static bool create_stream (scoped_lock & lock, const pa_sample_spec & ss)
+/* called with the main loop locked */
+static bool create_stream (const pa_sample_spec & ss)
 {
     if (! (stream = pa_stream_new (context, get_stream_name (), & ss, nullptr)))
     {
@@ -478,6 +511,9 @@ static bool create_stream (scoped_lock & lock, const pa_sample_spec & ss)
         return false;
     }
 
+    pa_stream_set_state_callback (stream, stream_state_cb, nullptr);
+    pa_stream_set_write_callback (stream, stream_write_cb, nullptr);
+
     /* Connect stream with sink and default volume */
     pa_buffer_attr buffer;
     set_buffer_attr (buffer, ss);
@@ -499,13 +535,14 @@ static bool create_stream (scoped_lock & lock, const pa_sample_spec & ss)
             return false;
         }
 
-        poll_events (lock);
+        pa_threaded_mainloop_wait (mainloop);
     }
 
     return true;
 }
 
-static bool subscribe_events (scoped_lock & lock)
+/* called with the main loop locked */
+static bool subscribe_events ()
 {
     pa_context_set_subscribe_callback (context, subscribe_cb, nullptr);
 
@@ -532,11 +569,29 @@ bool PulseOutput::open_audio (int fmt, int rate, int nch, String & error)
     if (! set_sample_spec (ss, fmt, rate, nch))
         return false;
 
-    if (! create_context (lock) ||
-        ! create_stream (lock, ss) ||
-        ! subscribe_events (lock))
+    if (! (mainloop = pa_threaded_mainloop_new ()))
+    {
+        AUDERR ("Failed to allocate main loop\n");
+        return false;
+    }
+
+    if (pa_threaded_mainloop_start (mainloop) < 0)
+    {
+        AUDERR ("Failed to start main loop\n");
+        pa_threaded_mainloop_free (mainloop);
+        mainloop = nullptr;
+        return false;
+    }
+
+    pa_threaded_mainloop_lock (mainloop);
+
+    bool success = create_context () && create_stream (ss) && subscribe_events ();
+
+    pa_threaded_mainloop_unlock (mainloop);
+
+    if (! success)
     {
-        close_audio_locked (lock);
+        close_audio_locked ();
         return false;
     }
 
@@ -544,7 +599,7 @@ bool PulseOutput::open_audio (int fmt, int rate, int nch, String & error)
     flushed = true;
 
     if (saved_volume_changed)
-        set_volume_locked (lock);
+        set_volume_locked ();
     else
         get_volume_locked ();
 
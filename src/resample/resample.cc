@@ -25,6 +25,9 @@
 #include <libfauxdcore/preferences.h>
 #include <libfauxdcore/audstrings.h>
 
+#include "../dsp/dsp.h"
+#include "../dsp/sinc-resampler.h"
+
 #define MIN_RATE 8000
 #define MAX_RATE 192000
 #define RATE_STEP 50
@@ -68,6 +71,11 @@ EXPORT Resampler aud_plugin_instance;
 
 const char * const Resampler::defaults[] = {
  "method", aud::numeric_string<SRC_SINC_FASTEST>::str,
+#ifdef DEF_AUDIO_FLOAT64
+ "builtin", "TRUE",
+#else
+ "builtin", "FALSE",
+#endif
  "default-rate", "44100",
  "use-mappings", "FALSE",
  "8000", "48000",
@@ -83,6 +91,8 @@ const char * const Resampler::defaults[] = {
  nullptr};
 
 static SRC_STATE * state;
+static SincResampler sinc;
+static bool use_sinc;
 static int stored_channels;
 static double ratio;
 static Index<audio_sample> outbuffer;
@@ -101,6 +111,7 @@ void Resampler::cleanup ()
         state = nullptr;
     }
 
+    sinc.clear ();
     outbuffer.clear ();
 }
 
@@ -112,6 +123,8 @@ void Resampler::start (int & channels, int & rate)
         state = nullptr;
     }
 
+    use_sinc = false;
+
     int new_rate = 0;
 
     if (aud_get_bool ("resample", "use-mappings"))
@@ -126,6 +139,23 @@ void Resampler::start (int & channels, int & rate)
         return;
 
     int method = aud_get_int ("resample", "method");
+
+    if (aud_get_bool ("resample", "builtin"))
+    {
+        /* the built-in resampler only does sinc; the other methods get the
+         * fastest one */
+        auto quality = (method == SRC_SINC_BEST_QUALITY) ? SincResampler::Best :
+         (method == SRC_SINC_MEDIUM_QUALITY) ? SincResampler::Medium : SincResampler::Fast;
+
+        sinc.setup (channels, quality);
+        use_sinc = true;
+
+        stored_channels = channels;
+        ratio = (double) new_rate / rate;
+        rate = new_rate;
+        return;
+    }
+
     int error;
 
     if ((state = src_new (method, channels, & error)) == nullptr)
@@ -141,19 +171,20 @@ void Resampler::start (int & channels, int & rate)
 
 Index<audio_sample> & Resampler::resample (Index<audio_sample> & data, bool finish)
 {
+    if (use_sinc)
+    {
+        outbuffer.resize (0);
+        sinc.process (data.begin (), data.len () / stored_channels, ratio, finish, outbuffer);
+        return outbuffer;
+    }
+
     if (! state || ! data.len ())
         return data;
 
 #ifdef DEF_AUDIO_FLOAT64
     static Index<float> floatbuf_in;
     floatbuf_in.resize (data.len ());
-    float * fout = floatbuf_in.begin ();
-    audio_sample * fin = data.begin ();
-    const audio_sample * fend = data.end ();
-    while (fin < fend)
-    {
-        *(fout++) = *(fin++);
-    }
+    dsp_to_float (data.begin (), floatbuf_in.begin (), data.len ());
     static Index<float> floatbuf_out;
     floatbuf_out.resize ((int) (data.len () * ratio) + 256);
 
@@ -185,13 +216,7 @@ Index<audio_sample> & Resampler::resample (Index<audio_sample> & data, bool fini
 #ifdef DEF_AUDIO_FLOAT64
     floatbuf_in.resize (0);
     outbuffer.resize (stored_channels * srcd.output_frames_gen);
-    float * ain = floatbuf_out.begin ();
-    audio_sample * aout = outbuffer.begin ();
-    const audio_sample * aend = aout + (stored_channels * srcd.output_frames_gen);
-    while (aout < aend)
-    {
-        *(aout++) = *(ain++);
-    }
+    dsp_from_float (floatbuf_out.begin (), outbuffer.begin (), outbuffer.len ());
     floatbuf_out.resize (0);
 #else
     outbuffer.resize (stored_channels * srcd.output_frames_gen);
@@ -205,6 +230,9 @@ Index<audio_sample> & Resampler::resample (Index<audio_sample> & data, bool fini
 
 bool Resampler::flush (bool force)
 {
+    if (use_sinc)
+        sinc.reset ();
+
     int error;
     if (state && (error = src_reset (state)))
         RESAMPLE_ERROR (error);
@@ -230,6 +258,8 @@ const PreferencesWidget Resampler::widgets[] = {
     WidgetCombo (N_("Method:"),
         WidgetInt ("resample", "method"),
         {{method_list}}),
+    WidgetCheck (N_("Use built-in resampler (full precision)"),
+        WidgetBool ("resample", "builtin")),
     WidgetSpin (N_("Rate:"),
         WidgetInt ("resample", "default-rate"),
         {MIN_RATE, MAX_RATE, RATE_STEP, N_("Hz")}),
@@ -22,18 +22,22 @@
 
 #include <math.h>
 #include <pthread.h>
+#include <semaphore.h>
 #include <string.h>
 #include <sys/time.h>
 
+#include <atomic>
+
 #include <SDL.h>
 #include <SDL_audio.h>
 
 #include <libfauxdcore/audstrings.h>
 #include <libfauxdcore/i18n.h>
 #include <libfauxdcore/plugin.h>
-#include <libfauxdcore/ringbuf.h>
 #include <libfauxdcore/runtime.h>
 
+#include "volume.h"
+
 #define VOLUME_RANGE 40 /* decibels */
 
 class SDLOutput : public OutputPlugin
@@ -80,19 +84,29 @@ const char * const SDLOutput::defaults[] = {
  "vol_right", "100",
  nullptr};
 
+/* The audio callback never takes sdlout_mutex.  The buffer between
+ * write_audio() and the callback is a single-producer/single-consumer ring
+ * with atomic read/write positions (free-running byte counters).  When
+ * period_wait() or drain() need to wait for the callback, they set
+ * sdlout_waiting and sleep on sdlout_sem, which the callback posts only if
+ * it finds that flag set.  sdlout_mutex now just serializes the control
+ * functions among themselves. */
 static pthread_mutex_t sdlout_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t sdlout_cond = PTHREAD_COND_INITIALIZER;
+static sem_t sdlout_sem;
+static std::atomic<bool> sdlout_waiting;
 
-static volatile int vol_left, vol_right;
+static std::atomic<int> vol_left, vol_right;
 
-static int sdlout_chan, sdlout_rate;
+static int sdlout_format, sdlout_chan, sdlout_rate, sdlout_frame;
 
-static RingBuf<unsigned char> buffer;
+static unsigned char * buffer;
+static unsigned buffer_size;
+static std::atomic<unsigned> read_pos, write_pos;
 
 static bool prebuffer_flag, paused_flag;
 
-static int block_delay;
-static struct timeval block_time;
+static std::atomic<int> block_delay;
+static std::atomic<int64_t> block_time; /* microseconds */
 #if SDL == 2
 static SDL_AudioDeviceID ouraudiodevice;  // JWT:ADDED FOR SDL2.
 #endif
@@ -110,6 +124,7 @@ bool SDLOutput::init ()
         return false;
     }
 
+    sem_init (& sdlout_sem, 0, 0);
     return true;
 }
 
@@ -119,6 +134,7 @@ void SDLOutput::cleanup ()
     SDL_Quit ();
     */
     SDL_QuitSubSystem (SDL_INIT_AUDIO);
+    sem_destroy (& sdlout_sem);
 }
 
 StereoVolume SDLOutput::get_volume ()
@@ -135,52 +151,71 @@ void SDLOutput::set_volume (StereoVolume v)
     aud_set_int ("sdlout", "vol_right", v.right);
 }
 
-static void apply_mono_volume (unsigned char * data, int len)
+static float volume_factor (int vol)
 {
-    int vol = aud::max (vol_left, vol_right);
-    int factor = (vol == 0) ? 0 : powf (10, (float) VOLUME_RANGE * (vol - 100)
-     / 100 / 20) * 65536;
+    return (vol == 0) ? 0 : powf (10, (float) VOLUME_RANGE * (vol - 100) / 100 / 20);
+}
 
-    int16_t * i = (int16_t *) data;
-    const int16_t * end = (int16_t *) (data + len);
+static int64_t time_usec ()
+{
+    struct timeval tv;
+    gettimeofday (& tv, nullptr);
+    return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
 
-    while (i < end)
-    {
-        * i = ((int) * i * factor) >> 16;
-        i ++;
-    }
+static int buffer_len ()
+{
+    return write_pos.load (std::memory_order_acquire) - read_pos.load (std::memory_order_acquire);
 }
 
-static void apply_stereo_volume (unsigned char * data, int len)
+/* wakes up period_wait() or drain(), if either is waiting */
+static void wake_waiter ()
 {
-    int factor_left = (vol_left == 0) ? 0 : powf (10, (float) VOLUME_RANGE *
-     (vol_left - 100) / 100 / 20) * 65536;
-    int factor_right = (vol_right == 0) ? 0 : powf (10, (float) VOLUME_RANGE *
-     (vol_right - 100) / 100 / 20) * 65536;
+    std::atomic_thread_fence (std::memory_order_seq_cst);
 
-    int16_t * i = (int16_t *) data;
-    const int16_t * end = (int16_t *) (data + len);
+    if (sdlout_waiting.exchange (false))
+        sem_post (& sdlout_sem);
+}
+
+/* waits until woken up; returns at once if <ready> became true meanwhile */
+template<class F>
+static void wait_until (F ready)
+{
+    sdlout_waiting.store (true);
+    std::atomic_thread_fence (std::memory_order_seq_cst);
 
-    while (i < end)
+    if (! ready ())
     {
-        * i = ((int) * i * factor_left) >> 16;
-        i ++;
-        * i = ((int) * i * factor_right) >> 16;
-        i ++;
+        pthread_mutex_unlock (& sdlout_mutex);
+        sem_wait (& sdlout_sem);
+        pthread_mutex_lock (& sdlout_mutex);
     }
+    else if (! sdlout_waiting.exchange (false))
+        sem_wait (& sdlout_sem); /* consume the post we raced with */
 }
 
 static void callback (void * user, unsigned char * buf, int len)
 {
-    pthread_mutex_lock (& sdlout_mutex);
+    unsigned pos = read_pos.load (std::memory_order_relaxed);
+    int copy = aud::min (len, buffer_len ());
+
+    unsigned offset = pos % buffer_size;
+    int part = aud::min (copy, (int) (buffer_size - offset));
+
+    memcpy (buf, buffer + offset, part);
+    memcpy (buf + part, buffer, copy - part);
+
+    read_pos.store (pos + copy, std::memory_order_release);
+
+    int left = vol_left.load (std::memory_order_relaxed);
+    int right = vol_right.load (std::memory_order_relaxed);
 
-    int copy = aud::min (len, buffer.len ());
-    buffer.move_out (buf, copy);
+    if (sdlout_chan != 2)
+        left = right = aud::max (left, right);
 
-    if (sdlout_chan == 2)
-        apply_stereo_volume (buf, copy);
-    else
-        apply_mono_volume (buf, copy);
+    if (left != 100 || right != 100)
+        apply_volume (buf, copy / FMT_SIZEOF (sdlout_format), sdlout_format,
+         sdlout_chan, volume_factor (left), volume_factor (right));
 
     if (copy < len)
         memset (buf + copy, 0, len - copy);
@@ -188,11 +223,10 @@ static void callback (void * user, unsigned char * buf, int len)
     /* At this moment, we know that there is a delay of (at least) the block of
      * data just written.  We save the block size and the current time for
      * estimating the delay later on. */
-    block_delay = aud::rescale (copy / (2 * sdlout_chan), sdlout_rate, 1000);
-    gettimeofday (& block_time, nullptr);
+    block_delay.store (aud::rescale (copy / sdlout_frame, sdlout_rate, 1000));
+    block_time.store (time_usec ());
 
-    pthread_cond_broadcast (& sdlout_cond);
-    pthread_mutex_unlock (& sdlout_mutex);
+    wake_waiter ();
 }
 
 bool SDLOutput::open_audio (int format, int rate, int chan, String & error)
@@ -223,11 +257,17 @@ bool SDLOutput::open_audio (int format, int rate, int chan, String & error)
 
     AUDDBG ("Opening audio for %d channels, %d Hz.\n", chan, rate);
 
+    sdlout_format = format;
     sdlout_chan = chan;
     sdlout_rate = rate;
+    sdlout_frame = FMT_SIZEOF (format) * chan;
 
     int buffer_ms = aud_get_int (nullptr, "output_buffer_size");
-    buffer.alloc (2 * chan * aud::rescale (buffer_ms, 1000, rate));
+    buffer_size = sdlout_frame * aud::rescale (buffer_ms, 1000, rate);
+    buffer = new unsigned char[buffer_size];
+    read_pos = 0;
+    write_pos = 0;
+    block_delay = 0;
 
     prebuffer_flag = true;
     paused_flag = false;
@@ -251,7 +291,8 @@ bool SDLOutput::open_audio (int format, int rate, int chan, String & error)
     {
         error = String (str_printf
          ("SDL error: Failed to open audio stream: %s.", SDL_GetError ()));
-        buffer.destroy ();
+        delete[] buffer;
+        buffer = nullptr;
         return false;
     }
 #if SDL == 2
@@ -272,7 +313,8 @@ void SDLOutput::close_audio ()
     SDL_CloseAudio ();
 #endif
 
-    buffer.destroy ();
+    delete[] buffer;
+    buffer = nullptr;
 }
 
 static void check_started ()
@@ -293,14 +335,19 @@ static void check_started ()
 
 void SDLOutput::period_wait ()
 {
+    auto has_space = [] () { return buffer_len () < (int) buffer_size; };
+
+    if (has_space ())
+        return;
+
     pthread_mutex_lock (& sdlout_mutex);
 
-    while (! buffer.space ())
+    while (! has_space ())
     {
         if (! paused_flag)
             check_started ();
 
-        pthread_cond_wait (& sdlout_cond, & sdlout_mutex);
+        wait_until (has_space);
     }
 
     pthread_mutex_unlock (& sdlout_mutex);
@@ -308,12 +355,16 @@ void SDLOutput::period_wait ()
 
 int SDLOutput::write_audio (const void * data, int len)
 {
-    pthread_mutex_lock (& sdlout_mutex);
+    unsigned pos = write_pos.load (std::memory_order_relaxed);
+    len = aud::min (len, (int) buffer_size - buffer_len ());
 
-    len = aud::min (len, buffer.space ());
-    buffer.copy_in ((const unsigned char *) data, len);
+    unsigned offset = pos % buffer_size;
+    int part = aud::min (len, (int) (buffer_size - offset));
 
-    pthread_mutex_unlock (& sdlout_mutex);
+    memcpy (buffer + offset, data, part);
+    memcpy (buffer, (const unsigned char *) data + part, len - part);
+
+    write_pos.store (pos + len, std::memory_order_release);
     return len;
 }
 
@@ -324,28 +375,27 @@ void SDLOutput::drain ()
 
     check_started ();
 
-    while (buffer.len ())
-        pthread_cond_wait (& sdlout_cond, & sdlout_mutex);
+    auto is_empty = [] () { return ! buffer_len (); };
+
+    while (! is_empty ())
+        wait_until (is_empty);
 
     pthread_mutex_unlock (& sdlout_mutex);
 }
 
 int SDLOutput::get_delay ()
 {
-    auto timediff = [] (const timeval & a, const timeval & b) -> int64_t
-        { return 1000 * (int64_t) (b.tv_sec - a.tv_sec) + (b.tv_usec - a.tv_usec) / 1000; };
-
     pthread_mutex_lock (& sdlout_mutex);
 
-    int delay = aud::rescale (buffer.len (), 2 * sdlout_chan * sdlout_rate, 1000);
+    int delay = aud::rescale (buffer_len (), sdlout_frame * sdlout_rate, 1000);
 
     /* Estimate the additional delay of the last block written. */
-    if (! prebuffer_flag && ! paused_flag && block_delay)
-    {
-        struct timeval cur;
-        gettimeofday (& cur, nullptr);
+    int last_delay = block_delay.load ();
 
-        delay += aud::max (block_delay - timediff (block_time, cur), (int64_t) 0);
+    if (! prebuffer_flag && ! paused_flag && last_delay)
+    {
+        int64_t elapsed = (time_usec () - block_time.load ()) / 1000;
+        delay += aud::max (last_delay - elapsed, (int64_t) 0);
     }
 
     pthread_mutex_unlock (& sdlout_mutex);
@@ -366,7 +416,7 @@ void SDLOutput::pause (bool pause)
     if (! prebuffer_flag)
         SDL_PauseAudio (pause);
 #endif
-    pthread_cond_broadcast (& sdlout_cond); /* wake up period wait */
+    wake_waiter (); /* wake up period wait */
     pthread_mutex_unlock (& sdlout_mutex);
 }
 
@@ -375,10 +425,19 @@ void SDLOutput::flush ()
     AUDDBG ("Seek requested; discarding buffer.\n");
     pthread_mutex_lock (& sdlout_mutex);
 
-    buffer.discard ();
+    /* the callback owns read_pos; keep it from running meanwhile */
+#if SDL == 2
+    SDL_LockAudioDevice (ouraudiodevice);
+    read_pos.store (write_pos.load ());
+    SDL_UnlockAudioDevice (ouraudiodevice);
+#else
+    SDL_LockAudio ();
+    read_pos.store (write_pos.load ());
+    SDL_UnlockAudio ();
+#endif
 
     prebuffer_flag = true;
 
-    pthread_cond_broadcast (& sdlout_cond); /* wake up period wait */
+    wake_waiter (); /* wake up period wait */
     pthread_mutex_unlock (& sdlout_mutex);
 }
@@ -0,0 +1,290 @@
+/*
+ * Software volume kernels for the SDL output plugin
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+/*
+ * Software volume kernels.  Each kernel starts at sample <i>, processes as
+ * many whole vectors as it can and returns the index of the first sample not
+ * done; the next (narrower) kernel continues from there.  Since the vector
+ * widths are all even, the left/right gain pattern stays aligned with the
+ * stereo sample order.
+ *
+ * AVX2 is selected at runtime (x86 only); SSE2 and NEON are used whenever
+ * the compiler targets them.
+ */
+
+#include <math.h>
+#include <stdint.h>
+
+#include <libfauxdcore/audio.h>
+#include <libfauxdcore/objects.h>
+
+#include "volume.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_AVX2_DISPATCH
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HAVE_NEON
+#endif
+
+/* largest float below 2^31, so that converting back to int32 cannot overflow */
+static constexpr float S32_LIMIT = 2147483520.0f;
+
+/* ---- scalar ---- */
+
+static void volume_float_c (float * data, int i, int samples, const float gain[2])
+{
+    for (; i < samples; i ++)
+        data[i] *= gain[i & 1];
+}
+
+static void volume_s16_c (int16_t * data, int i, int samples, const float gain[2])
+{
+    for (; i < samples; i ++)
+        data[i] = aud::clamp ((int) lrintf (data[i] * gain[i & 1]), -32768, 32767);
+}
+
+static void volume_s32_c (int32_t * data, int i, int samples, const float gain[2])
+{
+    for (; i < samples; i ++)
+        data[i] = aud::clamp ((int64_t) llrint ((double) data[i] * gain[i & 1]),
+         (int64_t) INT32_MIN, (int64_t) INT32_MAX);
+}
+
+/* ---- SSE2 ---- */
+
+#ifdef __SSE2__
+
+static int volume_float_sse2 (float * data, int i, int samples, const float gain[2])
+{
+    __m128 g = _mm_setr_ps (gain[0], gain[1], gain[0], gain[1]);
+
+    for (; i + 4 <= samples; i += 4)
+        _mm_storeu_ps (data + i, _mm_mul_ps (_mm_loadu_ps (data + i), g));
+
+    return i;
+}
+
+static int volume_s16_sse2 (int16_t * data, int i, int samples, const float gain[2])
+{
+    __m128 g = _mm_setr_ps (gain[0], gain[1], gain[0], gain[1]);
+
+    for (; i + 8 <= samples; i += 8)
+    {
+        __m128i v = _mm_loadu_si128 ((const __m128i *) (data + i));
+        __m128i lo = _mm_srai_epi32 (_mm_unpacklo_epi16 (v, v), 16);
+        __m128i hi = _mm_srai_epi32 (_mm_unpackhi_epi16 (v, v), 16);
+
+        lo = _mm_cvtps_epi32 (_mm_mul_ps (_mm_cvtepi32_ps (lo), g));
+        hi = _mm_cvtps_epi32 (_mm_mul_ps (_mm_cvtepi32_ps (hi), g));
+
+        _mm_storeu_si128 ((__m128i *) (data + i), _mm_packs_epi32 (lo, hi));
+    }
+
+    return i;
+}
+
+static int volume_s32_sse2 (int32_t * data, int i, int samples, const float gain[2])
+{
+    __m128 g = _mm_setr_ps (gain[0], gain[1], gain[0], gain[1]);
+    __m128 limit = _mm_set1_ps (S32_LIMIT);
+
+    for (; i + 4 <= samples; i += 4)
+    {
+        __m128i v = _mm_loadu_si128 ((const __m128i *) (data + i));
+        __m128 f = _mm_min_ps (_mm_mul_ps (_mm_cvtepi32_ps (v), g), limit);
+        _mm_storeu_si128 ((__m128i *) (data + i), _mm_cvtps_epi32 (f));
+    }
+
+    return i;
+}
+
+#endif // __SSE2__
+
+/* ---- AVX2 ---- */
+
+#ifdef HAVE_AVX2_DISPATCH
+
+__attribute__((target("avx2")))
+static int volume_float_avx2 (float * data, int i, int samples, const float gain[2])
+{
+    __m256 g = _mm256_setr_ps (gain[0], gain[1], gain[0], gain[1],
+     gain[0], gain[1], gain[0], gain[1]);
+
+    for (; i + 8 <= samples; i += 8)
+        _mm256_storeu_ps (data + i, _mm256_mul_ps (_mm256_loadu_ps (data + i), g));
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+static int volume_s16_avx2 (int16_t * data, int i, int samples, const float gain[2])
+{
+    __m256 g = _mm256_setr_ps (gain[0], gain[1], gain[0], gain[1],
+     gain[0], gain[1], gain[0], gain[1]);
+
+    for (; i + 16 <= samples; i += 16)
+    {
+        __m256i v = _mm256_loadu_si256 ((const __m256i *) (data + i));
+        __m256i lo = _mm256_cvtepi16_epi32 (_mm256_castsi256_si128 (v));
+        __m256i hi = _mm256_cvtepi16_epi32 (_mm256_extracti128_si256 (v, 1));
+
+        lo = _mm256_cvtps_epi32 (_mm256_mul_ps (_mm256_cvtepi32_ps (lo), g));
+        hi = _mm256_cvtps_epi32 (_mm256_mul_ps (_mm256_cvtepi32_ps (hi), g));
+
+        /* packs works per 128-bit lane; restore the sample order */
+        __m256i packed = _mm256_permute4x64_epi64 (_mm256_packs_epi32 (lo, hi), 0xd8);
+        _mm256_storeu_si256 ((__m256i *) (data + i), packed);
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+static int volume_s32_avx2 (int32_t * data, int i, int samples, const float gain[2])
+{
+    __m256 g = _mm256_setr_ps (gain[0], gain[1], gain[0], gain[1],
+     gain[0], gain[1], gain[0], gain[1]);
+    __m256 limit = _mm256_set1_ps (S32_LIMIT);
+
+    for (; i + 8 <= samples; i += 8)
+    {
+        __m256i v = _mm256_loadu_si256 ((const __m256i *) (data + i));
+        __m256 f = _mm256_min_ps (_mm256_mul_ps (_mm256_cvtepi32_ps (v), g), limit);
+        _mm256_storeu_si256 ((__m256i *) (data + i), _mm256_cvtps_epi32 (f));
+    }
+
+    return i;
+}
+
+static bool have_avx2 ()
+{
+    static bool result = __builtin_cpu_supports ("avx2");
+    return result;
+}
+
+#endif // HAVE_AVX2_DISPATCH
+
+/* ---- NEON ---- */
+
+#ifdef HAVE_NEON
+
+static float32x4_t neon_gain (const float gain[2])
+{
+    const float g[4] = {gain[0], gain[1], gain[0], gain[1]};
+    return vld1q_f32 (g);
+}
+
+static int volume_float_neon (float * data, int i, int samples, const float gain[2])
+{
+    float32x4_t g = neon_gain (gain);
+
+    for (; i + 4 <= samples; i += 4)
+        vst1q_f32 (data + i, vmulq_f32 (vld1q_f32 (data + i), g));
+
+    return i;
+}
+
+static int volume_s16_neon (int16_t * data, int i, int samples, const float gain[2])
+{
+    float32x4_t g = neon_gain (gain);
+
+    for (; i + 8 <= samples; i += 8)
+    {
+        int16x8_t v = vld1q_s16 (data + i);
+        float32x4_t lo = vmulq_f32 (vcvtq_f32_s32 (vmovl_s16 (vget_low_s16 (v))), g);
+        float32x4_t hi = vmulq_f32 (vcvtq_f32_s32 (vmovl_s16 (vget_high_s16 (v))), g);
+
+        vst1q_s16 (data + i, vcombine_s16 (vqmovn_s32 (vcvtq_s32_f32 (lo)),
+         vqmovn_s32 (vcvtq_s32_f32 (hi))));
+    }
+
+    return i;
+}
+
+static int volume_s32_neon (int32_t * data, int i, int samples, const float gain[2])
+{
+    float32x4_t g = neon_gain (gain);
+
+    /* vcvtq_s32_f32 saturates, so no explicit limit is needed */
+    for (; i + 4 <= samples; i += 4)
+        vst1q_s32 (data + i, vcvtq_s32_f32 (vmulq_f32 (vcvtq_f32_s32 (vld1q_s32 (data + i)), g)));
+
+    return i;
+}
+
+#endif // HAVE_NEON
+
+void apply_volume (void * data, int samples, int format, int channels,
+ float left, float right)
+{
+    const float gain[2] = {left, (channels == 2) ? right : left};
+    int i = 0;
+
+    switch (format)
+    {
+    case FMT_FLOAT:
+#ifdef HAVE_AVX2_DISPATCH
+        if (have_avx2 ())
+            i = volume_float_avx2 ((float *) data, i, samples, gain);
+#endif
+#ifdef __SSE2__
+        i = volume_float_sse2 ((float *) data, i, samples, gain);
+#endif
+#ifdef HAVE_NEON
+        i = volume_float_neon ((float *) data, i, samples, gain);
+#endif
+        volume_float_c ((float *) data, i, samples, gain);
+        break;
+
+    case FMT_S16_NE:
+#ifdef HAVE_AVX2_DISPATCH
+        if (have_avx2 ())
+            i = volume_s16_avx2 ((int16_t *) data, i, samples, gain);
+#endif
+#ifdef __SSE2__
+        i = volume_s16_sse2 ((int16_t *) data, i, samples, gain);
+#endif
+#ifdef HAVE_NEON
+        i = volume_s16_neon ((int16_t *) data, i, samples, gain);
+#endif
+        volume_s16_c ((int16_t *) data, i, samples, gain);
+        break;
+
+    case FMT_S32_NE:
+#ifdef HAVE_AVX2_DISPATCH
+        if (have_avx2 ())
+            i = volume_s32_avx2 ((int32_t *) data, i, samples, gain);
+#endif
+#ifdef __SSE2__
+        i = volume_s32_sse2 ((int32_t *) data, i, samples, gain);
+#endif
+#ifdef HAVE_NEON
+        i = volume_s32_neon ((int32_t *) data, i, samples, gain);
+#endif
+        volume_s32_c ((int32_t *) data, i, samples, gain);
+        break;
+    }
+}
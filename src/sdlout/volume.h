@@ -0,0 +1,29 @@
+/*
+ * Software volume kernels for the SDL output plugin
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef SDLOUT_VOLUME_H
+#define SDLOUT_VOLUME_H
+
+/* Scales interleaved samples of the given format (FMT_S16_NE, FMT_S32_NE or
+ * FMT_FLOAT) in place.  For stereo data, even samples are scaled by <left>
+ * and odd samples by <right>; otherwise every sample is scaled by <left>.
+ * Safe to call from the audio callback: no locks, no allocation. */
+void apply_volume (void * data, int samples, int format, int channels,
+ float left, float right);
+
+#endif
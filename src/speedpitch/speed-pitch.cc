@@ -26,11 +26,16 @@
 #include <libfauxdcore/plugin.h>
 #include <libfauxdcore/preferences.h>
 
+#include "../dsp/dsp.h"
+#include "../dsp/sinc-resampler.h"
+#include "wsola.h"
+
 /* The general idea of the speed change algorithm is to divide the input signal
  * into pieces, spaced at a time interval A, using a cosine-shaped window
  * function.  The pieces are then reassembled by adding them together again,
  * spaced at another time interval B.  By varying the ratio A:B, we change the
- * speed of the audio. */
+ * speed of the audio.  The optional WSOLA mode (see wsola.h) also lines up the
+ * pieces with each other, at some extra cost. */
 
 #define FREQ    10
 #define OVERLAP  3
@@ -80,13 +85,23 @@ EXPORT SpeedPitch aud_plugin_instance;
 static double semitones;
 static int curchans, currate;
 static SRC_STATE * srcstate;
+static SincResampler sinc;
+static bool use_sinc;
+static WSOLA wsola;
+static bool use_wsola;
 static int outstep, width;
 static Index<float> cosine;
 static Index<audio_sample> in, out;
 static int src, dst;
 
-static void add_data (Index<audio_sample> & b_out, Index<audio_sample> & data, float ratio)
+static void add_data (Index<audio_sample> & b_out, Index<audio_sample> & data, float ratio, bool ending)
 {
+    if (use_sinc)
+    {
+        sinc.process (data.begin (), data.len () / curchans, ratio, ending, b_out);
+        return;
+    }
+
     int oldlen = b_out.len ();
     int inframes = data.len () / curchans;
     int maxframes = (int) (inframes * ratio) + 256;
@@ -94,13 +109,7 @@ static void add_data (Index<audio_sample> & b_out, Index<audio_sample> & data, f
 #ifdef DEF_AUDIO_FLOAT64
     static Index<float> floatbuf_in;
     floatbuf_in.resize (data.len ());
-    float * fout = floatbuf_in.begin ();
-    audio_sample * fin = data.begin ();
-    const audio_sample * fend = data.end ();
-    while (fin < fend)
-    {
-        *(fout++) = *(fin++);
-    }
+    dsp_to_float (data.begin (), floatbuf_in.begin (), data.len ());
     static Index<float> floatbuf_out;
     floatbuf_out.resize (maxframes * curchans);
 
@@ -125,13 +134,7 @@ static void add_data (Index<audio_sample> & b_out, Index<audio_sample> & data, f
 #ifdef DEF_AUDIO_FLOAT64
     floatbuf_in.resize (0);
     b_out.resize (oldlen + srcd.output_frames_gen * curchans);
-    float * ain = floatbuf_out.begin ();
-    audio_sample * aout = & b_out[oldlen];
-    const audio_sample * aend = aout + (srcd.output_frames_gen * curchans);
-    while (aout < aend)
-    {
-        *(aout++) = *(ain++);
-    }
+    dsp_from_float (floatbuf_out.begin (), & b_out[oldlen], srcd.output_frames_gen * curchans);
     floatbuf_out.resize (0);
 #else
     b_out.resize (oldlen + srcd.output_frames_gen * curchans);
@@ -141,6 +144,8 @@ static void add_data (Index<audio_sample> & b_out, Index<audio_sample> & data, f
 bool SpeedPitch::flush (bool force)
 {
     src_reset (srcstate);
+    sinc.reset ();
+    wsola.reset ();
 
     in.resize (0);
     out.resize (0);
@@ -166,6 +171,15 @@ void SpeedPitch::start (int & chans, int & rate)
 
     srcstate = src_new (SRC_LINEAR, curchans, nullptr);
 
+    use_sinc = aud_get_bool (CFGSECT, "builtin");
+    sinc.setup (curchans, SincResampler::Fast);
+
+    use_wsola = aud_get_bool (CFGSECT, "wsola");
+    if (use_wsola)
+        wsola.setup (curchans, currate);
+    else
+        wsola.clear ();
+
     /* Calculate the width of the cosine window and the spacing interval for
      * output.  Make them both even numbers for convenience.  Note that the
      * cosine window is applied without deinterleaving the audio samples. */
@@ -188,7 +202,7 @@ Index<audio_sample> & SpeedPitch::process (Index<audio_sample> & data, bool endi
     float speed = aud_get_double (CFGSECT, "speed");
 
     /* Copy the passed audio to the input buffer, scaled to adjust pitch. */
-    add_data (in, data, 1.0 / pitch);
+    add_data (in, data, 1.0 / pitch, ending);
 
     if (! aud_get_bool (CFGSECT, "decouple"))
     {
@@ -196,6 +210,14 @@ Index<audio_sample> & SpeedPitch::process (Index<audio_sample> & data, bool endi
         return data;
     }
 
+    if (use_wsola)
+    {
+        data.resize (0);
+        wsola.process (in.begin (), in.len () / curchans, speed / pitch, ending, data);
+        in.resize (0);
+        return data;
+    }
+
     /* Calculate the spacing interval for input. */
     int instep = (int) round ((outstep / curchans) * speed / pitch) * curchans;
 
@@ -245,6 +267,12 @@ int SpeedPitch::adjust_delay (int delay)
     int in_samples = in.len () - src;
     int out_samples = dst;
 
+    if (use_wsola)
+    {
+        in_samples = in.len () + wsola.input_frames () * curchans;
+        out_samples = wsola.output_frames () * curchans;
+    }
+
     return (delay + in_samples * samples_to_ms) * speed + out_samples * samples_to_ms;
 }
 
@@ -275,6 +303,12 @@ const char * const SpeedPitch::defaults[] = {
  "decouple", "TRUE",
  "speed", "1",
  "pitch", "1",
+ "wsola", "FALSE",
+#ifdef DEF_AUDIO_FLOAT64
+ "builtin", "TRUE",
+#else
+ "builtin", "FALSE",
+#endif
  nullptr};
 
 const PreferencesWidget SpeedPitch::widgets[] = {
@@ -285,6 +319,9 @@ const PreferencesWidget SpeedPitch::widgets[] = {
         WidgetFloat (CFGSECT, "speed", nullptr, "speed-pitch set speed"),
         {MINSPEED, MAXSPEED, 0.05},
         WIDGET_CHILD),
+    WidgetCheck (N_("Align waveforms (WSOLA)"),
+        WidgetBool (CFGSECT, "wsola"),
+        WIDGET_CHILD),
     WidgetLabel (N_("<b>Pitch</b>")),
     WidgetSpin (nullptr,
         WidgetFloat (semitones, semitones_changed, "speed-pitch set semitones"),
@@ -292,7 +329,9 @@ const PreferencesWidget SpeedPitch::widgets[] = {
     WidgetSpin (N_("Multiplier:"),
         WidgetFloat (CFGSECT, "pitch", pitch_changed, "speed-pitch set pitch"),
         {MINPITCH, MAXPITCH, 0.005},
-        WIDGET_CHILD)
+        WIDGET_CHILD),
+    WidgetCheck (N_("Use built-in resampler (full precision)"),
+        WidgetBool (CFGSECT, "builtin"))
 };
 
 const PluginPreferences SpeedPitch::prefs = {{widgets}};
@@ -311,6 +350,8 @@ void SpeedPitch::cleanup ()
 
     srcstate = nullptr;
 
+    sinc.clear ();
+    wsola.clear ();
     cosine.clear ();
     in.clear ();
     out.clear ();
@@ -0,0 +1,276 @@
+/*
+ * WSOLA time stretching for the Speed and Pitch plugin
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "wsola.h"
+#include "../dsp/dsp.h"
+
+#define WINDOW_MS 20
+#define SEEK_MS 10
+#define DECIMATE 4
+
+/* the speed-pitch plugin asks for at most 2.0 / 0.5 */
+#define MAX_SPEED 4
+
+void WSOLA::setup (int channels, int rate)
+{
+    m_channels = channels;
+
+    /* even, and a multiple of DECIMATE for the coarse search */
+    m_width = aud::max (rate * WINDOW_MS / 1000 / (2 * DECIMATE), 1) * 2 * DECIMATE;
+    m_hop = m_width / 2;
+    m_seek = aud::max (rate * SEEK_MS / 1000 / DECIMATE, 1) * DECIMATE;
+
+    /* a periodic Hann window, which adds up to 1 at half overlap */
+    m_window.resize (m_width * channels);
+    for (int i = 0; i < m_width; i ++)
+    {
+        float w = 0.5 - 0.5 * cos (2 * M_PI * i / m_width);
+        for (int c = 0; c < channels; c ++)
+            m_window[i * channels + c] = w;
+    }
+
+    /* one piece reaches from the end of the last (the reference) to the far
+     * end of the search, past a hop of up to MAX_SPEED; the rest is room to
+     * write into */
+    m_size = 2 * (MAX_SPEED * m_hop + 2 * m_seek + m_width);
+
+    m_ring.resize (2 * m_size * channels);
+    m_mono.resize (2 * m_size);
+
+    m_ref.resize (m_hop / DECIMATE);
+    m_region.resize ((m_hop + 2 * m_seek) / DECIMATE);
+    m_overlap.resize (m_width * channels);
+
+    reset ();
+}
+
+void WSOLA::reset ()
+{
+    m_write = m_read = 0;
+    m_end = INT64_MAX;
+    m_prev = -1;
+    m_nominal = 0;
+
+    for (audio_sample & s : m_overlap)
+        s = 0;
+
+    /* the first piece is half silence, so that the audio starts at full
+     * level under its falling half; its rising half is not output */
+    if (m_size)
+        write (nullptr, m_hop);
+
+    m_skip = true;
+}
+
+void WSOLA::clear ()
+{
+    m_size = 0;
+
+    m_window.clear ();
+    m_ring.clear ();
+    m_mono.clear ();
+    m_ref.clear ();
+    m_region.clear ();
+    m_overlap.clear ();
+}
+
+/* <in> null means silence */
+void WSOLA::write (const audio_sample * in, int frames)
+{
+    const int ch = m_channels;
+
+    while (frames)
+    {
+        int at = m_write % m_size;
+        int n = aud::min (frames, m_size - at);
+
+        audio_sample * a = & m_ring[at * ch];
+        audio_sample * b = & m_ring[(at + m_size) * ch];
+        float * mono = & m_mono[at];
+
+        if (in)
+        {
+            memcpy (a, in, sizeof (audio_sample) * n * ch);
+            memcpy (b, in, sizeof (audio_sample) * n * ch);
+
+            for (int i = 0; i < n; i ++)
+            {
+                float sum = 0;
+                for (int c = 0; c < ch; c ++)
+                    sum += in[i * ch + c];
+
+                mono[i] = mono[i + m_size] = sum;
+            }
+
+            in += n * ch;
+        }
+        else
+        {
+            memset (a, 0, sizeof (audio_sample) * n * ch);
+            memset (b, 0, sizeof (audio_sample) * n * ch);
+
+            for (int i = 0; i < n; i ++)
+                mono[i] = mono[i + m_size] = 0;
+        }
+
+        m_write += n;
+        frames -= n;
+    }
+}
+
+/* where around <nominal> the next piece best continues the last one */
+int64_t WSOLA::search (int64_t nominal)
+{
+    if (m_prev < 0)
+        return nominal;
+
+    int64_t lo = aud::max (nominal - m_seek, m_read);
+    int64_t hi = nominal + m_seek;
+
+    /* the reference is the input that followed the overlapping half of the
+     * last piece */
+    const float * ref = & m_mono[(m_prev + m_hop) % m_size];
+    const float * region = & m_mono[lo % m_size];
+
+    /* coarse: averages of DECIMATE frames, every DECIMATE frames */
+    int ref_len = m_ref.len ();
+    int region_len = aud::min ((int) (hi - lo) + m_hop, m_region.len () * DECIMATE) / DECIMATE;
+
+    for (int i = 0; i < ref_len; i ++)
+    {
+        float sum = 0;
+        for (int d = 0; d < DECIMATE; d ++)
+            sum += ref[i * DECIMATE + d];
+
+        m_ref[i] = sum;
+    }
+
+    for (int i = 0; i < region_len; i ++)
+    {
+        float sum = 0;
+        for (int d = 0; d < DECIMATE; d ++)
+            sum += region[i * DECIMATE + d];
+
+        m_region[i] = sum;
+    }
+
+    int best = 0;
+    float best_score = -INFINITY;
+
+    for (int k = 0; k + ref_len <= region_len; k ++)
+    {
+        float cross, energy;
+        dsp_correlate (m_ref.begin (), & m_region[k], ref_len, cross, energy);
+
+        float score = cross / sqrtf (energy + 1e-9f);
+        if (score > best_score)
+        {
+            best = k * DECIMATE;
+            best_score = score;
+        }
+    }
+
+    /* fine: every frame within DECIMATE of the coarse match */
+    int fine_lo = aud::max (best - DECIMATE + 1, 0);
+    int fine_hi = aud::min (best + DECIMATE - 1, (int) (hi - lo));
+
+    best_score = -INFINITY;
+
+    for (int k = fine_lo; k <= fine_hi; k ++)
+    {
+        float cross, energy;
+        dsp_correlate (ref, region + k, m_hop, cross, energy);
+
+        float score = cross / sqrtf (energy + 1e-9f);
+        if (score > best_score)
+        {
+            best = k;
+            best_score = score;
+        }
+    }
+
+    return lo + best;
+}
+
+void WSOLA::hop (double speed, Index<audio_sample> & out)
+{
+    const int ch = m_channels;
+
+    int64_t pos = search ((int64_t) m_nominal);
+
+    dsp_window_add (m_overlap.begin (), & m_ring[(pos % m_size) * ch], m_window.begin (),
+     m_width * ch);
+
+    /* the first half now has both pieces in it */
+    if (! m_skip)
+        out.insert (m_overlap.begin (), -1, m_hop * ch);
+
+    m_skip = false;
+
+    memmove (& m_overlap[0], & m_overlap[m_hop * ch], sizeof (audio_sample) * m_hop * ch);
+    memset (& m_overlap[m_hop * ch], 0, sizeof (audio_sample) * m_hop * ch);
+
+    m_prev = pos;
+    m_nominal += m_hop * aud::min (speed, (double) MAX_SPEED);
+
+    /* keep the reference and the next search region */
+    m_read = aud::max (m_read, aud::min (m_prev + m_hop, (int64_t) m_nominal - m_seek));
+}
+
+void WSOLA::feed (const audio_sample * in, int frames, double speed, Index<audio_sample> & out)
+{
+    const int ch = m_channels;
+
+    while (1)
+    {
+        while ((int64_t) m_nominal < m_end &&
+         (int64_t) m_nominal + m_seek + m_width <= m_write)
+            hop (speed, out);
+
+        if (! frames || (int64_t) m_nominal >= m_end)
+            break;
+
+        int n = aud::min (frames, m_size - (int) (m_write - m_read));
+
+        write (in, n);
+
+        if (in)
+            in += n * ch;
+
+        frames -= n;
+    }
+}
+
+void WSOLA::process (const audio_sample * in, int frames, double speed, bool ending,
+ Index<audio_sample> & out)
+{
+    feed (in, frames, speed, out);
+
+    if (ending)
+    {
+        /* pieces past the end see silence */
+        m_end = m_write;
+        feed (nullptr, m_seek + m_width, speed, out);
+
+        out.insert (m_overlap.begin (), -1, m_hop * m_channels);
+        reset ();
+    }
+}
@@ -0,0 +1,84 @@
+/*
+ * WSOLA time stretching for the Speed and Pitch plugin
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef __WSOLA_H__GUARD
+#define __WSOLA_H__GUARD
+
+#include <stdint.h>
+
+#include <libfauxdcore/audio.h>
+#include <libfauxdcore/index.h>
+
+/*
+ * Waveform-similarity overlap-add: like the plain overlap-add in
+ * speed-pitch.cc, the input is cut into Hann-windowed pieces which are laid
+ * down again at a fixed spacing, but each piece is moved (by up to SEEK_MS)
+ * to where it best continues the one before, so that the pieces add up in
+ * phase instead of interfering.  The best position is found by correlating
+ * a decimated mono mix first and then refining at the full rate.
+ *
+ * All buffers are allocated in setup(); the input is kept in a ring that is
+ * written twice over (at i and i + size), so that any piece of it can be
+ * read as one contiguous block.
+ */
+class WSOLA
+{
+public:
+    void setup (int channels, int rate);
+    void reset ();
+    void clear ();
+
+    /* appends the output for <frames> more frames of input to <out>, where
+     * <speed> input frames make up one output frame; with <ending>, also
+     * what is held back, after which the state is as after reset() */
+    void process (const audio_sample * in, int frames, double speed, bool ending,
+     Index<audio_sample> & out);
+
+    /* input frames not yet passed, and output frames not yet complete */
+    int input_frames () const
+        { return (int) (m_write - (int64_t) m_nominal); }
+    int output_frames () const
+        { return m_hop; }
+
+private:
+    void feed (const audio_sample * in, int frames, double speed, Index<audio_sample> & out);
+    void write (const audio_sample * in, int frames);
+    int64_t search (int64_t nominal);
+    void hop (double speed, Index<audio_sample> & out);
+
+    int m_channels = 0;
+    int m_width = 0, m_hop = 0, m_seek = 0;  // frames
+
+    Index<float> m_window;       // m_width * m_channels, interleaved
+
+    int m_size = 0;              // of the ring, in frames
+    Index<audio_sample> m_ring;  // 2 * m_size * m_channels
+    Index<float> m_mono;         // 2 * m_size, for the search
+
+    Index<float> m_ref, m_region;    // decimated, for the coarse search
+    Index<audio_sample> m_overlap;   // the output not yet complete
+
+    int64_t m_write = 0;         // absolute frame, next to be written
+    int64_t m_read = 0;          // oldest kept
+    int64_t m_end = 0;           // when ending, the end of the real input
+    int64_t m_prev = -1;         // where the last piece was taken, or -1
+    double m_nominal = 0;        // where the next piece would be taken unaligned
+    bool m_skip = false;         // the first piece's rising half
+};
+
+#endif
@@ -7,6 +7,8 @@
 #include <libfauxdcore/plugin.h>
 #include <libfauxdcore/preferences.h>
 
+#include "../dsp/dsp.h"
+
 class ExtraStereo : public EffectPlugin
 {
 public:
@@ -64,21 +66,16 @@ void ExtraStereo::start (int & channels, int & rate)
 
 Index<audio_sample> & ExtraStereo::process(Index<audio_sample> & data)
 {
-    audio_sample value = aud_get_double ("extra_stereo", "intensity");
-    audio_sample * f, * end;
-    audio_sample center;
+    float value = aud_get_double ("extra_stereo", "intensity");
 
     if (stereo_channels != 2)
         return data;
 
-    end = data.end ();
+    /* center + (side - center) * value, with center = (left + right) / 2 */
+    float same = (1 + value) / 2, other = (1 - value) / 2;
+    const float matrix[4] = {same, other, other, same};
 
-    for (f = data.begin (); f < end; f += 2)
-    {
-        center = (f[0] + f[1]) / 2;
-        f[0] = center + (f[0] - center) * value;
-        f[1] = center + (f[1] - center) * value;
-    }
+    dsp_mat2x2 (data.begin (), data.len () / 2, matrix);
 
     return data;
 }
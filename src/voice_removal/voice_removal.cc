@@ -21,6 +21,8 @@
 #include <libfauxdcore/i18n.h>
 #include <libfauxdcore/plugin.h>
 
+#include "../dsp/dsp.h"
+
 class VoiceRemoval : public EffectPlugin
 {
 public:
@@ -49,13 +51,9 @@ Index<audio_sample> & VoiceRemoval::process (Index<audio_sample> & data)
     if (voice_channels != 2)
         return data;
 
-    const audio_sample * end = data.end ();
-
-    for (audio_sample * f = data.begin (); f < end; f += 2)
-    {
-        f[0] -= f[1];
-        f[1] = f[0];
-    }
+    /* both channels become left minus right */
+    static const float matrix[4] = {1, -1, 1, -1};
+    dsp_mat2x2 (data.begin (), data.len () / 2, matrix);
 
     return data;
 }
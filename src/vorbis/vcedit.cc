@@ -212,6 +212,121 @@ bool VCEdit::open(VFSFile &in)
     return true;
 }
 
+/* Overwrites the comment header in the header pages already in the file,
+ * if the new one is no longer than the old one (with any padding it had).
+ * It is padded with zeros after the framing bit to exactly the old length,
+ * so every page keeps its lacing values and length and only needs a new
+ * CRC; the audio pages are not touched.  Returns false without writing
+ * anything if that's not possible, with the read position left where it
+ * was (for write()). */
+bool VCEdit::write_in_place(VFSFile &file)
+{
+    struct Page {
+        int64_t offset;
+        Index<unsigned char> header;
+        int body_start, body_len;  /* within <bodies> */
+    };
+
+    Index<Page> pages;
+    Index<unsigned char> bodies;   /* pages after the first, back to back */
+    int64_t resume = file.ftell();
+    int64_t offset = 0;
+    int packets = 0, packet_len = 0, comment_len = -1;
+    ogg_packet op;
+    bool ok = false;
+
+    op.packet = nullptr;
+
+    /* the first page holds only the identification header; the comment
+     * and setup headers follow, ending a page before the first audio */
+    for (int n = 0; packets < 2; n++) {
+        unsigned char head[27 + 255];
+
+        if (file.fseek(offset, VFS_SEEK_SET) < 0 || file.fread(head, 1, 27) != 27 ||
+            memcmp(head, "OggS", 4) || head[4] != 0)
+            goto done;
+
+        int segments = head[26];
+        if (file.fread(head + 27, 1, segments) != segments)
+            goto done;
+
+        int page_serial = (int) (head[14] | head[15] << 8 | head[16] << 16 | (uint32_t) head[17] << 24);
+        if (page_serial != serial)
+            goto done;  /* multiplexed */
+
+        int body_len = 0;
+        for (int i = 0; i < segments; i++)
+            body_len += head[27 + i];
+
+        if (n > 0) {
+            for (int i = 0; i < segments; i++) {
+                if (packets == 2)
+                    goto done;  /* audio data shares the page */
+
+                packet_len += head[27 + i];
+                if (head[27 + i] < 255) {
+                    if (!packets)
+                        comment_len = packet_len;
+                    packets++;
+                    packet_len = 0;
+                }
+            }
+
+            Page &page = pages.append();
+            page.offset = offset;
+            page.header.insert(head, 0, 27 + segments);
+            page.body_start = bodies.len();
+            page.body_len = body_len;
+
+            bodies.insert(-1, body_len);
+            if (file.fread(bodies.begin() + page.body_start, 1, body_len) != body_len)
+                goto done;
+        }
+
+        offset += 27 + segments + body_len;
+    }
+
+    _commentheader_out(&vc, vendor, &op);
+
+    if (op.bytes > comment_len)
+        goto done;
+
+    memcpy(bodies.begin(), op.packet, op.bytes);
+    memset(bodies.begin() + op.bytes, 0, comment_len - op.bytes);
+
+    for (Page &page : pages) {
+        if (page.body_start >= comment_len)
+            break;  /* only the setup header from here on */
+
+        ogg_page og;
+        og.header = page.header.begin();
+        og.header_len = page.header.len();
+        og.body = bodies.begin() + page.body_start;
+        og.body_len = page.body_len;
+
+        ogg_page_checksum_set(&og);
+
+        if (file.fseek(page.offset, VFS_SEEK_SET) < 0 ||
+            file.fwrite(og.header, 1, og.header_len) != og.header_len ||
+            file.fwrite(og.body, 1, og.body_len) != og.body_len) {
+            lasterror = "Error writing header pages. "
+             "Output stream may be corrupted.";
+            ogg_packet_clear(&op);
+            return false;
+        }
+    }
+
+    ok = (file.fflush() == 0);
+
+  done:
+    if (op.packet)
+        ogg_packet_clear(&op);
+    if (!ok)
+        file.fseek(resume, VFS_SEEK_SET);
+
+    return ok;
+}
+
 bool VCEdit::write(VFSFile &in, VFSFile &out)
 {
     ogg_stream_state streamout;
@@ -28,6 +28,7 @@ public:
 
     bool open(VFSFile &in);
     bool write(VFSFile &in, VFSFile &out);
+    bool write_in_place(VFSFile &file);
 
 private:
     ogg_sync_state   oy;
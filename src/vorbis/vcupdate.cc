@@ -205,6 +205,15 @@ bool VorbisPlugin::write_tuple (const char * filename, VFSFile & file, const Tup
 
     dictionary_to_vorbis_comment (& edit.vc, dict);
 
+    /* rewriting the whole file is needed only if the comments grew */
+    if (edit.write_in_place (file))
+        return true;
+    if (edit.lasterror)
+    {
+        AUDERR ("Tag update failed: %s.\n", edit.lasterror);
+        return false;
+    }
+
     auto temp_vfs = VFSFile::tmpfile ();
     if (! temp_vfs)
         return false;